@@ -32,6 +32,7 @@ void basic_playback() {
     // defaults to 0, which means the effect will only be played once
     audeo::Sound effect = audeo::play_sound(effect_source);
 
-    // Idle loop so that we don't quit the application before the music stops.
-    while (audeo::is_playing_music()) {}
+    // Wait so that we don't quit the application before the music stops.
+    // audeo::wait_for() blocks until the sound finished, without using any CPU
+    audeo::wait_for(music);
 }
@@ -13,7 +13,6 @@ void effects() {
     // does not work well. Contributions are always welcome
 	// audeo::add_effect(sound, audeo::Effect::Echo);
 
-    while (true) {
-        // Idle loop
-    }
+    // The sound loops forever, so this waits until the application is closed
+    audeo::wait_for(sound);
 }
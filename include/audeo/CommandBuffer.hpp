@@ -0,0 +1,137 @@
+#ifndef AUDEO_COMMAND_BUFFER_HPP_
+#define AUDEO_COMMAND_BUFFER_HPP_
+
+#include "Sound.hpp"
+#include "SoundEngine.hpp"
+#include "SoundSource.hpp"
+#include "vec3.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace audeo {
+
+namespace detail {
+struct EngineState;
+} // namespace detail
+
+// Commands collected during a frame, and applied at once with submit(). This
+// is cheaper than the separate functions for many updates: the audio device is
+// locked once for all volume and position changes, every sound is moved at most
+// once, and sounds are moved in channel order. Plays and stops are applied
+// first, in the order they were added. Then volumes, then positions, where the
+// last position of a sound wins.
+//
+// The sounds of plays don't exist before the buffer is submitted, so commands
+// for them take the PlayIndex returned by play() instead. Volumes and
+// positions of those sounds are applied by the play itself, so the sound
+// starts out with them.
+//
+// Reuse a buffer every frame to avoid allocating. submit() clears it
+class CommandBuffer {
+public:
+    // A play added to the buffer. Only valid for commands of the same buffer,
+    // until it is submitted or cleared
+    struct PlayIndex {
+        // Index of the play in played_sounds()
+        std::size_t value = 0;
+    };
+
+    // Plays a source when the buffer is submitted
+    PlayIndex play(SoundSource source, int loop_count = 0, int fade_in_ms = 0) {
+        play_commands.push_back(commands.size());
+        Command& command = commands.emplace_back();
+        command.type = CommandType::Play;
+        command.source = source;
+        command.loop_count = loop_count;
+        command.fade_ms = fade_in_ms;
+        return PlayIndex {play_commands.size() - 1};
+    }
+
+    PlayIndex play(SoundSource source, loop_forever_t, int fade_in_ms = 0) {
+        return play(source, -1, fade_in_ms);
+    }
+
+    void stop(Sound sound, int fade_out_ms = 0) {
+        Command& command = commands.emplace_back();
+        command.type = CommandType::Stop;
+        command.sound = sound;
+        command.fade_ms = fade_out_ms;
+    }
+
+    void stop(PlayIndex play, int fade_out_ms = 0) {
+        Command& command = commands.emplace_back();
+        command.type = CommandType::Stop;
+        command.play = play.value;
+        command.fade_ms = fade_out_ms;
+    }
+
+    void set_volume(Sound sound, float volume) {
+        Command& command = commands.emplace_back();
+        command.type = CommandType::SetVolume;
+        command.sound = sound;
+        command.volume = volume;
+    }
+
+    void set_position(Sound sound, vec3f position) {
+        Command& command = commands.emplace_back();
+        command.type = CommandType::SetPosition;
+        command.sound = sound;
+        command.position = position;
+    }
+
+    void set_position(Sound sound, float x, float y, float z) { set_position(sound, {x, y, z}); }
+
+    void set_volume(PlayIndex play, float volume) {
+        commands[play_commands[play.value]].volume = volume;
+    }
+
+    void set_position(PlayIndex play, vec3f position) {
+        commands[play_commands[play.value]].position = position;
+    }
+
+    void set_position(PlayIndex play, float x, float y, float z) {
+        set_position(play, {x, y, z});
+    }
+
+    // The sounds started by the plays of the last submit(), in the order they
+    // were added. Plays that failed have an invalid sound
+    std::vector<Sound> const& played_sounds() const { return played; }
+
+    std::size_t size() const { return commands.size(); }
+    bool empty() const { return commands.empty(); }
+
+    // Drops the commands that weren't submitted
+    void clear() {
+        commands.clear();
+        play_commands.clear();
+    }
+
+private:
+    friend struct detail::EngineState;
+
+    enum class CommandType { Play, Stop, SetVolume, SetPosition };
+
+    struct Command {
+        CommandType type = CommandType::Play;
+        Sound sound;
+        // Index of the play whose sound a Stop applies to, instead of sound
+        std::optional<std::size_t> play;
+        SoundSource source;
+        int loop_count = 0;
+        int fade_ms = 0;
+        // Plays only override the source's defaults if these are set
+        std::optional<float> volume;
+        std::optional<vec3f> position;
+    };
+
+    std::vector<Command> commands;
+    // Index in commands of every play
+    std::vector<std::size_t> play_commands;
+    std::vector<Sound> played;
+};
+
+} // namespace audeo
+
+#endif
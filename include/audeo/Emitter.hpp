@@ -0,0 +1,41 @@
+#ifndef AUDEO_EMITTER_HPP_
+#define AUDEO_EMITTER_HPP_
+
+#include <cstdint>
+#include <functional>
+
+namespace audeo {
+
+// Handle to a persistent sound emitter in the world. Unlike a Sound, an emitter
+// stays valid when it is too far away to be heard, see create_emitter()
+class Emitter {
+public:
+    Emitter() : handle(-1) {}
+    Emitter(std::int64_t handle) : handle(handle) {}
+    Emitter(Emitter const&) = default;
+    Emitter(Emitter&&) = default;
+
+    Emitter& operator=(Emitter const&) = default;
+    Emitter& operator=(Emitter&&) = default;
+
+    std::int64_t value() const { return handle; }
+
+    bool operator==(Emitter const& rhs) const { return handle == rhs.handle; }
+    bool operator!=(Emitter const& rhs) const { return handle != rhs.handle; }
+
+private:
+    std::int64_t handle;
+};
+
+} // namespace audeo
+
+namespace std {
+template<>
+struct hash<audeo::Emitter> {
+    size_t operator()(audeo::Emitter const& x) const {
+        return hash<std::int64_t>()(x.value());
+    }
+};
+} // namespace std
+
+#endif
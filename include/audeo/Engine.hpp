@@ -0,0 +1,183 @@
+#ifndef AUDEO_ENGINE_HPP_
+#define AUDEO_ENGINE_HPP_
+
+#include "SoundEngine.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace audeo {
+
+class Engine;
+
+namespace detail {
+struct EngineState;
+struct AdpcmBuffer;
+
+// Creates an effect source from samples that are already converted to the
+// output format of an engine initialized with init_offline(). Used by
+// render_scenes(), which decodes every file once for the engines of all scenes.
+// The source is compressed if adpcm holds the compressed samples
+SoundSource load_converted_source(Engine& engine,
+                                  std::string_view path,
+                                  std::shared_ptr<std::vector<std::uint8_t> const> pcm,
+                                  std::shared_ptr<AdpcmBuffer const> adpcm);
+} // namespace detail
+
+// An independent instance of the sound engine. Every engine owns its own
+// sources, sounds, emitters, listeners, callbacks and events. The functions do
+// what the free functions of the same name do, on this engine only. The free
+// functions use default_engine().
+//
+// An engine may be used from one thread at a time, and different engines from
+// different threads. SDL_Mixer only has a single audio device per process, so
+// only one engine can be initialized with init() at a time. init() fails for
+// the others until that engine calls quit(). Engines initialized with
+// init_offline() don't use the device, and any number of them can run side by
+// side. An engine that is still initialized calls quit() when it is destroyed
+class AUDEO_API Engine {
+public:
+    Engine();
+    ~Engine();
+
+    Engine(Engine const&) = delete;
+    Engine& operator=(Engine const&) = delete;
+    Engine(Engine&&) noexcept;
+    Engine& operator=(Engine&&) noexcept;
+
+    bool init(InitInfo const& info = InitInfo {});
+    // Initializes the engine without an audio device. Its output is mixed by
+    // render() on the calling thread, with the same voices, effects and
+    // spatialization as on the device, and always as floats. Ticks count the
+    // frames rendered, so fades and retrigger intervals are in output time.
+    // Only WAV files can be loaded, and music can't be played. The chunk size
+    // is the most frames render() mixes per audio callback
+    bool init_offline(InitInfo const& info = InitInfo {});
+    void quit();
+    // Mixes the next frame_count frames of an engine initialized with
+    // init_offline() into out, as interleaved floats with the engine's channel
+    // count. The output is not clipped
+    void render(float* out, std::size_t frame_count);
+
+    bool is_playing_music();
+    unsigned int effect_channel_count();
+    void allocate_effect_channels(unsigned int count);
+
+    // Sound sources
+
+    [[nodiscard]] SoundSource load_source(std::string_view path,
+                                          AudioType type,
+                                          SourceCompression compression = SourceCompression::None);
+    [[nodiscard]] std::unordered_map<std::string, SoundSource> load_bank(std::string_view path);
+    bool free_source(SoundSource source);
+    std::size_t free_unused_sources();
+    bool prefetch(SoundSource source);
+    void set_source_memory_budget(std::size_t bytes);
+    SourceCacheStats get_source_cache_stats();
+    EngineStats get_stats();
+    void reset_stats();
+    bool is_playing(SoundSource source);
+    bool source_is_music(SoundSource source);
+    bool set_default_volume(SoundSource source, float volume);
+    bool set_default_position(SoundSource source, float x, float y, float z);
+    bool set_default_position(SoundSource source, vec3f position);
+    bool set_default_distance_range_max(SoundSource source, float distance);
+    bool set_default_max_instances(SoundSource source,
+                                   unsigned int count,
+                                   InstanceLimitBehavior behavior = InstanceLimitBehavior::Reject);
+    bool set_default_min_retrigger_interval(SoundSource source, int interval_ms);
+
+    // Sounds
+
+    Sound play_sound(SoundSource source, int loop_count = 0, int fade_in_ms = 0);
+    Sound play_sound(SoundSource source, loop_forever_t, int fade_in_ms = 0);
+    bool is_valid(Sound sound);
+    bool is_valid(SoundSource source);
+    std::optional<float> get_volume(Sound sound);
+    std::optional<vec3f> get_position(Sound sound);
+    std::optional<float> get_pitch(Sound sound);
+    double get_output_latency();
+    std::optional<double> get_time_until_audible(Sound sound);
+    bool pause_sound(Sound sound);
+    bool resume_sound(Sound sound);
+    bool stop_sound(Sound sound, int fade_out_ms = 0);
+    bool set_volume(Sound sound, float volume);
+    bool set_position(Sound sound, vec3f position);
+    bool set_position(Sound sound, float x, float y, float z);
+    bool set_distance_range_max(Sound sound, float distance);
+    bool set_pitch(Sound sound, float pitch);
+    bool set_resample_quality(Sound sound, ResampleQuality quality);
+    void submit(CommandBuffer& buffer);
+
+    // Listeners
+
+    vec3f get_listener_position();
+    vec3f get_listener_forward();
+    vec3f get_listener_position(std::size_t listener);
+    vec3f get_listener_forward(std::size_t listener);
+    std::size_t get_listener_count();
+    void set_listener_position(vec3f new_position);
+    void set_listener_position(float new_x, float new_y, float new_z);
+    void set_listener_forward(vec3f new_forward);
+    void set_listener_forward(float new_x, float new_y, float new_z);
+    void set_listener_count(std::size_t count);
+    void set_listener_position(std::size_t listener, vec3f new_position);
+    void set_listener_forward(std::size_t listener, vec3f new_forward);
+
+    // Emitters
+
+    [[nodiscard]] Emitter create_emitter(SoundSource source, vec3f position);
+    bool destroy_emitter(Emitter emitter);
+    bool is_valid(Emitter emitter);
+    bool set_emitter_position(Emitter emitter, vec3f position);
+    std::optional<Sound> get_emitter_sound(Emitter emitter);
+    void update_emitters();
+
+    // Spatialization
+
+    bool load_hrtf(std::string_view directory);
+    void unload_hrtf();
+    bool is_hrtf_enabled();
+    bool enable_ambisonics(AmbisonicOrder order = AmbisonicOrder::First);
+    void disable_ambisonics();
+    bool is_ambisonics_enabled();
+    void set_occlusion_query(OcclusionQueryT query,
+                             OcclusionSettings const& settings = OcclusionSettings {});
+    void clear_occlusion_query();
+    std::optional<float> get_occlusion(Sound sound);
+
+    // Effects, callbacks and events
+
+    bool reverse_stereo(Sound sound, bool reverse = true);
+    bool add_effect(Sound sound, Effect effect);
+    void set_sound_finish_callback(SoundFinishCallbackT callback, void* user_data = nullptr);
+    void set_sound_finish_callback(std::function<void(Sound)> callback);
+    void set_event_callback(EventCallbackT callback);
+    std::size_t poll_events();
+    bool poll_event(Event& event);
+    bool wait_event(Event& event, int timeout_ms = -1);
+    bool wait_for(Sound sound, int timeout_ms = -1);
+    bool start_recording(std::string_view path);
+    void stop_recording();
+
+private:
+    friend SoundSource detail::load_converted_source(
+        Engine& engine,
+        std::string_view path,
+        std::shared_ptr<std::vector<std::uint8_t> const> pcm,
+        std::shared_ptr<detail::AdpcmBuffer const> adpcm);
+
+    std::unique_ptr<detail::EngineState> state;
+};
+
+// The engine the free functions in SoundEngine.hpp use. It is created on first
+// use, and never destroyed
+AUDEO_API Engine& default_engine();
+
+} // namespace audeo
+
+#endif
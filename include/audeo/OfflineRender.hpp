@@ -0,0 +1,142 @@
+#ifndef AUDEO_OFFLINE_RENDER_HPP_
+#define AUDEO_OFFLINE_RENDER_HPP_
+
+#include "SoundEngine.hpp"
+#include "export_import.hpp"
+#include "resampler.hpp"
+#include "vec3.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace audeo {
+
+enum class SceneCommandType {
+    // Plays a source. Sounds are numbered in the order they are played,
+    // starting at 0
+    Play,
+    // Stops a sound, fading it out over fade_ms milliseconds
+    Stop,
+    Pause,
+    Resume,
+    SetVolume,
+    SetPosition,
+    SetPitch,
+    SetDistanceRangeMax,
+    SetResampleQuality,
+    ReverseStereo,
+    AddEffect,
+    SetListenerPosition,
+    SetListenerForward,
+    SetListenerCount,
+    // Creates an emitter of a source. Emitters are numbered in the order they
+    // are created, starting at 0
+    CreateEmitter,
+    DestroyEmitter,
+    SetEmitterPosition,
+    UpdateEmitters,
+    LoadHrtf,
+    UnloadHrtf,
+    EnableAmbisonics,
+    DisableAmbisonics
+};
+
+// SceneCommand::sound of commands for the sound an emitter plays
+constexpr std::size_t emitter_sound = static_cast<std::size_t>(-1);
+
+// A single step of a scene. Fields that don't apply to the type are ignored
+struct SceneCommand {
+    SceneCommandType type = SceneCommandType::Play;
+    // The output frame at which the command takes effect
+    std::int64_t frame = 0;
+    // Index into Scene::sources, for Play and CreateEmitter
+    std::size_t source = 0;
+    // The sound the command applies to, or emitter_sound for the sound that
+    // emitter plays. Commands for sounds that weren't played yet, or that
+    // already finished, do nothing
+    std::size_t sound = 0;
+    // The emitter the command applies to. Commands for emitters that weren't
+    // created yet, or that were destroyed, do nothing
+    std::size_t emitter = 0;
+    // The listener moved by SetListenerPosition and SetListenerForward, or the
+    // amount of listeners for SetListenerCount
+    std::size_t listener = 0;
+    // Amount of extra loops for Play. -1 loops forever
+    int loop_count = 0;
+    // Fade in time for Play, fade out time for Stop
+    int fade_ms = 0;
+    // The new position of a sound, an emitter or a listener, the position of a
+    // new emitter, or a listener's forward vector
+    vec3f vector;
+    // The new volume, pitch or distance range. ReverseStereo reverses the
+    // channels unless it is 0
+    float value = 0.0f;
+    ResampleQuality quality = ResampleQuality::Sinc;
+    Effect effect = Effect::None;
+    AmbisonicOrder order = AmbisonicOrder::First;
+    // The HRTF directory for LoadHrtf
+    std::string path;
+};
+
+// A source used by a scene, with its default parameters
+struct SceneSource {
+    // Path to a WAV file
+    std::string path;
+    float volume = 1.0f;
+    // Default constructed to (0, 0, 0)
+    vec3f position;
+    float distance_range_max = 255;
+    SourceCompression compression = SourceCompression::None;
+    // See set_default_max_instances(). 0 means there is no limit
+    unsigned int max_instances = 0;
+    InstanceLimitBehavior limit_behavior = InstanceLimitBehavior::Reject;
+    int min_retrigger_interval_ms = 0;
+};
+
+// A scripted scene that is rendered without an audio device. The listener
+// starts at (0, 0, 0), facing (0, 0, -1)
+struct Scene {
+    std::vector<SceneSource> sources;
+    // Applied in order of their frame. Commands with the same frame are applied
+    // in the order they are listed in
+    std::vector<SceneCommand> commands;
+    // Length of the rendered output
+    std::int64_t frame_count = 0;
+};
+
+struct OfflineRenderInfo {
+    unsigned int frequency = 22050;
+    // 1, 2, 4, 6 or 8. Quad, 5.1 and 7.1 use SDL's channel order, like the
+    // engine does
+    unsigned int output_channels = 2;
+    ResampleQuality resample_quality = ResampleQuality::Sinc;
+    // Amount of threads scenes are rendered on. 0 uses one per core
+    unsigned int thread_count = 0;
+};
+
+// Renders every scene to interleaved float frames, frame_count *
+// output_channels samples per scene. Every scene is played by an engine of its
+// own that has no audio device, see Engine::init_offline(), so it sounds the
+// way the engine plays it live. Commands apply at their exact frame, and the
+// output is not clipped. Scenes are rendered in parallel, and every file is
+// decoded only once, no matter how many scenes use it. Throws if a source or
+// an HRTF set can't be loaded, and rethrows what rendering a scene threw
+AUDEO_API std::vector<std::vector<float>> render_scenes(std::vector<Scene> const& scenes,
+                                                        OfflineRenderInfo const& info = {});
+
+// Turns a log written with start_recording() into a scene that replays it, and
+// sets the frequency, channel count and resample quality of info to the ones it
+// was recorded with. Music is not replayed. Logs of engines that
+// used an occlusion query or a sound bank can't be replayed: the query is game
+// code, and banks are packed for the live output format. This throws for them.
+// A log that was cut short, for example by a crash, replays up to its last
+// complete call. Returns false if the file could not be read or is not a
+// command log of this version
+AUDEO_API bool load_recording(std::string_view path, Scene& scene, OfflineRenderInfo& info);
+
+} // namespace audeo
+
+#endif
@@ -1,25 +1,41 @@
 #ifndef AUDEO_SOUND_ENGINE_HPP_
 #define AUDEO_SOUND_ENGINE_HPP_
 
+#include "Emitter.hpp"
 #include "Sound.hpp"
 #include "SoundSource.hpp"
+#include "ambisonics.hpp"
 #include "exception.hpp"
 #include "export_import.hpp"
+#include "occlusion.hpp"
+#include "resampler.hpp"
 #include "vec3.hpp"
 
 #include <cstddef>
 #include <functional>
 #include <optional>
+#include <string>
 #include <string_view>
+#include <unordered_map>
 #include <utility>
 
 namespace audeo {
 
+class CommandBuffer;
+
 namespace detail {
-AUDEO_API inline void no_callback(Sound) {}
+AUDEO_API inline void no_callback(Sound, void*) {}
 } // namespace detail
 
-enum class OutputChannelCount { Mono = 1, Stereo = 2 };
+// Quad, 5.1 and 7.1 output use SDL's channel order. Sound effects are panned
+// over the speakers with vector base amplitude panning
+enum class OutputChannelCount {
+    Mono = 1,
+    Stereo = 2,
+    Quad = 4,
+    Surround51 = 6,
+    Surround71 = 8
+};
 enum class AudioFormat {
     // Unsigned 8-bit samples
     U8,
@@ -50,12 +66,50 @@ enum class Effect {
     None
 };
 
+// What play_sound() does when a source already plays its maximum amount of
+// sounds, see set_default_max_instances()
+enum class InstanceLimitBehavior {
+    // Don't play the new sound
+    Reject,
+    // Stop the sound of the source that started first
+    StealOldest,
+    // Stop the sound of the source with the lowest volume after distance
+    // attenuation
+    StealQuietest
+};
+
 struct loop_forever_t {};
 
 // Pass this value to in a loop_count parameter to make it loop forever
 static constexpr loop_forever_t loop_forever;
 
-using SoundFinishCallbackT = std::function<void(Sound)>;
+// A plain function, so calling it never allocates. user_data is the pointer
+// passed to set_sound_finish_callback()
+using SoundFinishCallbackT = void (*)(Sound sound, void* user_data);
+
+// Things that happen while sounds play. They are queued by the engine and
+// taken with poll_events(), poll_event() or wait_event()
+enum class EventType {
+    // A sound started playing
+    SoundStarted,
+    // A sound finished or was stopped
+    SoundFinished,
+    // A looping effect started its next loop. Not sent for streamed sounds
+    SoundLooped,
+    // A streamed sound ran out of decoded audio. It plays silence until the
+    // stream catches up
+    StreamStarved,
+    // A source passed to prefetch() finished loading. The sound is invalid
+    LoadCompleted
+};
+
+struct Event {
+    EventType type = EventType::SoundStarted;
+    Sound sound;
+    SoundSource source;
+};
+
+using EventCallbackT = std::function<void(Event const&)>;
 
 // Used internally to store active sounds
 struct SoundData {
@@ -69,6 +123,9 @@ struct SoundData {
     // The maximum distance this sound can be heard from. Only used when the
     // sound is an effect
     float max_distance;
+    // The playback rate of this sound, where 1 is the original speed. Only
+    // used when the sound is an effect
+    float pitch = 1.0f;
 };
 
 // Initialization data for the sound engine.
@@ -85,6 +142,101 @@ struct InitInfo {
     // The amount of effect channels to allocate. This effectively controls
     // how many sound effects can be played at once. Defaults to 16
     unsigned int effect_channels = 16;
+    // The resampler quality new sounds start with. This can be changed per
+    // sound with set_resample_quality()
+    ResampleQuality resample_quality = ResampleQuality::Sinc;
+    // Size of a cell in the grid emitters are stored in, in world units. A good
+    // value is in the order of the typical emitter distance range
+    float emitter_grid_cell_size = 64.0f;
+    // Memory budget for the samples of effect sources, in bytes. When loaded
+    // effects use more, the least recently played ones are evicted. Their
+    // handles stay valid, and they are loaded again the next time they play.
+    // 0 means there is no limit
+    std::size_t source_memory_budget = 0;
+    // When set, load_source() only registers effect sources. Their file is
+    // decoded when they first play, or in the background after a call to
+    // prefetch(). Sources that are never played then cost no load time or
+    // memory
+    bool lazy_source_loading = false;
+    // By default, the sound finish callback is called from poll_events() on
+    // your own thread. When set, it is called right away on the audio thread
+    // instead. It then has to be realtime safe: it may not block, allocate or
+    // call into audeo, or the audio output will glitch
+    bool immediate_finish_callbacks = false;
+    // Adapts the device buffer to the machine. The device is opened with
+    // min_chunk_size instead of chunk_size. When audio callbacks underrun,
+    // the buffer doubles, up to max_chunk_size. After adaptive_stable_ms
+    // without underruns, it halves again. The device is reopened to resize
+    // it, which is done by poll_events(). Effects keep playing, music
+    // restarts close to where it was, but effects added with add_effect() or
+    // reverse_stereo() are lost
+    bool adaptive_chunk_size = false;
+    unsigned int min_chunk_size = 512;
+    unsigned int max_chunk_size = 8192;
+    unsigned int adaptive_stable_ms = 30000;
+};
+
+// Memory use of effect sources, as returned by get_source_cache_stats()
+struct SourceCacheStats {
+    // The current memory budget, 0 if there is no limit
+    std::size_t budget_bytes = 0;
+    // Memory used by the samples of loaded effect sources. Sources that share
+    // their samples are counted once
+    std::size_t resident_bytes = 0;
+    std::size_t resident_sources = 0;
+    // Effect sources that were evicted or registered lazily, and will be
+    // loaded on play
+    std::size_t evicted_sources = 0;
+    // Effect sources being decoded in the background after prefetch()
+    std::size_t prefetching_sources = 0;
+    // Totals since the engine was initialized. reloads counts sources that
+    // had to be loaded when they played
+    std::size_t evictions = 0;
+    std::size_t reloads = 0;
+};
+
+// Performance counters of the engine, as returned by get_stats(). Times are
+// in microseconds. Only audeo's own processing in the audio callback is
+// measured, not the music SDL_Mixer decodes before it
+struct EngineStats {
+    // Audio callbacks since init() or reset_stats()
+    std::uint64_t callbacks = 0;
+    double callback_min_us = 0.0;
+    double callback_avg_us = 0.0;
+    double callback_max_us = 0.0;
+    // Over the last 1024 callbacks
+    double callback_p99_us = 0.0;
+    // Callback time relative to the duration of the audio it produced, on
+    // average and for the 99th percentile of the last 1024 callbacks. Above 1
+    // the device runs out of audio
+    double budget_utilization = 0.0;
+    double budget_utilization_p99 = 0.0;
+    // Callbacks that took longer than the audio they produced, or that came
+    // more than two buffers after the previous one
+    std::uint64_t underruns = 0;
+    // The current device buffer, in sample frames and milliseconds, and how
+    // often it was resized by InitInfo::adaptive_chunk_size
+    unsigned int chunk_size = 0;
+    double buffer_latency_ms = 0.0;
+    std::size_t buffer_resizes = 0;
+    // Average time per callback spent on each stage of processing effects.
+    // Voices covers reading, decoding and resampling their samples
+    double voices_us = 0.0;
+    double occlusion_us = 0.0;
+    double hrtf_us = 0.0;
+    double ambisonics_us = 0.0;
+    double surround_us = 0.0;
+    // Effects playing on a channel, and emitters that are out of range
+    std::size_t real_voices = 0;
+    std::size_t virtual_voices = 0;
+    // Memory used by the samples of effect sources, see SourceCacheStats
+    std::size_t resident_source_bytes = 0;
+    // Events waiting for poll_events(), and events dropped because the queue
+    // was full
+    std::size_t queued_events = 0;
+    std::uint64_t dropped_events = 0;
+    // Sources being decoded in the background after prefetch()
+    std::size_t queued_loads = 0;
 };
 
 AUDEO_API bool init(InitInfo const& info = InitInfo {});
@@ -110,9 +262,23 @@ AUDEO_API void allocate_effect_channels(unsigned int count);
 // Functions that control sound sources
 
 // Loads a sound source into memory. This returns a handle that you can pass to
-// the library to do stuff with your sound source
-[[nodiscard]] AUDEO_API SoundSource load_source(std::string_view path,
-                                               AudioType type);
+// the library to do stuff with your sound source. Effects can be kept
+// compressed in memory, see SourceCompression. Effects loaded from the same
+// path, or from files that decode to the same samples, share their memory. It
+// is released when the last of these sources is freed. With
+// InitInfo::lazy_source_loading, effects are decoded when they first play
+[[nodiscard]] AUDEO_API SoundSource
+load_source(std::string_view path,
+            AudioType type,
+            SourceCompression compression = SourceCompression::None);
+
+// Loads every sound in a sound bank made with the audeo_pack tool. The bank is
+// mapped into memory, and its sounds play straight from the mapping without
+// being decoded or copied. It has to be packed for the frequency, format and
+// channel count the engine was initialized with. Returns the sources by the
+// names they were packed under. The bank is unmapped once all of them are freed
+[[nodiscard]] AUDEO_API std::unordered_map<std::string, SoundSource>
+load_bank(std::string_view path);
 
 // This will free a sound source if it is not currently playing. Returns the
 // success of the function
@@ -122,6 +288,46 @@ AUDEO_API bool free_source(SoundSource source);
 // sources freed
 AUDEO_API std::size_t free_unused_sources();
 
+// Hints that an effect source will play soon. If its samples are not loaded,
+// because the source was registered lazily or evicted, they are decoded on a
+// background thread. Playing the source before that finished waits for it.
+// Returns false for invalid sources and sources that aren't effects
+AUDEO_API bool prefetch(SoundSource source);
+
+// Changes the memory budget for effect sources, see
+// InitInfo::source_memory_budget. Sources are evicted right away if needed
+AUDEO_API void set_source_memory_budget(std::size_t bytes);
+
+// Returns how much memory effect sources use, and how often they were evicted
+AUDEO_API SourceCacheStats get_source_cache_stats();
+
+// Returns the performance counters of the engine. Timing is measured inside
+// the audio callback, and costs a few clock reads per voice and block
+AUDEO_API EngineStats get_stats();
+
+// Restarts the timing counters of get_stats()
+AUDEO_API void reset_stats();
+
+// Writes the spans recorded by the tracing layer as Chrome trace JSON, which
+// chrome://tracing and Perfetto can open. Timestamps are on the steady clock.
+// Tracing is only compiled in with the AUDEO_ENABLE_TRACING CMake option.
+// Returns false without it, or if the file could not be written
+AUDEO_API bool write_trace(std::string_view path);
+
+// Records the calls that change what is heard, like loading sources, playing,
+// stopping and moving sounds, and moving the listeners, to a binary log at
+// path. Calls are stamped with the amount of frames mixed since the recording
+// started. Sources that are already loaded are recorded as loaded at its start,
+// with their current defaults, and so are the listeners, emitters, HRTF and
+// ambisonics. Sounds that already play are not recorded.
+// load_recording() turns the log into a scene that render_scenes() replays
+// without an audio device. A running recording is stopped first. Returns false
+// if the file could not be opened
+AUDEO_API bool start_recording(std::string_view path);
+
+// Finishes the recording started with start_recording(). quit() also does this
+AUDEO_API void stop_recording();
+
 // Returns whether a sound source currently has a playing Sound instance
 // attached to it
 AUDEO_API bool is_playing(SoundSource source);
@@ -145,6 +351,19 @@ AUDEO_API bool set_default_position(SoundSource source, vec3f position);
 AUDEO_API bool set_default_distance_range_max(SoundSource source,
                                               float distance);
 
+// Limit the amount of sounds of a source that play at once. 0 (the default)
+// means there is no limit. When the limit is reached, play_sound() either
+// fails and returns an invalid sound, or stops an instance to make room. This
+// keeps bursts of the same sound from using up all channels
+AUDEO_API bool
+set_default_max_instances(SoundSource source,
+                          unsigned int count,
+                          InstanceLimitBehavior behavior = InstanceLimitBehavior::Reject);
+
+// Make play_sound() fail for a source when it started a sound less than
+// interval_ms milliseconds ago. 0 (the default) turns this off
+AUDEO_API bool set_default_min_retrigger_interval(SoundSource source, int interval_ms);
+
 // Functions that control sounds
 
 // Play a sound source. loop_count is the amount of times we loop the sound.
@@ -178,6 +397,23 @@ AUDEO_API std::optional<float> get_volume(Sound sound);
 // return (0, 0, 0)
 AUDEO_API std::optional<vec3f> get_position(Sound sound);
 
+// Returns the playback rate of a playing sound effect. For music, this
+// function returns std::nullopt
+AUDEO_API std::optional<float> get_pitch(Sound sound);
+
+// Returns the time in milliseconds from the audio callback mixing a sample to
+// the device playing it. This is the duration of the device buffer, see
+// InitInfo::chunk_size. Latency of the driver and hardware after that is not
+// included
+AUDEO_API double get_output_latency();
+
+// Estimates the time in milliseconds until the start of a sound is played by
+// the device. A sound started by play_sound() is mixed by the next audio
+// callback, and is then heard after get_output_latency(). Returns 0 for
+// sounds that are already audible, and is estimated as if paused sounds were
+// resumed right away. For an invalid sound, returns std::nullopt
+AUDEO_API std::optional<double> get_time_until_audible(Sound sound);
+
 // Returns the listener position. If no listener position was set, this will
 // be (0, 0, 0)
 AUDEO_API vec3f get_listener_position();
@@ -187,6 +423,15 @@ AUDEO_API vec3f get_listener_position();
 // forward in OpenGL)
 AUDEO_API vec3f get_listener_forward();
 
+// Returns the position and forward direction of one of the listeners. Listener
+// 0 is the one used by the functions above
+AUDEO_API vec3f get_listener_position(std::size_t listener);
+AUDEO_API vec3f get_listener_forward(std::size_t listener);
+
+// Returns the number of listeners. This is 1 unless set_listener_count() was
+// called
+AUDEO_API std::size_t get_listener_count();
+
 // Functions to affect currently playing sounds. Note that all these
 // functions return a bool indicating success or failure.
 
@@ -214,6 +459,21 @@ AUDEO_API bool set_position(Sound sound, float x, float y, float z);
 // Set the maximum distance this sound can be heard from
 AUDEO_API bool set_distance_range_max(Sound sound, float distance);
 
+// Set the playback rate of a sound effect. A pitch of 2 plays the sound twice
+// as fast (one octave higher), 0.5 plays it at half speed. The value is
+// clamped to the range [0.125, 8]. Music does not support changing the pitch
+AUDEO_API bool set_pitch(Sound sound, float pitch);
+
+// Set the resampler used to change the playback rate of a sound effect.
+// ResampleQuality::Linear is a lot cheaper than the default sinc resampler,
+// which makes it a good fit for distant or unimportant sounds
+AUDEO_API bool set_resample_quality(Sound sound, ResampleQuality quality);
+
+// Applies the commands in a buffer and clears it. See CommandBuffer for the
+// order they are applied in. Commands for sounds that aren't playing are
+// skipped
+AUDEO_API void submit(CommandBuffer& buffer);
+
 // Functionality to control the positional audio.
 
 // Sets the audio listener position to specified position
@@ -225,6 +485,97 @@ AUDEO_API void set_listener_position(float new_x, float new_y, float new_z);
 AUDEO_API void set_listener_forward(vec3f new_forward);
 AUDEO_API void set_listener_forward(float new_x, float new_y, float new_z);
 
+// Sets the number of listeners, for example one per player in split screen.
+// Every sound is spatialized relative to the listener closest to it, so each
+// sound is only heard once. With ambisonics enabled, every listener gets its own
+// bus that is rotated to its orientation. New listeners start at the origin,
+// facing (0, 0, -1). The count must be at least 1
+AUDEO_API void set_listener_count(std::size_t count);
+
+// Moves or turns one of the listeners
+AUDEO_API void set_listener_position(std::size_t listener, vec3f new_position);
+AUDEO_API void set_listener_forward(std::size_t listener, vec3f new_forward);
+
+// Persistent emitters.
+
+// Creates an emitter that loops an effect source at a position in the world.
+// Emitters only occupy a channel while the listener is in their distance range
+// (the source's default distance range). Call update_emitters() every frame to
+// start emitters that came into range and virtualize the ones that left it.
+// Virtual emitters keep track of time, so they resume at the right offset.
+// Returns an invalid emitter for music or invalid sources
+[[nodiscard]] AUDEO_API Emitter create_emitter(SoundSource source, vec3f position);
+
+// Removes an emitter from the world, stopping its sound if it is playing
+AUDEO_API bool destroy_emitter(Emitter emitter);
+
+// Checks if an emitter is valid
+AUDEO_API bool is_valid(Emitter emitter);
+
+// Moves an emitter. If it is currently playing, its sound is moved too
+AUDEO_API bool set_emitter_position(Emitter emitter, vec3f position);
+
+// Returns the sound playing for an emitter, or std::nullopt if the emitter is
+// currently virtual or invalid
+AUDEO_API std::optional<Sound> get_emitter_sound(Emitter emitter);
+
+// Finds the emitters within range of the listener and starts or virtualizes
+// them accordingly. Only the emitters in grid cells near the listener are
+// looked at. When there are not enough free channels, the closest emitters are
+// played first
+AUDEO_API void update_emitters();
+
+// Binaural spatialization for headphone output.
+
+// Loads a set of head-related impulse responses from a directory and uses them
+// to spatialize all sound effects instead of the default stereo panning. This
+// allows sounds to be placed above and below the listener. The directory must
+// contain stereo WAV files named like the MIT KEMAR set, H<elevation>e<azimuth>a.wav
+// (for example H-10e090a.wav), where azimuth is measured in degrees clockwise
+// from the front. Requires stereo output. Returns the success of the function
+AUDEO_API bool load_hrtf(std::string_view directory);
+
+// Frees the loaded HRTF set and goes back to stereo panning
+AUDEO_API void unload_hrtf();
+
+// Returns true if an HRTF set is loaded and used for spatialization
+AUDEO_API bool is_hrtf_enabled();
+
+// Ambisonic spatialization.
+
+// Encodes all sound effects into a shared ambisonic bus instead of panning
+// every sound separately. The bus is rotated to the listener orientation and
+// decoded once per audio callback, so turning the listener costs the same no
+// matter how many sounds are playing. If an HRTF set is loaded, the bus is
+// decoded binaurally. Requires stereo output. Returns the success of the
+// function
+AUDEO_API bool enable_ambisonics(AmbisonicOrder order = AmbisonicOrder::First);
+
+// Goes back to panning every sound effect separately
+AUDEO_API void disable_ambisonics();
+
+// Returns true if sound effects are spatialized through the ambisonic bus
+AUDEO_API bool is_ambisonics_enabled();
+
+// Occlusion and obstruction.
+
+// Sets a function that is used to find out how much the path from the listener
+// to each playing sound effect is blocked by your scene geometry. It is called
+// from a worker thread every settings.update_interval_ms milliseconds, and only
+// for sounds where either the sound or the listener moved more than
+// settings.movement_threshold units since the last query. Occluded sounds are
+// made quieter and muffled with a low-pass filter
+AUDEO_API void set_occlusion_query(OcclusionQueryT query,
+                                   OcclusionSettings const& settings = OcclusionSettings {});
+
+// Removes the occlusion query, which stops the worker thread and makes every
+// sound unoccluded again
+AUDEO_API void clear_occlusion_query();
+
+// Returns the last occlusion value computed for a sound, between 0 and 1. If no
+// occlusion query is set or the sound is music, this returns std::nullopt
+AUDEO_API std::optional<float> get_occlusion(Sound sound);
+
 // Callbacks and special effects
 
 // Swaps stereo left and right. This function only has effect when
@@ -232,12 +583,45 @@ AUDEO_API void set_listener_forward(float new_x, float new_y, float new_z);
 // with false as the second argument
 AUDEO_API bool reverse_stereo(Sound sound, bool reverse = true);
 
+// Adds an effect to a sound until it finishes. Effect::None adds nothing
 AUDEO_API bool add_effect(Sound sound, Effect effect);
 
-// Set a callback that is called right after the sound is stopped, and right
-// before it is removed from the system. This means that the sound parameter
-// is still valid inside the callback function
-AUDEO_API void set_sound_finish_callback(SoundFinishCallbackT callback);
+// Set a callback that is called for every sound that finished or was
+// stopped. Finished sounds are queued by the audio thread, and the callback is
+// called for them by poll_events(), so the sound is no longer valid inside
+// it. See InitInfo::immediate_finish_callbacks to call it from the audio
+// thread instead, while the sound is still valid. user_data is passed to every
+// call
+AUDEO_API void set_sound_finish_callback(SoundFinishCallbackT callback,
+                                         void* user_data = nullptr);
+// The signature from before callbacks took user data. Replaces the callback set
+// above. The function is copied, which may allocate
+AUDEO_API void set_sound_finish_callback(std::function<void(Sound)> callback);
+
+// Set a callback that poll_events() passes every event to
+AUDEO_API void set_event_callback(EventCallbackT callback);
+
+// Passes every queued event to the event callback, and calls the sound finish
+// callback for finished sounds. Call this regularly from the thread that
+// should run the callbacks, for example once per frame. Returns the amount of
+// events. Events that don't fit in the queue are dropped, so don't let them
+// pile up for too long
+AUDEO_API std::size_t poll_events();
+
+// Takes the oldest queued event, without passing it to any callback. Returns
+// false if there are no events. The queue has a single consumer, so
+// poll_events(), poll_event() and wait_event() must all be called from the
+// same thread
+AUDEO_API bool poll_event(Event& event);
+
+// Like poll_event(), but waits up to timeout_ms milliseconds for an event to
+// arrive. A negative timeout waits forever
+AUDEO_API bool wait_event(Event& event, int timeout_ms = -1);
+
+// Blocks until the sound finished, or until timeout_ms milliseconds passed. A
+// negative timeout waits forever. Returns true if the sound finished. This
+// does not take any events from the queue
+AUDEO_API bool wait_for(Sound sound, int timeout_ms = -1);
 
 } // namespace audeo
 
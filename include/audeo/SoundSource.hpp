@@ -10,7 +10,20 @@
 
 namespace audeo {
 
-enum class AudioType { Music, Effect };
+// Music is streamed through SDL_Mixer's single music channel. Effects are
+// decoded into memory when loaded. Streams play like effects, but are decoded
+// from disk while they play, which saves memory for long sounds. Only
+// uncompressed WAV files can be streamed
+enum class AudioType { Music, Effect, Stream };
+
+// How an effect source is kept in memory. Ignored for music and streams
+enum class SourceCompression {
+    // PCM in the device format
+    None,
+    // 4 bit IMA-ADPCM, about a quarter of the size of 16 bit PCM. Decoded
+    // while the sound plays, at a small CPU and quality cost
+    Adpcm
+};
 
 class SoundSource {
 public:
@@ -0,0 +1,39 @@
+#ifndef AUDEO_ADPCM_HPP_
+#define AUDEO_ADPCM_HPP_
+
+#include "export_import.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace audeo::detail {
+
+// Frames per ADPCM block. Blocks can be decoded independently, so this is also
+// the granularity of random access
+constexpr int adpcm_block_frames = 256;
+
+// Interleaved audio compressed to 4 bit IMA-ADPCM. Every block starts with the
+// decoder state of each channel, followed by the samples of each channel in
+// turn, two per byte.
+struct AdpcmBuffer {
+    int channels = 0;
+    std::int64_t frame_count = 0;
+    std::vector<std::uint8_t> data;
+};
+
+// Size of a single block in bytes
+AUDEO_API std::size_t adpcm_block_size(int channels);
+
+// Compresses frame_count interleaved frames of float samples. The last block is
+// padded with silence
+AUDEO_API AdpcmBuffer adpcm_encode(float const* samples, int channels, std::int64_t frame_count);
+
+// Decodes a whole block to adpcm_block_frames interleaved float frames. blocks
+// points to the data of an AdpcmBuffer, or ADPCM data in a sound bank
+AUDEO_API void
+adpcm_decode_block(std::uint8_t const* blocks, int channels, std::int64_t block, float* out);
+
+} // namespace audeo::detail
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef AUDEO_AMBISONICS_HPP_
+#define AUDEO_AMBISONICS_HPP_
+
+#include "export_import.hpp"
+#include "hrtf.hpp"
+#include "vec3.hpp"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace audeo {
+
+enum class AmbisonicOrder { First = 1, Third = 3 };
+
+namespace detail {
+
+// Amount of ambisonic channels for a third order bus
+constexpr int max_ambisonic_channels = 16;
+
+using AmbisonicCoefficients = std::array<float, max_ambisonic_channels>;
+
+AUDEO_API int ambisonic_channel_count(AmbisonicOrder order);
+
+// Computes the ACN/SN3D encoding gains for a unit direction in world space.
+// Directions are converted to the ambisonic convention (x forward, y left,
+// z up), where forward is the default listener forward (0, 0, -1)
+AUDEO_API AmbisonicCoefficients encode_direction(vec3f direction, AmbisonicOrder order);
+
+// Per voice encoding state
+struct AmbisonicVoice {
+    bool enabled = false;
+    // Index of the bus this voice is encoded into
+    std::size_t bus = 0;
+    AmbisonicCoefficients coefficients {};
+    AmbisonicCoefficients previous_coefficients {};
+    // Frame offset in the bus for the next block this voice renders. Only
+    // valid if generation matches the bus generation
+    int offset = 0;
+    unsigned int generation = 0;
+};
+
+// A B-format bus that all voices are encoded into. Once per audio callback
+// the bus is rotated to the listener orientation and decoded, so the cost of
+// rotating the listener does not depend on the amount of playing voices.
+class AmbisonicBus {
+public:
+    // capacity_frames is the most frames a callback can hold, the device's
+    // chunk size. The bus never grows, so encoding and decoding don't allocate
+    // on the audio thread. Buses that are decoded in the same callbacks must
+    // share a generation, so voices can move between them. Pass the generation
+    // of an existing bus when creating a new one
+    AmbisonicBus(AmbisonicOrder order, int capacity_frames, unsigned int generation = 1);
+
+    AmbisonicOrder order() const { return bus_order; }
+
+    // Mixes a block of mono samples into the bus at the voice's offset.
+    // Coefficients are interpolated from the previous block's to avoid zipper
+    // noise. Frames past the capacity are dropped
+    void encode(AmbisonicVoice& voice, float const* mono, int frames);
+
+    // Sets the rotation applied before decoding from the listener's basis
+    // vectors, given in world space
+    void set_listener_orientation(vec3f forward, vec3f right, vec3f up);
+
+    // Decodes to virtual speakers that are rendered binaurally with this HRTF
+    // set. Pass nullptr to decode to stereo instead
+    void set_hrtf(HrtfSet* hrtf);
+
+    // Rotates and decodes frames starting at offset into interleaved stereo,
+    // added to out. frames may not exceed hrtf_max_block_frames. Frames past
+    // the capacity were never encoded, so out is left as it is for them
+    void decode(int offset, int frames, float* out);
+
+    // Clears the bus after a callback was decoded. This invalidates the
+    // offsets of all voices
+    void next_callback();
+
+    int capacity() const { return capacity_frames; }
+    unsigned int current_generation() const { return generation; }
+
+private:
+    AmbisonicOrder bus_order;
+    int channels;
+    int capacity_frames;
+    unsigned int generation = 1;
+    // Planar, channels * capacity_frames
+    std::vector<float> data;
+
+    // Row major, channels x channels
+    std::vector<float> rotation;
+    // Least squares fit used to compute the rotation matrix, see ambisonics.cpp
+    std::vector<vec3f> fit_points;
+    std::vector<float> fit_inverse;
+
+    // Virtual speakers in listener space, with their decoding gains and stereo
+    // pan gains
+    std::vector<vec3f> speakers;
+    std::vector<float> speaker_decode;
+    std::vector<float> stereo_decode;
+    std::vector<HrtfVoice> speaker_hrtf;
+    HrtfSet* binaural = nullptr;
+
+    // Scratch space of decode(), for a block of the rotated bus and of a
+    // virtual speaker
+    std::vector<float> rotated_block;
+    std::vector<float> speaker_block;
+    HrtfWork speaker_work;
+};
+
+} // namespace detail
+
+} // namespace audeo
+
+#endif
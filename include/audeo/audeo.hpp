@@ -3,6 +3,10 @@
 
 // Main header for audeo library. Includes main audeo functionality
 
+#include "CommandBuffer.hpp"
+#include "Emitter.hpp"
+#include "Engine.hpp"
+#include "OfflineRender.hpp"
 #include "Sound.hpp"
 #include "SoundEngine.hpp"
 #include "SoundSource.hpp"
@@ -0,0 +1,105 @@
+#ifndef AUDEO_BANK_HPP_
+#define AUDEO_BANK_HPP_
+
+#include "export_import.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace audeo::detail {
+
+// A sound bank holds many sounds, already converted to the output format of
+// the device they will be played on, so they can be used straight from a
+// memory mapping of the file. The layout is a BankHeader, followed by one
+// BankEntry per sound and a table of the sound names. Sample data of every
+// sound starts at a multiple of bank_alignment. All values are stored in the
+// byte order of the machine that packed the bank.
+
+constexpr char bank_magic[4] = {'A', 'D', 'B', 'K'};
+constexpr std::uint32_t bank_version = 1;
+constexpr std::size_t bank_alignment = 64;
+
+enum class BankEncoding : std::uint32_t {
+    // Samples in the bank's SDL audio format
+    Pcm = 0,
+    // IMA-ADPCM blocks, see adpcm.hpp
+    Adpcm = 1
+};
+
+struct BankHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t frequency;
+    // SDL audio format, for example AUDIO_S16SYS
+    std::uint32_t format;
+    std::uint32_t channels;
+    std::uint32_t sound_count;
+    // Byte offsets from the start of the file
+    std::uint64_t entries_offset;
+    std::uint64_t names_offset;
+};
+
+struct BankEntry {
+    std::uint64_t data_offset;
+    std::uint64_t data_size;
+    std::uint64_t frame_count;
+    // Offset into the name table
+    std::uint32_t name_offset;
+    std::uint32_t name_size;
+    BankEncoding encoding;
+    std::uint32_t reserved;
+};
+
+static_assert(sizeof(BankHeader) == 40, "BankHeader must not contain padding");
+static_assert(sizeof(BankEntry) == 40, "BankEntry must not contain padding");
+
+// A bank file mapped into memory. The mapping stays alive for as long as this
+// object does
+class BankFile {
+public:
+    BankFile() = default;
+    ~BankFile();
+
+    BankFile(BankFile const&) = delete;
+    BankFile& operator=(BankFile const&) = delete;
+
+    // Maps the file and checks that the header and index are valid
+    bool open(std::string_view path);
+
+    BankHeader const& header() const;
+    BankEntry const& entry(std::size_t index) const;
+    std::string_view name(std::size_t index) const;
+    std::uint8_t const* data(std::size_t index) const;
+
+private:
+    bool validate() const;
+
+    std::uint8_t const* mapping = nullptr;
+    std::size_t mapping_size = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+// A sound to be written into a bank by write_bank()
+struct BankSound {
+    std::string name;
+    BankEncoding encoding = BankEncoding::Pcm;
+    std::uint64_t frame_count = 0;
+    std::vector<std::uint8_t> data;
+};
+
+// Writes a bank file. Used by the packer tool
+AUDEO_API bool write_bank(std::string_view path,
+                          std::uint32_t frequency,
+                          std::uint32_t format,
+                          std::uint32_t channels,
+                          std::vector<BankSound> const& sounds);
+
+} // namespace audeo::detail
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef AUDEO_COMMAND_LOG_HPP_
+#define AUDEO_COMMAND_LOG_HPP_
+
+#include "resampler.hpp"
+#include "vec3.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+
+namespace audeo::detail {
+
+// Calls recorded in a command log. The values are part of the file format
+enum class LoggedCall : std::uint8_t {
+    LoadSource = 0,
+    SetDefaultVolume = 1,
+    SetDefaultPosition = 2,
+    SetDefaultDistanceRangeMax = 3,
+    PlaySound = 4,
+    PauseSound = 5,
+    ResumeSound = 6,
+    StopSound = 7,
+    SetVolume = 8,
+    SetPosition = 9,
+    SetDistanceRangeMax = 10,
+    SetPitch = 11,
+    SetListenerPosition = 12,
+    SetListenerForward = 13,
+    // Written when the recording stops, at the frame it stopped at
+    End = 14,
+    SetDefaultMaxInstances = 15,
+    SetDefaultMinRetriggerInterval = 16,
+    SetResampleQuality = 17,
+    SetListenerCount = 18,
+    CreateEmitter = 19,
+    DestroyEmitter = 20,
+    SetEmitterPosition = 21,
+    UpdateEmitters = 22,
+    LoadHrtf = 23,
+    UnloadHrtf = 24,
+    EnableAmbisonics = 25,
+    DisableAmbisonics = 26,
+    ReverseStereo = 27,
+    AddEffect = 28,
+    // An emitter started a sound, so later calls on it are replayed on the
+    // sound the emitter plays then
+    EmitterSound = 29,
+    // Recorded so a replay can refuse the log, see load_recording()
+    LoadBank = 30,
+    SetOcclusionQuery = 31
+};
+
+// Writes API calls to a binary log. The file starts with a header holding the
+// output frequency, channel count and default resample quality. Every record is
+// the call, the frames mixed since the previous record, and the arguments.
+// Integers, enums and handles are variable length, floats are 4 little endian
+// bytes, so a typical record takes well under 20 bytes. Arguments per call:
+//  LoadSource: source, type, compression, path
+//  SetDefaultVolume, SetDefaultDistanceRangeMax: source, value
+//  SetDefaultPosition: source, vector
+//  SetDefaultMaxInstances: source, count, limit behavior
+//  SetDefaultMinRetriggerInterval: source, interval ms
+//  PlaySound: sound, source, loop count (-1 loops forever), fade in ms
+//  PauseSound, ResumeSound: sound
+//  StopSound: sound, fade out ms
+//  SetVolume, SetDistanceRangeMax, SetPitch: sound, value
+//  SetPosition: sound, vector
+//  SetResampleQuality: sound, quality
+//  ReverseStereo: sound, 1 to reverse or 0 to undo it
+//  AddEffect: sound, effect
+//  SetListenerPosition, SetListenerForward: listener, vector
+//  SetListenerCount: count
+//  CreateEmitter: emitter, source, vector
+//  DestroyEmitter: emitter
+//  SetEmitterPosition: emitter, vector
+//  EmitterSound: emitter, sound
+//  LoadHrtf: directory
+//  EnableAmbisonics: order
+//  UpdateEmitters, UnloadHrtf, DisableAmbisonics, LoadBank, SetOcclusionQuery,
+//  End: nothing
+class CommandLog {
+public:
+    CommandLog(std::string_view path,
+               unsigned int frequency,
+               unsigned int channels,
+               ResampleQuality resample_quality);
+    // Closes the file. Write End first, a log without it counts as cut short
+    ~CommandLog();
+
+    CommandLog(CommandLog const&) = delete;
+    CommandLog& operator=(CommandLog const&) = delete;
+
+    // False if the file could not be opened
+    bool is_open() const { return file != nullptr; }
+
+    // Starts a record. frame is the amount of frames the engine mixed since
+    // the recording started
+    void begin(LoggedCall call, std::int64_t frame);
+    void write_int(std::int64_t value);
+    void write_float(float value);
+    void write_vector(vec3f value);
+    void write_string(std::string_view value);
+
+private:
+    std::FILE* file = nullptr;
+    std::int64_t last_frame = 0;
+};
+
+} // namespace audeo::detail
+
+#endif
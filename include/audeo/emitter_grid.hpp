@@ -0,0 +1,44 @@
+#ifndef AUDEO_EMITTER_GRID_HPP_
+#define AUDEO_EMITTER_GRID_HPP_
+
+#include "Emitter.hpp"
+#include "export_import.hpp"
+#include "vec3.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace audeo::detail {
+
+// Uniform grid over world space, used to find the emitters near the listener
+// without looking at every emitter in the world. Only cells that contain at
+// least one emitter are stored.
+class EmitterGrid {
+public:
+    explicit EmitterGrid(float cell_size) : cell_size(cell_size) {}
+
+    void insert(Emitter emitter, vec3f position);
+    void remove(Emitter emitter, vec3f position);
+    void move(Emitter emitter, vec3f from, vec3f to);
+
+    // Appends every emitter in a cell that overlaps the sphere around center to
+    // out. This can return emitters slightly outside the radius, callers are
+    // expected to do their own distance check
+    void query(vec3f center, float radius, std::vector<Emitter>& out) const;
+
+private:
+    using CellKey = std::int64_t;
+
+    CellKey key(int x, int y, int z) const;
+    void coordinates(CellKey cell, int& x, int& y, int& z) const;
+    int cell_coordinate(float value) const;
+    CellKey key_for(vec3f position) const;
+
+    float cell_size;
+    std::unordered_map<CellKey, std::vector<Emitter>> cells;
+};
+
+} // namespace audeo::detail
+
+#endif
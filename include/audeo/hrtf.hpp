@@ -0,0 +1,88 @@
+#ifndef AUDEO_HRTF_HPP_
+#define AUDEO_HRTF_HPP_
+
+#include "export_import.hpp"
+
+#include <array>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace audeo::detail {
+
+// Impulse responses are truncated to this many taps at the device frequency
+constexpr int max_hrir_length = 256;
+
+// A pair of head-related impulse responses for a single direction. The
+// coefficients are stored in reverse order, so that convolving is a straight
+// dot product with the input history
+struct HrirFilter {
+    std::array<float, max_hrir_length> left {};
+    std::array<float, max_hrir_length> right {};
+};
+
+// A set of measured HRIRs loaded from disk, together with a cache of filters
+// interpolated for quantized directions.
+class HrtfSet {
+public:
+    // Loads every stereo WAV file in directory (and its subdirectories) named
+    // after the MIT KEMAR convention, H<elevation>e<azimuth>a.wav. Azimuth is
+    // in degrees clockwise from the front, elevation in degrees upwards. The
+    // impulse responses are resampled to device_frequency.
+    bool load(std::string_view directory, int device_frequency);
+
+    // Returns the filter for a direction, interpolated from the nearest
+    // measurements. Filters are cached per quantized direction, so the
+    // returned pointer stays valid for as long as this set is alive.
+    HrirFilter const* filter(float azimuth, float elevation);
+
+    int length() const { return hrir_length; }
+
+private:
+    struct Measurement {
+        float azimuth;
+        std::vector<float> left;
+        std::vector<float> right;
+    };
+
+    struct Ring {
+        float elevation;
+        // Sorted by azimuth
+        std::vector<Measurement> measurements;
+    };
+
+    void interpolate_ring(Ring const& ring, float azimuth, float weight, HrirFilter& out) const;
+
+    // Sorted by elevation
+    std::vector<Ring> rings;
+    std::unordered_map<int, HrirFilter> cache;
+    int hrir_length = 0;
+};
+
+// Per voice convolution state
+struct HrtfVoice {
+    bool enabled = false;
+    HrirFilter const* current = nullptr;
+    HrirFilter const* previous = nullptr;
+    float gain = 1.0f;
+    float previous_gain = 1.0f;
+    // The last max_hrir_length - 1 mono input samples
+    std::array<float, max_hrir_length - 1> history {};
+};
+
+constexpr int hrtf_max_block_frames = 256;
+
+// Scratch space of hrtf_process(), for the history and a block of input. Every
+// engine has its own, so engines can spatialize on different threads
+using HrtfWork = std::array<float, max_hrir_length - 1 + hrtf_max_block_frames>;
+
+// Spatializes interleaved stereo frames in place. The input is downmixed to
+// mono and convolved with the first length taps of the voice's filter pair.
+// When the filter changed since the last call, the output crossfades from the
+// old to the new filter. frame_count may not exceed hrtf_max_block_frames
+AUDEO_API void
+hrtf_process(HrtfVoice& voice, int length, float* frames, int frame_count, HrtfWork& work);
+
+} // namespace audeo::detail
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef AUDEO_MIXER_HPP_
+#define AUDEO_MIXER_HPP_
+
+#include "export_import.hpp"
+
+#include <SDL_mixer.h>
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace audeo::detail {
+
+// Gains of the software mixer's positional effect, see Mixer::set_position()
+struct PositionGains {
+    int channels = 0;
+    float left = 1.0f;
+    float right = 1.0f;
+    float distance = 1.0f;
+};
+
+// The channels an engine plays its sounds on. Engines with the audio device
+// forward to SDL_Mixer's channels. Engines without one use a software mixer
+// that behaves like SDL_Mixer does for the calls the engine makes: channels
+// play and loop chunks, pause, and run their effects before they are added to
+// the output. It mixes on the thread that calls mix(), and its ticks count the
+// frames it mixed, so its output doesn't depend on timing. It only mixes
+// AUDIO_F32SYS, and doesn't clip
+class AUDEO_API Mixer {
+public:
+    using EffectT = Mix_EffectFunc_t;
+    using PostMixT = void (*)(void* user_data, Uint8* stream, int length);
+
+    // Switches to the software mixer, mixing frames with this rate and channel
+    // count. Until then, every function forwards to SDL_Mixer
+    void open_software(int frequency, int channels);
+    // Drops the software mixer's channels and forwards to SDL_Mixer again
+    void close_software();
+    bool is_software() const { return software; }
+
+    // Locks out the audio callback, or mix(). Both are recursive
+    void lock();
+    void unlock();
+    // Milliseconds since the mixer was opened. SDL_GetTicks() for the audio
+    // device
+    Uint32 ticks() const;
+
+    // Like the SDL_Mixer functions of the same name. Channel -1, to apply a
+    // function to every channel, is not supported, except to query counts
+    int allocate_channels(int count);
+    // Plays a chunk on a channel, halting what played there before. Returns
+    // the channel, or -1 if it doesn't exist
+    int play_channel(int channel, Mix_Chunk* chunk, int loops);
+    int halt_channel(int channel);
+    void pause(int channel);
+    void resume(int channel);
+    int paused(int channel);
+    int playing(int channel);
+    int volume(int channel, int volume);
+    // channel may be MIX_CHANNEL_POST
+    int register_effect(int channel, EffectT effect, void* user_data);
+    int unregister_effect(int channel, EffectT effect);
+    int unregister_all_effects(int channel);
+    int set_position(int channel, Sint16 angle, Uint8 distance);
+    int set_reverse_stereo(int channel, int flip);
+
+    // Software mixer only. With the audio device, the engine sets SDL_Mixer's
+    // hook itself
+    void set_post_mix(PostMixT callback, void* user_data);
+    // Mixes length bytes of frames into stream, overwriting it. Software mixer
+    // only
+    void mix(Uint8* stream, int length);
+
+private:
+    struct Effect {
+        EffectT function = nullptr;
+        void* user_data = nullptr;
+    };
+
+    struct Channel {
+        Mix_Chunk* chunk = nullptr;
+        bool playing = false;
+        // Byte offset of the next sample in chunk
+        Uint32 offset = 0;
+        // Remaining loops. -1 loops forever
+        int loops = 0;
+        int volume = MIX_MAX_VOLUME;
+        bool paused = false;
+        std::vector<Effect> effects;
+        // User data of the positional effect. Channels are kept in a deque, so
+        // it doesn't move when channels are added
+        PositionGains position;
+    };
+
+    bool valid(int channel) const {
+        return channel >= 0 && static_cast<std::size_t>(channel) < channels.size();
+    }
+    std::vector<Effect>* effects_of(int channel);
+    void run_effects(int channel, Uint8* stream, int length);
+    void mix_channel(int channel, Uint8* stream, int length);
+    void done_playing(int channel);
+
+    bool software = false;
+    int frequency = 0;
+    int output_channels = 0;
+    std::recursive_mutex mutex;
+    std::uint64_t mixed_frames = 0;
+    std::deque<Channel> channels;
+    std::vector<Effect> post_effects;
+    PostMixT post_mix = nullptr;
+    void* post_mix_data = nullptr;
+    // A channel's samples with its effects applied
+    std::vector<Uint8> scratch;
+};
+
+} // namespace audeo::detail
+
+#endif
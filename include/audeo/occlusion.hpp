@@ -0,0 +1,112 @@
+#ifndef AUDEO_OCCLUSION_HPP_
+#define AUDEO_OCCLUSION_HPP_
+
+#include "Sound.hpp"
+#include "export_import.hpp"
+#include "vbap.hpp"
+#include "vec3.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace audeo {
+
+// Returns how much the path between the listener and an emitter is blocked, as
+// a value between 0 (clear line of sight) and 1 (fully occluded). This is
+// called from a worker thread, so it has to be safe to call concurrently with
+// the rest of your application
+using OcclusionQueryT = std::function<float(vec3f listener, vec3f emitter)>;
+
+struct OcclusionSettings {
+    // Time between two passes of the occlusion worker, in milliseconds
+    unsigned int update_interval_ms = 100;
+    // An emitter is only queried again once it or the listener moved further
+    // than this distance since its last query
+    float movement_threshold = 0.5f;
+    // Volume of a fully occluded sound, between 0 and 1
+    float occluded_volume = 0.3f;
+    // Cutoff frequency of the low-pass filter for a fully occluded sound
+    float occluded_cutoff_hz = 800.0f;
+    // Time it takes to fade between occlusion values, in milliseconds
+    float smoothing_ms = 80.0f;
+};
+
+namespace detail {
+
+// Per voice occlusion filter state
+struct OcclusionVoice {
+    // Latest result from the worker
+    float target = 0.0f;
+    // Smoothed towards target every block
+    float current = 0.0f;
+    std::array<float, max_output_channels> lowpass {};
+};
+
+// Applies the gain and low-pass filter for the voice's occlusion to interleaved
+// frames in place
+AUDEO_API void occlusion_process(OcclusionVoice& voice,
+                                 OcclusionSettings const& settings,
+                                 int frequency,
+                                 int channels,
+                                 float* frames,
+                                 int frame_count);
+
+// Runs occlusion queries for all tracked emitters on a background thread.
+// Results are cached per emitter, and are only recomputed when the emitter or
+// its nearest listener moved past the movement threshold.
+class OcclusionWorker {
+public:
+    // Called from the worker thread with an emitter and its new occlusion
+    // value. The sound may have finished since it was queried
+    using PublishT = std::function<void(Sound sound, float occlusion)>;
+
+    OcclusionWorker(OcclusionQueryT query, OcclusionSettings settings, PublishT publish);
+    ~OcclusionWorker();
+
+    OcclusionWorker(OcclusionWorker const&) = delete;
+    OcclusionWorker& operator=(OcclusionWorker const&) = delete;
+
+    void track(Sound sound, vec3f position);
+    void move(Sound sound, vec3f position);
+    void untrack(Sound sound);
+    void set_listeners(std::vector<vec3f> positions);
+
+    std::optional<float> occlusion(Sound sound);
+
+    OcclusionSettings const& settings() const { return occlusion_settings; }
+
+private:
+    struct Emitter {
+        vec3f position;
+        // Positions at the time of the last query
+        vec3f queried_position;
+        vec3f queried_listener;
+        bool queried = false;
+        float occlusion = 0.0f;
+    };
+
+    void run();
+
+    OcclusionQueryT query;
+    OcclusionSettings occlusion_settings;
+    PublishT publish;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::unordered_map<Sound, Emitter> emitters;
+    std::vector<vec3f> listeners;
+
+    std::thread worker;
+};
+
+} // namespace detail
+
+} // namespace audeo
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef AUDEO_RESAMPLER_HPP_
+#define AUDEO_RESAMPLER_HPP_
+
+#include "export_import.hpp"
+
+#include <cstddef>
+
+namespace audeo {
+
+enum class ResampleQuality {
+    // Linear interpolation between two neighbouring frames. Very cheap, but
+    // it aliases audibly when pitching up. Good enough for distant or low
+    // priority sounds
+    Linear,
+    // Polyphase windowed-sinc interpolation. This is the default
+    Sinc
+};
+
+namespace detail {
+
+// Amount of taps in every polyphase filter. Half of these taps lie before the
+// interpolated position, the other half after it
+constexpr int sinc_taps = 16;
+constexpr int sinc_half_taps = sinc_taps / 2;
+// Amount of fractional positions the filter tables are computed for. Positions
+// in between two phases are linearly interpolated
+constexpr int sinc_phases = 64;
+
+// Pitch values are clamped to this range. This also bounds the amount of input
+// frames a single output block can consume
+constexpr float min_resample_step = 0.125f;
+constexpr float max_resample_step = 8.0f;
+
+// Precomputes the windowed-sinc filter tables. This must be called before
+// resample() is used with ResampleQuality::Sinc, and is called by init() and
+// init_offline(). The tables are computed once, with std::call_once, so
+// engines on different threads can call it at the same time
+AUDEO_API void init_resampler_tables();
+
+// Amount of frames resample() needs to be able to read before the integer
+// part of the start position
+constexpr int resample_padding_before = sinc_half_taps - 1;
+// And after the last interpolated position
+constexpr int resample_padding_after = sinc_half_taps;
+
+// Resamples interleaved float frames. `in` must hold every frame in the range
+// [floor(start) - resample_padding_before,
+//  floor(start + step * (out_frames - 1)) + resample_padding_after],
+// where frame index 0 is located at in[resample_padding_before * channels].
+// step is the amount of input frames to advance per output frame.
+AUDEO_API void resample(float const* in,
+                        int channels,
+                        double start,
+                        double step,
+                        ResampleQuality quality,
+                        float* out,
+                        std::size_t out_frames);
+
+} // namespace detail
+
+} // namespace audeo
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef AUDEO_SAMPLE_FORMAT_HPP_
+#define AUDEO_SAMPLE_FORMAT_HPP_
+
+#include "export_import.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace audeo::detail {
+
+// Converts count samples in the SDL audio format `format` (for example
+// AUDIO_S16SYS) to floats in the range [-1, 1]. 8, 16 and 32 bit integer
+// formats and AUDIO_F32 are supported
+AUDEO_API void
+to_float(std::uint16_t format, void const* in, float* out, std::size_t count);
+
+// Converts count floats back to the SDL audio format `format`. Values outside
+// the range [-1, 1] are clamped
+AUDEO_API void
+from_float(std::uint16_t format, float const* in, void* out, std::size_t count);
+
+// Size of a single sample in bytes for an SDL audio format
+AUDEO_API std::size_t sample_size(std::uint16_t format);
+
+} // namespace audeo::detail
+
+#endif
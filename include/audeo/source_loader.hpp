@@ -0,0 +1,89 @@
+#ifndef AUDEO_SOURCE_LOADER_HPP_
+#define AUDEO_SOURCE_LOADER_HPP_
+
+#include "adpcm.hpp"
+#include "export_import.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Mix_Chunk;
+
+namespace audeo::detail {
+
+// An effect file to be decoded by decode_effect(), and the decoded samples
+struct EffectLoad {
+    EffectLoad() = default;
+    EffectLoad(EffectLoad const&) = delete;
+    EffectLoad& operator=(EffectLoad const&) = delete;
+    // Frees the chunk if nobody took it
+    ~EffectLoad();
+
+    std::string path;
+    // Compress the samples to IMA-ADPCM instead of keeping the chunk
+    bool compress = false;
+    // Output format of the device, as reported by Mix_QuerySpec()
+    std::uint16_t format = 0;
+    int channels = 0;
+    // Set for engines without an audio device, which SDL_Mixer can't load
+    // chunks for. The file is then converted with SDL to this frequency, and
+    // to the format and channels above. Only WAV files can be loaded this way
+    int frequency = 0;
+
+    // Results. On success, the samples are in chunk, or in pcm if frequency
+    // was set, or in adpcm if compress was set
+    bool loaded = false;
+    Mix_Chunk* chunk = nullptr;
+    std::shared_ptr<std::vector<std::uint8_t> const> pcm;
+    AdpcmBuffer adpcm;
+    // Set by the SourceLoader once the load was decoded
+    bool done = false;
+};
+
+// Decodes the file of a load on the calling thread. Safe to call from any
+// thread while the audio device is open, and at any time for loads with a
+// frequency
+AUDEO_API void decode_effect(EffectLoad& load);
+
+// Decodes effects on a background thread, so sources can be loaded before they
+// play without stalling the game
+class SourceLoader {
+public:
+    SourceLoader();
+    ~SourceLoader();
+
+    SourceLoader(SourceLoader const&) = delete;
+    SourceLoader& operator=(SourceLoader const&) = delete;
+
+    // Queues a load. Loads are decoded in the order they were added
+    void add(std::shared_ptr<EffectLoad> load);
+
+    // Returns once the load is done. A load that is still queued is decoded
+    // by the calling thread instead of waiting for its turn
+    void wait(std::shared_ptr<EffectLoad> const& load);
+
+    // Whether the load is done. Other fields of the load may only be read
+    // once this returned true
+    bool is_done(EffectLoad const& load);
+
+private:
+    void run();
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    bool stopping = false;
+    std::deque<std::shared_ptr<EffectLoad>> queue;
+
+    std::thread worker;
+};
+
+} // namespace audeo::detail
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef AUDEO_SPSC_QUEUE_HPP_
+#define AUDEO_SPSC_QUEUE_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace audeo::detail {
+
+// Fixed capacity, lock-free queue for a single producer and a single consumer
+// thread. Neither side ever blocks or allocates, so the producer may be the
+// audio thread. Items pushed while the queue is full are dropped and counted.
+template<typename T, std::size_t Capacity> class SpscQueue {
+public:
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    // Returns false and drops the item if the queue is full
+    bool push(T const& item) {
+        std::uint64_t const tail = pushed.load(std::memory_order_relaxed);
+        if (tail - popped.load(std::memory_order_acquire) == Capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[tail & (Capacity - 1)] = item;
+        pushed.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty
+    bool pop(T& item) {
+        std::uint64_t const head = popped.load(std::memory_order_relaxed);
+        if (head == pushed.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[head & (Capacity - 1)];
+        popped.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Items in the queue. Only exact when neither side is busy
+    std::size_t size() const {
+        return static_cast<std::size_t>(pushed.load(std::memory_order_acquire) -
+                                        popped.load(std::memory_order_acquire));
+    }
+
+    // Items dropped because the queue was full
+    std::uint64_t dropped_count() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    std::array<T, Capacity> items {};
+    // The counters only ever increase, the index into items is the counter
+    // modulo the capacity
+    std::atomic<std::uint64_t> pushed {0};
+    std::atomic<std::uint64_t> popped {0};
+    std::atomic<std::uint64_t> dropped {0};
+};
+
+} // namespace audeo::detail
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef AUDEO_STREAM_HPP_
+#define AUDEO_STREAM_HPP_
+
+#include "export_import.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct SDL_RWops;
+
+namespace audeo::detail {
+
+// Frames of decoded audio buffered per streaming voice. At 44.1 kHz this is a
+// little over a third of a second
+constexpr int stream_buffer_frames = 16384;
+
+// Layout of the sample data in a PCM WAV file
+struct WavInfo {
+    // SDL audio format of the samples, for example AUDIO_S16LSB
+    std::uint16_t format = 0;
+    int channels = 0;
+    int sample_rate = 0;
+    std::int64_t frame_count = 0;
+    // Byte offset of the first sample in the file
+    std::int64_t data_offset = 0;
+};
+
+// Reads the header of a WAV file. Only uncompressed files are supported, with
+// 8, 16 or 32 bit integer or 32 bit float samples
+AUDEO_API bool read_wav_info(std::string_view path, WavInfo& info);
+
+// A single playing instance of a streamed sound. The I/O worker decodes the
+// file into a ring buffer with fill(), and the audio thread drains it with
+// read(). Samples are converted to float and to the output channel count, but
+// keep the sample rate of the file.
+class Stream {
+public:
+    // start_frame is the first frame of the file to play. loops works like the
+    // loop count of play_sound(), -1 loops forever. window_frames is the most
+    // frames a single read() may ask for
+    Stream(std::string path,
+           WavInfo const& info,
+           int output_channels,
+           int loops,
+           std::int64_t start_frame,
+           int window_frames);
+    ~Stream();
+
+    Stream(Stream const&) = delete;
+    Stream& operator=(Stream const&) = delete;
+
+    // Opens the file. Returns false if it could not be opened
+    bool open();
+
+    // Decodes as many frames as fit into the ring buffer. Only called from one
+    // thread at a time
+    void fill();
+
+    // Called from the audio thread. Writes count frames starting at stream
+    // frame first to out. Frames before the start and after the end of the
+    // stream read as silence. Returns false without writing anything if the
+    // frames were not decoded yet. first may never decrease between calls
+    bool read(std::int64_t first, std::int64_t count, float* out);
+
+    // True once every frame of the stream was decoded and position is past the
+    // last one
+    bool finished(double position) const;
+
+private:
+    std::size_t decode(float* out, std::size_t frames);
+
+    std::string path;
+    WavInfo info;
+    int output_channels;
+    SDL_RWops* file = nullptr;
+    // Decoder state, only touched by fill()
+    int loops;
+    std::int64_t file_frame;
+    std::vector<std::uint8_t> raw;
+    std::vector<float> converted;
+
+    // Single producer, single consumer ring buffer. The counters only ever
+    // increase, the index into the buffer is the counter modulo its size
+    std::vector<float> ring;
+    std::atomic<std::int64_t> written {0};
+    std::atomic<std::int64_t> consumed {0};
+    std::atomic<bool> decoded_all {false};
+
+    // Frames taken out of the ring buffer that the resampler may still need,
+    // only touched by read()
+    std::vector<float> window;
+    std::int64_t window_start = 0;
+    std::int64_t window_count = 0;
+};
+
+// Keeps every playing stream's ring buffer filled from a background thread.
+// Streams are dropped once the worker holds the last reference to them, so
+// their file is never closed on the audio thread.
+class StreamWorker {
+public:
+    StreamWorker();
+    ~StreamWorker();
+
+    StreamWorker(StreamWorker const&) = delete;
+    StreamWorker& operator=(StreamWorker const&) = delete;
+
+    void add(std::shared_ptr<Stream> stream);
+
+private:
+    void run();
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    // Streams added since the worker last woke up
+    std::vector<std::shared_ptr<Stream>> added;
+
+    std::thread worker;
+};
+
+} // namespace audeo::detail
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef AUDEO_TRACE_HPP_
+#define AUDEO_TRACE_HPP_
+
+#include "export_import.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Tracing of engine internals. It is compiled in when AUDEO_TRACING is
+// defined, which the AUDEO_ENABLE_TRACING CMake option does. Spans are
+// recorded into a lock-free ring buffer per thread, and write_trace() saves
+// them as Chrome trace JSON for chrome://tracing or Perfetto. Without
+// AUDEO_TRACING, the macros expand to nothing.
+#ifdef AUDEO_TRACING
+#    define AUDEO_TRACE_CONCAT_IMPL(a, b) a##b
+#    define AUDEO_TRACE_CONCAT(a, b) AUDEO_TRACE_CONCAT_IMPL(a, b)
+// Records a span from here to the end of the enclosing scope. name has to
+// outlive the trace, so pass a string literal
+#    define AUDEO_TRACE_SCOPE(name)                                                                 \
+        ::audeo::detail::TraceScope AUDEO_TRACE_CONCAT(audeo_trace_scope_, __LINE__)(name)
+// Names the calling thread in the trace. name has to be a string literal
+#    define AUDEO_TRACE_THREAD(name) ::audeo::detail::trace_thread_name(name)
+#else
+#    define AUDEO_TRACE_SCOPE(name)
+#    define AUDEO_TRACE_THREAD(name)
+#endif
+
+namespace audeo::detail {
+
+// Spans kept per thread. Once a buffer is full, its oldest spans are
+// overwritten
+constexpr std::size_t trace_buffer_spans = 8192;
+
+// Nanoseconds on the steady clock. Trace timestamps use the same clock, so
+// spans line up with other traces taken on it
+AUDEO_API std::int64_t trace_clock_ns();
+
+// Records a span on the calling thread. The first span of every thread
+// allocates its buffer
+AUDEO_API void trace_span(char const* name, std::int64_t start_ns, std::int64_t end_ns);
+
+AUDEO_API void trace_thread_name(char const* name);
+
+// Writes the spans of all threads as Chrome trace JSON. Returns false if the
+// file could not be written
+AUDEO_API bool write_trace_file(std::string_view path);
+
+class TraceScope {
+public:
+    explicit TraceScope(char const* name) : name(name), start_ns(trace_clock_ns()) {}
+    ~TraceScope() { trace_span(name, start_ns, trace_clock_ns()); }
+
+    TraceScope(TraceScope const&) = delete;
+    TraceScope& operator=(TraceScope const&) = delete;
+
+private:
+    char const* name;
+    std::int64_t start_ns;
+};
+
+} // namespace audeo::detail
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef AUDEO_VBAP_HPP_
+#define AUDEO_VBAP_HPP_
+
+#include "export_import.hpp"
+#include "vec3.hpp"
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace audeo::detail {
+
+constexpr int max_output_channels = 8;
+
+using SpeakerGains = std::array<float, max_output_channels>;
+
+// Horizontal vector base amplitude panning for the speaker layouts SDL uses
+// for 4, 6 and 8 channel output. Speakers are indexed in SDL's channel order,
+// the LFE channel never receives any signal.
+class SpeakerLayout {
+public:
+    explicit SpeakerLayout(int channels);
+
+    // Computes the speaker gains for count sources in one pass. Azimuths are in
+    // degrees clockwise from the front, and every gain set is scaled by the
+    // matching distance gain
+    void pan(float const* azimuths,
+             float const* distance_gains,
+             SpeakerGains* out,
+             std::size_t count) const;
+
+private:
+    // Two neighbouring speakers, with the inverse of the matrix formed by
+    // their direction vectors
+    struct SpeakerPair {
+        int first;
+        int second;
+        float inverse[2][2];
+    };
+
+    std::vector<SpeakerPair> pairs;
+};
+
+// Per voice panning state. Gains are recomputed in a batch once per audio
+// callback when the voice or the listener moved
+struct SurroundVoice {
+    bool enabled = false;
+    bool dirty = false;
+    vec3f position;
+    float max_distance = 0.0f;
+    SpeakerGains gains {};
+    SpeakerGains previous_gains {};
+};
+
+} // namespace audeo::detail
+
+#endif
@@ -0,0 +1,295 @@
+#include "audeo/OfflineRender.hpp"
+#include "audeo/Engine.hpp"
+#include "audeo/adpcm.hpp"
+#include "audeo/exception.hpp"
+#include "audeo/source_loader.hpp"
+#include "audeo/trace.hpp"
+
+#include <SDL.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace audeo {
+
+namespace {
+
+// Scenes are mixed in audio callbacks of at most this many frames. Callbacks
+// also end at every command, so commands apply at their exact frame
+constexpr unsigned int block_frames = 256;
+
+using ConvertedSamples = std::shared_ptr<std::vector<std::uint8_t> const>;
+using CompressedSamples = std::shared_ptr<detail::AdpcmBuffer const>;
+
+// Runs work on thread_count threads, including the calling one. The first
+// exception thrown on any of them is rethrown once they all finished
+template<typename F> void run_on_threads(unsigned int thread_count, F const& work) {
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto const run = [&] {
+        AUDEO_TRY { work(); }
+        AUDEO_CATCH(...) {
+            std::lock_guard lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < thread_count; ++i) {
+        workers.emplace_back([&run] {
+            AUDEO_TRACE_THREAD("audeo offline renderer");
+            run();
+        });
+    }
+    run();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+#ifndef AUDEO_NO_EXCEPTIONS
+    if (error) {
+        std::rethrow_exception(error);
+    }
+#endif
+}
+
+// Applies a command to the engine of a scene. sounds holds the sound of every
+// play so far, and emitters every emitter created so far. Both are invalid for
+// the calls that failed
+void apply(Engine& engine,
+           std::vector<SoundSource> const& sources,
+           std::vector<Sound>& sounds,
+           std::vector<Emitter>& emitters,
+           SceneCommand const& command) {
+    switch (command.type) {
+        case SceneCommandType::Play:
+            sounds.push_back(command.source < sources.size()
+                                 ? engine.play_sound(sources[command.source], command.loop_count,
+                                                     command.fade_ms)
+                                 : Sound());
+            return;
+        case SceneCommandType::SetListenerPosition:
+            if (command.listener < engine.get_listener_count()) {
+                engine.set_listener_position(command.listener, command.vector);
+            }
+            return;
+        case SceneCommandType::SetListenerForward:
+            if (command.listener < engine.get_listener_count()) {
+                engine.set_listener_forward(command.listener, command.vector);
+            }
+            return;
+        case SceneCommandType::SetListenerCount:
+            engine.set_listener_count(std::max<std::size_t>(1, command.listener));
+            return;
+        case SceneCommandType::CreateEmitter:
+            emitters.push_back(command.source < sources.size()
+                                   ? engine.create_emitter(sources[command.source], command.vector)
+                                   : Emitter(-1));
+            return;
+        case SceneCommandType::UpdateEmitters: engine.update_emitters(); return;
+        case SceneCommandType::LoadHrtf:
+            if (!engine.load_hrtf(command.path)) {
+                std::string const message = "Audeo: Unable to load HRTF " + command.path;
+                AUDEO_THROW(audeo::exception(message.c_str()));
+            }
+            return;
+        case SceneCommandType::UnloadHrtf: engine.unload_hrtf(); return;
+        case SceneCommandType::EnableAmbisonics: engine.enable_ambisonics(command.order); return;
+        case SceneCommandType::DisableAmbisonics: engine.disable_ambisonics(); return;
+        default: break;
+    }
+
+    // The engine ignores emitters that were destroyed
+    Emitter const emitter = command.emitter < emitters.size() ? emitters[command.emitter]
+                                                               : Emitter(-1);
+    switch (command.type) {
+        case SceneCommandType::DestroyEmitter: engine.destroy_emitter(emitter); return;
+        case SceneCommandType::SetEmitterPosition:
+            engine.set_emitter_position(emitter, command.vector);
+            return;
+        default: break;
+    }
+
+    // The engine ignores sounds that already finished
+    Sound sound;
+    if (command.sound == emitter_sound) {
+        sound = engine.get_emitter_sound(emitter).value_or(Sound());
+    } else if (command.sound < sounds.size()) {
+        sound = sounds[command.sound];
+    } else {
+        return;
+    }
+    switch (command.type) {
+        case SceneCommandType::Stop: engine.stop_sound(sound, command.fade_ms); break;
+        case SceneCommandType::Pause: engine.pause_sound(sound); break;
+        case SceneCommandType::Resume: engine.resume_sound(sound); break;
+        case SceneCommandType::SetVolume: engine.set_volume(sound, command.value); break;
+        case SceneCommandType::SetPosition: engine.set_position(sound, command.vector); break;
+        case SceneCommandType::SetPitch: engine.set_pitch(sound, command.value); break;
+        case SceneCommandType::SetDistanceRangeMax:
+            engine.set_distance_range_max(sound, command.value);
+            break;
+        case SceneCommandType::SetResampleQuality:
+            engine.set_resample_quality(sound, command.quality);
+            break;
+        case SceneCommandType::ReverseStereo:
+            engine.reverse_stereo(sound, command.value != 0.0f);
+            break;
+        case SceneCommandType::AddEffect: engine.add_effect(sound, command.effect); break;
+        default: break;
+    }
+}
+
+// Renders a scene with an engine of its own that has no audio device, so it
+// plays through the same voices, effects and panning as a live engine
+void render_scene(Scene const& scene,
+                  OfflineRenderInfo const& info,
+                  std::vector<std::string> const& paths,
+                  std::vector<ConvertedSamples> const& samples,
+                  std::vector<CompressedSamples> const& compressed,
+                  std::vector<std::size_t> const& source_indices,
+                  std::vector<float>& out) {
+    AUDEO_TRACE_SCOPE("render_scene");
+    InitInfo init_info;
+    init_info.frequency = info.frequency;
+    init_info.output_channels = static_cast<OutputChannelCount>(info.output_channels);
+    init_info.chunk_size = block_frames;
+    init_info.resample_quality = info.resample_quality;
+    // A channel for every play and emitter, so no sound fails for lack of one
+    auto const play_count = std::count_if(
+        scene.commands.begin(), scene.commands.end(), [](SceneCommand const& command) {
+            return command.type == SceneCommandType::Play ||
+                   command.type == SceneCommandType::CreateEmitter;
+        });
+    init_info.effect_channels = static_cast<unsigned int>(std::max<std::ptrdiff_t>(1, play_count));
+    Engine engine;
+    if (!engine.init_offline(init_info)) {
+        return;
+    }
+
+    std::vector<SoundSource> sources;
+    for (std::size_t i = 0; i < scene.sources.size(); ++i) {
+        SceneSource const& scene_source = scene.sources[i];
+        std::size_t const index = source_indices[i];
+        bool const is_compressed = scene_source.compression == SourceCompression::Adpcm;
+        SoundSource const source = detail::load_converted_source(
+            engine, paths[index], samples[index], is_compressed ? compressed[index] : nullptr);
+        engine.set_default_volume(source, scene_source.volume);
+        engine.set_default_position(source, scene_source.position);
+        engine.set_default_distance_range_max(source, scene_source.distance_range_max);
+        engine.set_default_max_instances(source, scene_source.max_instances,
+                                         scene_source.limit_behavior);
+        engine.set_default_min_retrigger_interval(source, scene_source.min_retrigger_interval_ms);
+        sources.push_back(source);
+    }
+
+    std::vector<SceneCommand const*> commands;
+    for (SceneCommand const& command : scene.commands) {
+        commands.push_back(&command);
+    }
+    std::stable_sort(commands.begin(), commands.end(), [](auto const* a, auto const* b) {
+        return a->frame < b->frame;
+    });
+
+    std::size_t const channels = info.output_channels;
+    out.assign(scene.frame_count * channels, 0.0f);
+    std::vector<Sound> sounds;
+    std::vector<Emitter> emitters;
+    std::int64_t frame = 0;
+    auto const render_until = [&](std::int64_t end) {
+        if (end > frame) {
+            engine.render(&out[frame * channels], static_cast<std::size_t>(end - frame));
+            frame = end;
+        }
+        // Like a game loop would, so finished sounds are cleaned up
+        engine.poll_events();
+    };
+    for (SceneCommand const* command : commands) {
+        if (command->frame >= scene.frame_count) {
+            break;
+        }
+        render_until(command->frame);
+        apply(engine, sources, sounds, emitters, *command);
+    }
+    render_until(scene.frame_count);
+}
+
+} // namespace
+
+std::vector<std::vector<float>> render_scenes(std::vector<Scene> const& scenes,
+                                              OfflineRenderInfo const& info) {
+    AUDEO_TRACE_SCOPE("render_scenes");
+    int const channels = static_cast<int>(info.output_channels);
+    if (channels != 1 && channels != 2 && channels != 4 && channels != 6 && channels != 8) {
+        AUDEO_THROW(audeo::exception("Audeo: Unsupported output channel count"));
+        return {};
+    }
+    unsigned int const thread_count = info.thread_count > 0
+                                          ? info.thread_count
+                                          : std::max(1u, std::thread::hardware_concurrency());
+
+    // Find every distinct file, so each is decoded once
+    std::vector<std::string> paths;
+    std::unordered_map<std::string, std::size_t> path_indices;
+    std::vector<std::vector<std::size_t>> source_indices(scenes.size());
+    // Whether any source of the file is compressed
+    std::vector<bool> compress;
+    for (std::size_t i = 0; i < scenes.size(); ++i) {
+        for (SceneSource const& source : scenes[i].sources) {
+            auto const [it, inserted] = path_indices.try_emplace(source.path, paths.size());
+            if (inserted) {
+                paths.push_back(source.path);
+                compress.push_back(false);
+            }
+            if (source.compression == SourceCompression::Adpcm) {
+                compress[it->second] = true;
+            }
+            source_indices[i].push_back(it->second);
+        }
+    }
+
+    // Decoded in the output format, the way an engine without an audio device
+    // decodes its sources. Compressed sources are encoded from those samples
+    std::vector<ConvertedSamples> samples(paths.size());
+    std::vector<CompressedSamples> compressed(paths.size());
+    std::atomic<std::size_t> next_path {0};
+    run_on_threads(std::min<std::size_t>(thread_count, paths.size()), [&] {
+        for (std::size_t i = next_path++; i < paths.size(); i = next_path++) {
+            detail::EffectLoad load;
+            load.path = paths[i];
+            load.format = AUDIO_F32SYS;
+            load.channels = channels;
+            load.frequency = static_cast<int>(info.frequency);
+            detail::decode_effect(load);
+            samples[i] = std::move(load.pcm);
+            if (samples[i] && compress[i]) {
+                compressed[i] = std::make_shared<detail::AdpcmBuffer const>(detail::adpcm_encode(
+                    reinterpret_cast<float const*>(samples[i]->data()), channels,
+                    static_cast<std::int64_t>(samples[i]->size() / sizeof(float) / channels)));
+            }
+        }
+    });
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        if (!samples[i]) {
+            AUDEO_THROW(audeo::exception(("Audeo: Unable to load " + paths[i]).c_str()));
+            return {};
+        }
+    }
+
+    std::vector<std::vector<float>> outputs(scenes.size());
+    std::atomic<std::size_t> next_scene {0};
+    run_on_threads(std::min<std::size_t>(thread_count, scenes.size()), [&] {
+        for (std::size_t i = next_scene++; i < scenes.size(); i = next_scene++) {
+            render_scene(scenes[i], info, paths, samples, compressed, source_indices[i],
+                         outputs[i]);
+        }
+    });
+    return outputs;
+}
+
+} // namespace audeo
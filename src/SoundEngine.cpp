@@ -1,5 +1,22 @@
+#include "audeo/CommandBuffer.hpp"
+#include "audeo/Engine.hpp"
 #include "audeo/SoundEngine.hpp"
+#include "audeo/adpcm.hpp"
+#include "audeo/ambisonics.hpp"
+#include "audeo/bank.hpp"
+#include "audeo/command_log.hpp"
 #include "audeo/effects.hpp"
+#include "audeo/emitter_grid.hpp"
+#include "audeo/hrtf.hpp"
+#include "audeo/mixer.hpp"
+#include "audeo/occlusion.hpp"
+#include "audeo/resampler.hpp"
+#include "audeo/sample_format.hpp"
+#include "audeo/source_loader.hpp"
+#include "audeo/spsc_queue.hpp"
+#include "audeo/trace.hpp"
+#include "audeo/stream.hpp"
+#include "audeo/vbap.hpp"
 
 // SDL headers
 #define SDL_MAIN_HANDLED
@@ -7,22 +24,67 @@
 #include <SDL_audio.h>
 #include <SDL_mixer.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <functional>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace audeo {
 
 namespace {
 
-// Functions and data that control the engine's state
+// Decoded samples of an effect. Sources loaded from the same file, or from
+// files with identical contents, share one instance
+struct EffectSamples {
+    EffectSamples() = default;
+    EffectSamples(EffectSamples const&) = delete;
+    EffectSamples& operator=(EffectSamples const&) = delete;
+    // Frees the samples once the last source using them is freed
+    ~EffectSamples();
+
+    Mix_Chunk* chunk = nullptr;
+    // Set instead of chunk by engines without an audio device. The offline
+    // renderer shares these between the engines of its scenes
+    std::shared_ptr<std::vector<std::uint8_t> const> pcm;
+    // Samples loaded with SourceCompression::Adpcm are kept here instead of in
+    // chunk
+    detail::AdpcmBuffer adpcm;
+    // Set for samples in a sound bank, to keep its mapping alive. Banks are
+    // paged in and out by the OS, so they don't count against the memory budget
+    std::shared_ptr<detail::BankFile> bank;
+    // The samples voices read from. These point into chunk, pcm, adpcm or bank
+    std::uint8_t const* data = nullptr;
+    std::size_t size = 0;
+    std::int64_t frame_count = 0;
+    bool is_adpcm = false;
+    // Sample rate of the PCM data. Chunks loaded through Mix_LoadWAV, and
+    // pcm, are always converted to the device frequency
+    int sample_rate = 0;
+    // The samples are loaded from here again after they were evicted
+    std::string path;
+    SourceCompression compression = SourceCompression::None;
+    // False for samples that were evicted to stay within the memory budget, or
+    // that failed to load. They are loaded again when they play
+    bool resident = false;
+    // Set while the samples are decoded in the background after prefetch()
+    std::shared_ptr<detail::EffectLoad> pending_load;
+    // Value of source_use_count when these samples were last loaded or played
+    std::uint64_t last_used = 0;
+    // Hash of the loaded samples, used to find files with the same contents
+    std::uint64_t content_hash = 0;
+    // The engine that accounts for the memory of these samples
+    detail::EngineState* owner = nullptr;
+};
 
 struct SoundSourceData {
-    using data_t = union {
-        Mix_Chunk* chunk = nullptr;
-        Mix_Music* music;
-    };
-
     struct DefaultParameters {
         // volume is a value between 0 and 1, where 0 means silent and 1 means
         // max volume
@@ -31,71 +93,254 @@ struct SoundSourceData {
         vec3f position;
         // Maximum distance for this sound to be heard
         float distance_range_max = 255;
+        // Amount of sounds of this source that may play at once. 0 means there
+        // is no limit
+        unsigned int max_instances = 0;
+        InstanceLimitBehavior limit_behavior = InstanceLimitBehavior::Reject;
+        // Plays closer than this to the previous play are rejected
+        Uint32 min_retrigger_ms = 0;
     };
 
     bool is_music = false;
+    // Streamed sources don't have samples in memory. Every sound played from
+    // them opens the file again
+    bool is_stream = false;
 
-    data_t data;
+    Mix_Music* music = nullptr;
+    // Set for effects
+    std::shared_ptr<EffectSamples> samples;
     DefaultParameters default_params;
+    // mixer.ticks() of the last successful play, for min_retrigger_ms
+    std::optional<Uint32> last_play_ticks;
+    std::string stream_path;
+    detail::WavInfo stream_info;
+};
+
+// A SetVolume or SetPosition call applied by submit()
+struct BatchedRecord {
+    detail::LoggedCall call = detail::LoggedCall::SetVolume;
+    Sound sound;
+    float volume = 0.0f;
+    vec3f position;
+};
+
+// Format of the opened audio device, as reported by Mix_QuerySpec(), or the
+// format an engine without one mixes
+struct DeviceSpec {
+    int frequency = 0;
+    std::uint16_t format = 0;
+    int channels = 0;
+    // Frames per audio callback, as passed to Mix_OpenAudio()
+    int chunk_frames = 0;
+};
+
+// Playback state of a single effect channel. Effects are not mixed by SDL_Mixer
+// directly. Instead, every effect channel plays the silent chunk in an endless
+// loop and render_voice() overwrites the channel's buffer with the actual
+// output. This lets us play a chunk at any rate, and makes us responsible for
+// counting loops, fading and finishing the sound. The channel is paused while
+// no sound plays on it. It never stops, so SDL_Mixer keeps its effects
+// registered, and playing a sound doesn't allocate them again.
+struct Voice {
+    bool active = false;
+    bool finished = false;
+    // Set when reverse_stereo() or add_effect() registered effects that have
+    // to be removed before the next sound plays on this channel
+    bool extra_effects = false;
+    // The sound playing on this voice, for events sent by the audio thread
+    Sound sound;
+    SoundSource source;
+    // Set while a stream can't keep up, so StreamStarved is only sent once
+    bool starved = false;
+    // The audio callback that first rendered this voice, as counted by
+    // total_callbacks. -1 until it was rendered
+    std::int64_t first_callback = -1;
+    Uint8 const* pcm = nullptr;
+    // Set instead of pcm for compressed sources. The most recently decoded
+    // block is kept in decode_cache, since consecutive blocks read mostly the
+    // same frames
+    std::uint8_t const* adpcm = nullptr;
+    std::vector<float> decode_cache;
+    std::int64_t cached_block = -1;
+    std::int64_t frame_count = 0;
+    int source_rate = 0;
+    // Read position in source frames
+    double position = 0.0;
+    // Source frames to advance per output frame
+    double step = 1.0;
+    // Remaining loops. -1 loops forever
+    int loops = 0;
+    // Fades move fade_gain linearly to fade_target over fade_frames output
+    // frames. The voice finishes when a fade out ends
+    float fade_gain = 1.0f;
+    float fade_target = 1.0f;
+    std::int64_t fade_frames = 0;
+    bool fading_out = false;
+    ResampleQuality quality = ResampleQuality::Sinc;
+    // Set for sounds played from a streamed source. Positions are then counted
+    // from the start of the stream, and the stream does the looping
+    std::shared_ptr<detail::Stream> stream;
+    detail::HrtfVoice hrtf;
+    detail::AmbisonicVoice ambisonic;
+    detail::SurroundVoice surround;
+    detail::OcclusionVoice occlusion;
+};
+
+// Listener state as seen by the audio thread when panning surround voices
+struct ListenerSnapshot {
+    vec3f position;
+    vec3f forward;
+    vec3f right;
+    vec3f up;
+};
+
+// Voices are rendered in blocks of this many frames, so the scratch buffers can
+// be allocated once at init
+constexpr int voice_block_frames = 256;
+
+// Parts of the audio callback that are timed separately
+enum MixStage {
+    stage_voices,
+    stage_occlusion,
+    stage_hrtf,
+    stage_ambisonics,
+    stage_surround,
+    stage_count
+};
+
+// Callback durations kept for percentiles
+constexpr std::size_t recent_callback_count = 1024;
+
+// Timing of the audio callbacks. Written by the audio thread, and read with
+// the audio lock held
+struct MixStats {
+    // Set by the first of our effects that runs in an audio callback
+    bool in_callback = false;
+    std::chrono::steady_clock::time_point callback_start;
+    std::uint64_t callbacks = 0;
+    std::uint64_t underruns = 0;
+    double min_us = 0.0;
+    double max_us = 0.0;
+    double total_us = 0.0;
+    double total_budget_us = 0.0;
+    // Indexed by callbacks modulo recent_callback_count
+    std::array<float, recent_callback_count> recent_us {};
+    std::array<float, recent_callback_count> recent_budget_us {};
+    std::array<double, stage_count> stage_us {};
+};
+
+// See InitInfo::adaptive_chunk_size
+struct AdaptiveBuffer {
+    bool enabled = false;
+    int min_frames = 0;
+    int max_frames = 0;
+    Uint32 stable_ms = 0;
+    // total_underruns at the last check
+    std::uint64_t underruns = 0;
+    // Start of the current period without underruns
+    Uint32 stable_since = 0;
+    // Callbacks right after opening the device are irregular, so underruns
+    // are ignored until then
+    Uint32 settle_until = 0;
+    std::size_t resizes = 0;
+};
+
+// Adds the time spent on each stage of an effect to mix_stats. The first
+// timer in an audio callback also starts timing the callback
+class StageTimer {
+public:
+    explicit StageTimer(MixStats& mix_stats) :
+        mix_stats(mix_stats), last(std::chrono::steady_clock::now()) {
+        if (!mix_stats.in_callback) {
+            mix_stats.in_callback = true;
+            mix_stats.callback_start = last;
+        }
+    }
+
+    // Adds the time since the previous lap to stage
+    void lap(MixStage stage) {
+        auto const now = std::chrono::steady_clock::now();
+        mix_stats.stage_us[stage] += std::chrono::duration<double, std::micro>(now - last).count();
+        last = now;
+    }
+
+private:
+    MixStats& mix_stats;
+    std::chrono::steady_clock::time_point last;
 };
 
-std::unordered_map<SoundSource, SoundSourceData> sound_sources;
-std::unordered_map<Sound, SoundData> active_sounds;
-std::unordered_map<int, Sound> channel_map;
+// A playing sound
+struct SoundSlot {
+    Sound sound;
+    SoundData data;
+    bool active = false;
+};
 
-// Default constructed to (0, 0, 0)
-vec3f listener_pos;
-vec3f listener_forward = {0.0f, 0.0f, -1.0f};
+// Sound handles keep their slot in this many low bits
+constexpr int sound_slot_bits = 20;
+
+struct Listener {
+    // Default constructed to (0, 0, 0)
+    vec3f position;
+    vec3f forward = {0.0f, 0.0f, -1.0f};
+};
 
-SoundFinishCallbackT finish_callback = detail::no_callback;
+struct EmitterData {
+    SoundSource source;
+    vec3f position;
+    float max_distance = 0.0f;
+    // The sound playing for this emitter. Invalid while the emitter is virtual
+    Sound sound;
+    // Emitters play as if they started at creation time, even while virtual
+    Uint32 start_ticks = 0;
+    // Value of emitter_update_count when this emitter was last found in range
+    std::uint32_t audible_update = 0;
+};
 
+// Shared by all engines, so handles are unique in the whole process
 template<typename T> struct HandleGenerator {
-    static std::int64_t cur;
+    static std::atomic<std::int64_t> cur;
     static std::int64_t next() { return cur++; }
 };
 
-template<typename T> std::int64_t HandleGenerator<T>::cur = 0;
+template<typename T> std::atomic<std::int64_t> HandleGenerator<T>::cur {0};
 
 using SoundHandleGenerator = HandleGenerator<Sound>;
 using SourceHandleGenerator = HandleGenerator<SoundSource>;
+using EmitterHandleGenerator = HandleGenerator<Emitter>;
 
-struct SoundFinishedCallbacks {
-    static void remove_sound_from_map(int channel) {
-        if (auto sound_it = channel_map.find(channel); sound_it != channel_map.end()) {
-            Sound sound = sound_it->second;
-            finish_callback(sound);
-            channel_map.erase(sound_it);
-            active_sounds.erase(sound);
-        } else {
-            AUDEO_THROW(audeo::exception("Invalid channel"));
-        }
-    }
+constexpr double pi = 3.14159265358979323846;
 
-    static void channel_callback(int channel) {
-        remove_sound_from_map(channel);
-        // Unregister all effects from this channel, so that they won't apply to
-        // the next sound that plays here
-        Mix_UnregisterAllEffects(channel);
-    }
-    static void music_callback() {
-        // -1 is the music channel in the channel map
-        remove_sound_from_map(-1);
+// Computes a listener's coordinate system. Up is always the world Y axis
+void listener_basis(Listener const& listener, vec3f& forward, vec3f& right, vec3f& up) {
+    forward = normalize(listener.forward);
+    right = normalize(cross(forward, vec3f{0, 1, 0}));
+    up = cross(right, forward);
+}
+
+// Memory used by loaded samples
+std::size_t samples_size(EffectSamples const& samples) { return samples.bank ? 0 : samples.size; }
+
+// 64 bit FNV-1a
+std::uint64_t hash_bytes(std::uint8_t const* bytes, std::size_t size) {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
     }
-};
+    return hash;
+}
+
+std::string samples_key(std::string_view path, SourceCompression compression) {
+    return std::string(path) + '\n' + std::to_string(static_cast<int>(compression));
+}
 
 float map_range(float a, float b, float c, float d, float x) {
     // https://math.stackexchange.com/questions/377169/calculating-a-value-inside-one-range-to-a-value-of-another-range
     return (x - a) * ((d - c) / (b - a)) + c;
 }
 
-} // namespace
-
-static Sound play_music(SoundSource source, int loop_count, int fade_in_ms);
-static std::pair<Sound, int> play_effect(SoundSource source, int loop_count, int fade_in_ms);
-
-static void set_effect_position(int channel, vec3f position, float max_distance);
-
-static int to_mix_format(AudioFormat format) {
+int to_mix_format(AudioFormat format) {
     switch (format) {
         case AudioFormat::U8: return AUDIO_U8;
         case AudioFormat::S8: return AUDIO_S8;
@@ -110,493 +355,3776 @@ static int to_mix_format(AudioFormat format) {
     return MIX_DEFAULT_FORMAT;
 }
 
-bool init(InitInfo const& info) {
-    // Initialize SDL
-    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
-        std::string error = SDL_GetError();
-        AUDEO_THROW(
-            audeo::exception(("Audeo: Unable to initliaze SDL audeo. Reason: " + error).c_str()));
-        // This return can only be reached when exceptions are disabled
-        return false;
-    }
-    // Initialize SDL_Mixer
-    if (Mix_OpenAudio(info.frequency, to_mix_format(info.format),
-                      static_cast<int>(info.output_channels), info.chunk_size) == -1) {
-        // Mix_GetError() is the same as SDL_GetError()
-        std::string error = Mix_GetError();
-        AUDEO_THROW(
-            audeo::exception(("Audeo: Unable to initialize SDL_Mixer. Reason: " + error).c_str()));
-        return false;
-    }
-    // Load dynamic libraries for SDL_Mixer
-    const int flags = MIX_INIT_FLAC | MIX_INIT_MOD | MIX_INIT_OGG | MIX_INIT_MP3;
-    if ((flags & Mix_Init(flags)) != flags) {
-        std::string error = Mix_GetError();
-        AUDEO_THROW(
-            audeo::exception(("Audeo: Could not load all audio types. Reason: " + error).c_str()));
-        return false;
-    }
-    // Allocate channels for effects
-    Mix_AllocateChannels(info.effect_channels);
-
-    // Initialize callbacks
-    Mix_HookMusicFinished(&SoundFinishedCallbacks::music_callback);
-    Mix_ChannelFinished(&SoundFinishedCallbacks::channel_callback);
+} // namespace
 
-    return true;
-}
+namespace detail {
+
+// Everything an Engine owns. The functions of Engine forward to the members of
+// the same name. The audio thread reaches the engine through the user data of
+// its SDL_Mixer callbacks
+struct EngineState {
+    EngineState() = default;
+    EngineState(EngineState const&) = delete;
+    EngineState& operator=(EngineState const&) = delete;
+    ~EngineState();
+
+    // The public functions, see SoundEngine.hpp
+
+    bool init(InitInfo const& info);
+    bool init_offline(InitInfo const& info);
+    void quit();
+    void render(float* out, std::size_t frame_count);
+    SoundSource load_converted_source(std::string_view path,
+                                      std::shared_ptr<std::vector<std::uint8_t> const> pcm,
+                                      std::shared_ptr<detail::AdpcmBuffer const> adpcm);
+    bool is_playing_music();
+    unsigned int effect_channel_count();
+    void allocate_effect_channels(unsigned int count);
+    SoundSource load_source(std::string_view path, AudioType type, SourceCompression compression);
+    bool free_source(SoundSource source);
+    std::size_t free_unused_sources();
+    std::unordered_map<std::string, SoundSource> load_bank(std::string_view path);
+    bool prefetch(SoundSource source);
+    void set_source_memory_budget(std::size_t bytes);
+    SourceCacheStats get_source_cache_stats();
+    EngineStats get_stats();
+    void reset_stats();
+    bool is_playing(SoundSource source);
+    bool source_is_music(SoundSource source);
+    bool set_default_volume(SoundSource source, float volume);
+    bool set_default_position(SoundSource source, float x, float y, float z);
+    bool set_default_position(SoundSource source, vec3f position);
+    bool set_default_distance_range_max(SoundSource source, float distance);
+    bool set_default_max_instances(SoundSource source,
+                                   unsigned int count,
+                                   InstanceLimitBehavior behavior);
+    bool set_default_min_retrigger_interval(SoundSource source, int interval_ms);
+    Sound play_sound(SoundSource source, int loop_count, int fade_in_ms);
+    Sound play_sound(SoundSource source, loop_forever_t, int fade_in_ms);
+    bool is_valid(Sound sound);
+    bool is_valid(SoundSource source);
+    std::optional<float> get_volume(Sound sound);
+    std::optional<vec3f> get_position(Sound sound);
+    std::optional<float> get_pitch(Sound sound);
+    double get_output_latency();
+    std::optional<double> get_time_until_audible(Sound sound);
+    vec3f get_listener_position();
+    vec3f get_listener_forward();
+    vec3f get_listener_position(std::size_t listener);
+    vec3f get_listener_forward(std::size_t listener);
+    std::size_t get_listener_count();
+    bool pause_sound(Sound sound);
+    bool resume_sound(Sound sound);
+    bool stop_sound(Sound sound, int fade_out_ms = 0);
+    bool set_volume(Sound sound, float volume);
+    bool set_position(Sound sound, float x, float y, float z);
+    bool set_position(Sound sound, vec3f position);
+    bool set_distance_range_max(Sound sound, float distance);
+    bool set_pitch(Sound sound, float pitch);
+    bool set_resample_quality(Sound sound, ResampleQuality quality);
+    void submit(CommandBuffer& buffer);
+    void set_listener_position(vec3f new_position);
+    void set_listener_position(float new_x, float new_y, float new_z);
+    void set_listener_position(std::size_t listener, vec3f new_position);
+    void set_listener_forward(vec3f new_forward);
+    void set_listener_forward(float new_x, float new_y, float new_z);
+    void set_listener_forward(std::size_t listener, vec3f new_forward);
+    void set_listener_count(std::size_t count);
+    bool reverse_stereo(Sound sound, bool reverse);
+    bool add_effect(Sound sound, Effect effect);
+    Emitter create_emitter(SoundSource source, vec3f position);
+    bool destroy_emitter(Emitter emitter);
+    bool is_valid(Emitter emitter);
+    bool set_emitter_position(Emitter emitter, vec3f position);
+    std::optional<Sound> get_emitter_sound(Emitter emitter);
+    void update_emitters();
+    bool load_hrtf(std::string_view directory);
+    void unload_hrtf();
+    bool is_hrtf_enabled();
+    bool enable_ambisonics(AmbisonicOrder order);
+    void disable_ambisonics();
+    bool is_ambisonics_enabled();
+    void set_occlusion_query(OcclusionQueryT query, OcclusionSettings const& settings);
+    void clear_occlusion_query();
+    std::optional<float> get_occlusion(Sound sound);
+    void set_sound_finish_callback(SoundFinishCallbackT callback, void* user_data);
+    void set_sound_finish_callback(std::function<void(Sound)> callback);
+    void set_event_callback(EventCallbackT callback);
+    std::size_t poll_events();
+    bool poll_event(Event& event);
+    bool wait_event(Event& event, int timeout_ms);
+    bool wait_for(Sound sound, int timeout_ms);
+    bool start_recording(std::string_view path);
+    void stop_recording();
+
+    // Internal functions
+
+    void setup(InitInfo const& info);
+    void push_event(EventType type, Sound sound, SoundSource source);
+    detail::CommandLog* begin_record(detail::LoggedCall call);
+    detail::CommandLog* begin_record(detail::LoggedCall call, std::int64_t frame);
+    template<typename F> bool wait_until(int timeout_ms, F const& ready);
+    Sound make_sound_handle(int channel);
+    SoundSlot* find_sound(Sound sound);
+    void remove_sound(int channel);
+    std::size_t nearest_listener(vec3f position);
+    std::vector<vec3f> listener_positions();
+    void orient_ambisonic_bus(std::size_t index);
+    std::size_t frame_size();
+    void prepare_load(EffectSamples const& samples, detail::EffectLoad& load);
+    bool install_effect(EffectSamples& samples, detail::EffectLoad& load);
+    bool load_effect(EffectSamples& samples);
+    void unload_effect(EffectSamples& samples);
+    std::shared_ptr<EffectSamples> intern_samples(std::shared_ptr<EffectSamples> samples);
+    void intern_source_samples(std::shared_ptr<EffectSamples> const& samples);
+    void enforce_source_budget();
+    void collect_prefetched_samples();
+    double voice_step(float pitch, int source_rate);
+    void resize_voices(unsigned int count);
+    Sound play_sound(SoundSource source,
+                     int loop_count,
+                     int fade_in_ms,
+                     std::optional<float> volume,
+                     std::optional<vec3f> position);
+    Sound play_music(SoundSource source, int loop_count, int fade_in_ms, float volume);
+    Sound play_sound_at(SoundSource source,
+                        int loop_count,
+                        int fade_in_ms,
+                        vec3f position,
+                        float max_distance,
+                        double start_seconds,
+                        float volume);
+    bool admit_play(SoundSource source);
+    std::pair<Sound, int> play_effect(SoundSource source,
+                                      int loop_count,
+                                      int fade_in_ms,
+                                      vec3f position,
+                                      float max_distance,
+                                      double start_seconds,
+                                      float volume);
+    void set_effect_position(int channel, vec3f position, float max_distance);
+    void set_hrtf_position(int channel, vec3f position, float max_distance);
+    void set_ambisonic_position(int channel, vec3f position, float max_distance);
+    void set_surround_position(int channel, vec3f position, float max_distance);
+    void update_surround_listener();
+    void reset_effect_positions();
+    int free_channel();
+    void start_channel(int channel);
+    bool reopen_device(int chunk_frames);
+    void adapt_buffer_size();
+
+    // Run on the audio thread
+
+    void convert_frames(Voice& voice, std::int64_t index, std::int64_t count, float* out);
+    void gather_frames(Voice& voice, std::int64_t first, std::int64_t count, float* out);
+    bool read_frames(Voice& voice, std::int64_t first, std::int64_t count, float* out);
+    void starve_voice(Voice& voice, float* out, int frames);
+    void render_voice_block(Voice& voice, float* out, int frames);
+    void render_voice(int channel, void* stream, int length);
+    void surround_direction(detail::SurroundVoice const& voice, float& azimuth, float& gain);
+    void update_surround_panning();
+    void decode_ambisonics(void* stream, int length);
+    void finish_mix_stats(int length);
+    void apply_fade(Voice& voice, float* out, int frames);
+    void finish_voice(int channel);
+    void music_finished();
+
+    DeviceSpec device;
+    // SDL_Mixer's channels, or the software mixer of an engine that was
+    // initialized with init_offline()
+    detail::Mixer mixer;
+    // Indexed by channel
+    std::vector<Voice> voices;
+    ResampleQuality default_resample_quality = ResampleQuality::Sinc;
+    // Null unless an HRTF set was loaded with load_hrtf()
+    std::unique_ptr<detail::HrtfSet> hrtf_set;
+    // The directory hrtf_set was loaded from, for recordings
+    std::string hrtf_directory;
+    // Empty unless enable_ambisonics() was called. Every listener has its own
+    // bus, which are all decoded into the output
+    std::vector<std::unique_ptr<detail::AmbisonicBus>> ambisonic_buses;
+    // Null unless the device has more than two output channels
+    std::unique_ptr<detail::SpeakerLayout> speaker_layout;
+    // One per listener
+    std::vector<ListenerSnapshot> surround_listeners;
+    // Set when a listener moved, so every surround voice has to be panned again
+    bool surround_listener_dirty = false;
+    // Null unless set_occlusion_query() was called
+    std::unique_ptr<detail::OcclusionWorker> occlusion_worker;
+    // Copy of the worker's settings, read by the audio thread
+    OcclusionSettings occlusion_settings;
+    bool occlusion_enabled = false;
+    // Scratch space for the batched panning pass, one entry per voice
+    std::vector<int> surround_channels;
+    std::vector<float> surround_azimuths;
+    std::vector<float> surround_distance_gains;
+    std::vector<detail::SpeakerGains> surround_gains;
+
+    // Allocated once at init, see voice_block_frames
+    std::vector<float> voice_scratch_in;
+    std::vector<float> voice_scratch_out;
+    std::vector<float> voice_scratch_mono;
+    detail::HrtfWork hrtf_work;
+
+    MixStats mix_stats;
+    // Like mix_stats.underruns and mix_stats.callbacks, but not cleared by
+    // reset_stats()
+    std::uint64_t total_underruns = 0;
+    std::int64_t total_callbacks = 0;
+    // Frames mixed since init(), the clock of the command log
+    std::int64_t mixed_frames = 0;
+    // End of the previous audio callback, to find callbacks that came late.
+    // Reset when the device is opened
+    std::chrono::steady_clock::time_point last_callback_end;
+    AdaptiveBuffer adaptive_buffer;
+    // Set while the device is reopened, so stopping the music doesn't finish
+    // its sound
+    bool reopening_device = false;
+
+    // Every effect channel plays this silent chunk, and render_voice()
+    // replaces it with the voice's output
+    std::vector<Uint8> silent_pcm;
+    Mix_Chunk* silent_chunk = nullptr;
+    // The silent chunk of engines without an audio device
+    Mix_Chunk silent_chunk_data {};
+    // Created when the first stream starts playing
+    std::unique_ptr<detail::StreamWorker> stream_worker;
+
+    // Limit on the memory used by effect sources. 0 means there is no limit
+    std::size_t source_memory_budget = 0;
+    std::size_t resident_source_bytes = 0;
+    std::uint64_t source_use_count = 0;
+    std::size_t source_evictions = 0;
+    std::size_t source_reloads = 0;
+    std::unordered_map<SoundSource, SoundSourceData> sound_sources;
+    // Effect samples by path and compression, and by the hash of their
+    // contents. Entries of samples that were freed expire, and are replaced
+    // when the same file is loaded again
+    std::unordered_map<std::string, std::weak_ptr<EffectSamples>> effect_samples_by_path;
+    std::unordered_multimap<std::uint64_t, std::weak_ptr<EffectSamples>> effect_samples_by_hash;
+    // See InitInfo::lazy_source_loading
+    bool lazy_source_loading = false;
+    // Created when the first source is prefetched
+    std::unique_ptr<detail::SourceLoader> source_loader;
+    // Samples with a pending_load. Freed samples expire, and are dropped along
+    // with their load
+    std::vector<std::pair<SoundSource, std::weak_ptr<EffectSamples>>> prefetching_samples;
+
+    // Playing sounds by slot. Slot 0 is the music channel, slot channel + 1
+    // the effect channel with that index. There is a slot for every channel,
+    // and sound handles encode their slot, so playing, finding and finishing
+    // sounds never allocates
+    std::vector<SoundSlot> sound_slots = std::vector<SoundSlot>(1);
+
+    // There is always at least one listener. The functions without a listener
+    // index control listener 0. Every sound is spatialized relative to its
+    // nearest listener
+    std::vector<Listener> listeners = std::vector<Listener>(1);
+
+    SoundFinishCallbackT finish_callback = detail::no_callback;
+    void* finish_callback_data = nullptr;
+    // Set with the std::function overload of set_sound_finish_callback(), which
+    // installs call_finish_function as finish_callback
+    std::function<void(Sound)> finish_function;
+    EventCallbackT event_callback;
+    // See InitInfo::immediate_finish_callbacks
+    bool immediate_finish_callbacks = false;
+    // Events waiting for poll_events(). Pushed from the audio thread, or from
+    // the engine's thread while it holds the audio lock, so there is only ever
+    // one producer at a time
+    detail::SpscQueue<Event, 1024> events;
+    // Wakes the threads in wait_event() and wait_for(). Every event posts it
+    // once per waiting thread, so the audio thread never has to take a lock
+    SDL_sem* event_semaphore = SDL_CreateSemaphore(0);
+    std::atomic<int> event_waiters {0};
+
+    std::unordered_map<Emitter, EmitterData> emitters;
+    std::unique_ptr<detail::EmitterGrid> emitter_grid;
+    // Emitters that currently have a sound playing
+    std::vector<Emitter> playing_emitters;
+    // The largest distance range of all emitters, used as the query radius
+    float emitter_query_radius = 0.0f;
+    std::uint32_t emitter_update_count = 0;
+    // Kept around between calls to update_emitters() to avoid allocating every
+    // frame
+    std::vector<Emitter> emitter_candidates;
+    std::vector<std::pair<float, Emitter>> emitters_in_range;
+
+    // Music that is playing, to restart it when the device is reopened
+    int music_loops = 0;
+    Uint32 music_start_ticks = 0;
+    // The audio callback that mixes the start of the music, as counted by
+    // total_callbacks
+    std::int64_t music_start_callback = 0;
+
+    // Null unless start_recording() was called
+    std::unique_ptr<detail::CommandLog> command_log;
+    // mixed_frames when the recording started, which is frame 0 of the log
+    std::int64_t recording_start_frame = 0;
+
+    // Scratch space of submit(), the channel and new position of every moved
+    // sound, and the records it writes once the audio device is unlocked
+    std::vector<std::pair<int, vec3f>> batched_positions;
+    std::vector<BatchedRecord> batched_records;
+};
 
-void quit() {
-    // Halt all sounds, then free them
-    for (auto const [snd, data] : active_sounds) { stop_sound(snd); }
-    free_unused_sources();
+namespace {
 
-    Mix_HookMusicFinished(nullptr);
-    Mix_ChannelFinished(nullptr);
+// The engine that opened the audio device. SDL_Mixer has a single device per
+// process, and its finish hooks don't take user data
+std::atomic<EngineState*> device_owner {nullptr};
 
-    // Stop SDL and SDL_Mixer subsystems
-    Mix_CloseAudio();
-    SDL_Quit();
-    Mix_Quit();
+// Callbacks registered with SDL_Mixer. The effects and the postmix callback get
+// their engine as user data
+void render_voice_effect(int channel, void* stream, int length, void* engine) {
+    static_cast<EngineState*>(engine)->render_voice(channel, stream, length);
 }
 
-std::string get_audio_driver_name() { return SDL_GetCurrentAudioDriver(); }
+void surround_panning_effect(int, void*, int, void* engine) {
+    static_cast<EngineState*>(engine)->update_surround_panning();
+}
 
-bool is_playing_music() { return Mix_PlayingMusic(); }
+void decode_ambisonics_effect(int, void* stream, int length, void* engine) {
+    static_cast<EngineState*>(engine)->decode_ambisonics(stream, length);
+}
 
-unsigned int effect_channel_count() { return Mix_AllocateChannels(-1); }
+void finish_mix_stats_postmix(void* engine, Uint8*, int length) {
+    static_cast<EngineState*>(engine)->finish_mix_stats(length);
+}
 
-void allocate_effect_channels(unsigned int count) {
-    if (effect_channel_count() >= count) {
-        return;
+void music_finished_hook() {
+    if (EngineState* engine = device_owner.load()) {
+        engine->music_finished();
     }
-    Mix_AllocateChannels(count);
 }
 
-[[nodiscard]] SoundSource load_source(std::string_view path, AudioType type) {
-    SoundSource source(SourceHandleGenerator::next());
-    SoundSourceData source_data;
-    switch (type) {
-        case AudioType::Music:
-            source_data.is_music = true;
-            source_data.data.music = Mix_LoadMUS(path.data());
-            break;
-        case AudioType::Effect: source_data.data.chunk = Mix_LoadWAV(path.data()); break;
-    }
+} // namespace
 
-    // Check for errors
-    if (source_data.is_music) {
-        if (!source_data.data.music) {
-            AUDEO_THROW(audeo::exception("Audeo: Failed to load music file"));
-        }
-    } else {
-        if (!source_data.data.chunk) {
-            AUDEO_THROW(audeo::exception("Audeo: Failed to load audio chunk"));
-        }
+EngineState::~EngineState() {
+    if (device_owner.load() == this || mixer.is_software()) {
+        quit();
     }
+    // Samples report their freed memory to us, so free them while we still
+    // exist
+    sound_sources.clear();
+    SDL_DestroySemaphore(event_semaphore);
+}
 
-    sound_sources[source] = source_data;
-
-    return source;
+// Queues an event. The caller has to hold the audio lock, unless it is the
+// audio thread
+void EngineState::push_event(EventType type, Sound sound, SoundSource source) {
+    events.push(Event {type, sound, source});
+    // Pairs with the fence in wait_until(). Either we see the waiter, or it
+    // sees the event
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int i = event_waiters.load(); i > 0; --i) { SDL_SemPost(event_semaphore); }
 }
 
-bool free_source(SoundSource source) {
-    if (!is_valid(source)) {
-        return false;
-    }
-    if (is_playing(source)) {
-        return false;
+// Starts a record of a call in the command log. Returns the log to write the
+// call's arguments to, or null if nothing is recorded
+detail::CommandLog* EngineState::begin_record(detail::LoggedCall call) {
+    if (!command_log) {
+        return nullptr;
     }
+    mixer.lock();
+    std::int64_t const frame = mixed_frames;
+    mixer.unlock();
+    return begin_record(call, frame);
+}
 
-    SoundSourceData& data = sound_sources[source];
-    if (data.is_music) {
-        Mix_FreeMusic(data.data.music);
-    } else {
-        Mix_FreeChunk(data.data.chunk);
+// Starts a record of a call that was applied while the caller held the audio
+// lock, at the value mixed_frames had then
+detail::CommandLog* EngineState::begin_record(detail::LoggedCall call, std::int64_t frame) {
+    if (!command_log) {
+        return nullptr;
     }
-
-    // Remove from sound source map
-    sound_sources.erase(source);
-
-    return true;
+    command_log->begin(call, frame - recording_start_frame);
+    return command_log.get();
 }
 
-std::size_t free_unused_sources() {
-    // Create list of sources that have to be freed
-    std::vector<SoundSource> to_erase;
-    for (auto const& [source, data] : sound_sources) {
-        if (!is_playing(source)) {
-            to_erase.push_back(source);
+// Waits until ready() returns true, or timeout_ms milliseconds passed.
+// Returns the last result of ready()
+template<typename F> bool EngineState::wait_until(int timeout_ms, F const& ready) {
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    // Register before checking, so events pushed after the check post for us.
+    // Posts meant for waiters that returned early only cause another check
+    ++event_waiters;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool result = true;
+    while (!ready()) {
+        Uint32 wait_ms = SDL_MUTEX_MAXWAIT;
+        if (timeout_ms >= 0) {
+            auto const now = std::chrono::steady_clock::now();
+            if (now >= deadline) {
+                result = false;
+                break;
+            }
+            wait_ms = static_cast<Uint32>(
+                std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count());
         }
+        SDL_SemWaitTimeout(event_semaphore, wait_ms);
     }
+    --event_waiters;
+    return result;
+}
 
-    // Free all sources that have to be freed
-    for (auto src : to_erase) { free_source(src); }
-
-    return to_erase.size();
+Sound EngineState::make_sound_handle(int channel) {
+    return Sound((SoundHandleGenerator::next() << sound_slot_bits) | (channel + 1));
 }
 
-bool is_playing(SoundSource source) {
-    if (!is_valid(source)) {
-        return false;
+// Returns the slot of a playing sound, or null if the sound isn't playing
+SoundSlot* EngineState::find_sound(Sound sound) {
+    if (sound.value() < 0) {
+        return nullptr;
+    }
+    auto const slot = static_cast<std::size_t>(sound.value() & ((1 << sound_slot_bits) - 1));
+    if (slot >= sound_slots.size() || !sound_slots[slot].active ||
+        sound_slots[slot].sound != sound) {
+        return nullptr;
     }
+    return &sound_slots[slot];
+}
 
-    for (auto const& [snd, data] : active_sounds) {
-        if (data.source == source) {
-            return true;
+void EngineState::remove_sound(int channel) {
+    SoundSlot& slot = sound_slots[channel + 1];
+    if (slot.active) {
+        if (immediate_finish_callbacks) {
+            AUDEO_TRACE_SCOPE("finish_callback");
+            finish_callback(slot.sound, finish_callback_data);
         }
+        push_event(EventType::SoundFinished, slot.sound, slot.data.source);
+        if (occlusion_worker) {
+            occlusion_worker->untrack(slot.sound);
+        }
+        slot.active = false;
+    } else {
+        AUDEO_THROW(audeo::exception("Invalid channel"));
     }
-    return false;
 }
 
-bool source_is_music(SoundSource source) {
-    if (!is_valid(source)) {
-        return false;
+// Frees the channel of a sound that finished, and pauses it until the next
+// sound plays on it. Called by the audio thread, or with the audio lock held
+void EngineState::finish_voice(int channel) {
+    AUDEO_TRACE_SCOPE("finish_voice");
+    Voice& voice = voices[channel];
+    if (!voice.active) {
+        return;
     }
-
-    SoundSourceData const& data = sound_sources[source];
-    return data.is_music;
+    voice.active = false;
+    voice.finished = true;
+    // The stream worker holds on to the stream until it sees that the
+    // voice let go of it
+    voice.stream.reset();
+    remove_sound(channel);
+    mixer.pause(channel);
 }
 
-bool set_default_volume(SoundSource source, float volume) {
-    if (!is_valid(source)) {
-        return false;
+void EngineState::music_finished() {
+    AUDEO_TRACE_SCOPE("music_finished");
+    if (reopening_device) {
+        return;
     }
+    // -1 is the music channel, in slot 0
+    remove_sound(-1);
+}
 
-    // Clamp volume parameter
-    if (volume > 1)
-        volume = 1;
-    if (volume < 0)
-        volume = 0;
+// Returns the index of the listener closest to a position
+std::size_t EngineState::nearest_listener(vec3f position) {
+    std::size_t nearest = 0;
+    float nearest_distance = magnitude(position - listeners[0].position);
+    for (std::size_t i = 1; i < listeners.size(); ++i) {
+        float distance = magnitude(position - listeners[i].position);
+        if (distance < nearest_distance) {
+            nearest = i;
+            nearest_distance = distance;
+        }
+    }
+    return nearest;
+}
 
-    SoundSourceData& data = sound_sources[source];
-    data.default_params.volume = volume;
+std::vector<vec3f> EngineState::listener_positions() {
+    std::vector<vec3f> positions;
+    for (Listener const& listener : listeners) { positions.push_back(listener.position); }
+    return positions;
+}
 
-    return true;
+// Rotates the ambisonic bus of a listener to match its orientation. Callers
+// have to lock the audio device
+void EngineState::orient_ambisonic_bus(std::size_t index) {
+    vec3f forward, right, up;
+    listener_basis(listeners[index], forward, right, up);
+    ambisonic_buses[index]->set_listener_orientation(forward, right, up);
 }
 
-bool set_default_position(SoundSource source, float x, float y, float z) {
-    return set_default_position(source, {x, y, z});
+std::size_t EngineState::frame_size() {
+    return detail::sample_size(device.format) * device.channels;
 }
 
-bool set_default_position(SoundSource source, vec3f position) {
-    if (!is_valid(source)) {
-        return false;
+// Describes how to decode samples from their path
+void EngineState::prepare_load(EffectSamples const& samples, detail::EffectLoad& load) {
+    load.path = samples.path;
+    load.compress = samples.compression == SourceCompression::Adpcm;
+    load.format = device.format;
+    load.channels = device.channels;
+    if (mixer.is_software()) {
+        load.frequency = device.frequency;
     }
-
-    SoundSourceData& data = sound_sources[source];
-    data.default_params.position = position;
-
-    return true;
 }
 
-bool set_default_distance_range_max(SoundSource source, float distance) {
-    if (!is_valid(source)) {
+// Takes the decoded samples out of a finished load
+bool EngineState::install_effect(EffectSamples& samples, detail::EffectLoad& load) {
+    if (!load.loaded) {
         return false;
     }
-
-    SoundSourceData& data = sound_sources[source];
-    data.default_params.distance_range_max = distance;
-
+    samples.sample_rate = device.frequency;
+    if (load.compress) {
+        samples.adpcm = std::move(load.adpcm);
+        // Compressed sources play through the silent chunk, like streams
+        samples.is_adpcm = true;
+        samples.data = samples.adpcm.data.data();
+        samples.size = samples.adpcm.data.size();
+        samples.frame_count = samples.adpcm.frame_count;
+    } else if (load.pcm) {
+        samples.pcm = std::move(load.pcm);
+        samples.data = samples.pcm->data();
+        samples.size = samples.pcm->size();
+        samples.frame_count = samples.size / frame_size();
+    } else {
+        samples.chunk = load.chunk;
+        load.chunk = nullptr;
+        samples.data = samples.chunk->abuf;
+        samples.size = samples.chunk->alen;
+        samples.frame_count = samples.chunk->alen / frame_size();
+    }
+    samples.resident = true;
+    samples.last_used = ++source_use_count;
+    samples.content_hash = hash_bytes(samples.data, samples.size);
+    resident_source_bytes += samples_size(samples);
     return true;
 }
 
-Sound play_sound(SoundSource source, int loop_count, int fade_in_ms /* = 0 */) {
-
-    Sound sound(-1);
+// Loads samples from their path on the calling thread
+bool EngineState::load_effect(EffectSamples& samples) {
+    detail::EffectLoad load;
+    prepare_load(samples, load);
+    detail::decode_effect(load);
+    return install_effect(samples, load);
+}
 
-    if (!is_valid(source)) {
-        return sound;
+// Frees loaded samples, keeping everything needed to load them again
+void EngineState::unload_effect(EffectSamples& samples) {
+    resident_source_bytes -= samples_size(samples);
+    if (samples.chunk) {
+        Mix_FreeChunk(samples.chunk);
+        samples.chunk = nullptr;
     }
+    samples.pcm.reset();
+    samples.adpcm = detail::AdpcmBuffer {};
+    samples.bank.reset();
+    samples.data = nullptr;
+    samples.size = 0;
+    samples.resident = false;
+}
 
-    SoundData data;
-    data.source = source;
-
-    SoundSourceData const& source_data = sound_sources[source];
-
-    if (source_is_music(source)) {
-        sound = play_music(source, loop_count, fade_in_ms);
-        data.channel = -1;
-    } else {
-        // play_effect returns a pair with the sound and the channel it is
-        // played on
-        auto effect_data = play_effect(source, loop_count, fade_in_ms);
-        sound = effect_data.first;
-        data.channel = effect_data.second;
-        data.position = source_data.default_params.position;
+// Returns already loaded samples with the same contents as the freshly loaded
+// samples, or the samples themselves if there are none
+std::shared_ptr<EffectSamples> EngineState::intern_samples(std::shared_ptr<EffectSamples> samples) {
+    auto [first, last] = effect_samples_by_hash.equal_range(samples->content_hash);
+    for (auto it = first; it != last;) {
+        std::shared_ptr<EffectSamples> existing = it->second.lock();
+        if (!existing) {
+            it = effect_samples_by_hash.erase(it);
+            continue;
+        }
+        if (existing == samples) {
+            // Loaded again after it was evicted
+            return samples;
+        }
+        if (existing->resident && existing->compression == samples->compression &&
+            existing->size == samples->size &&
+            std::memcmp(existing->data, samples->data, samples->size) == 0) {
+            return existing;
+        }
+        ++it;
     }
-    // Add the sound to the active sounds list and to the channel map
-    active_sounds.try_emplace(sound, data);
-    channel_map[data.channel] = sound;
-
-    return sound;
+    effect_samples_by_hash.emplace(samples->content_hash, samples);
+    return samples;
 }
 
-Sound play_sound(SoundSource source, loop_forever_t, int fade_in_ms /* = 0 */) {
-    // Play the sound with the loop_forever parameter, which is -1
-    return play_sound(source, -1, fade_in_ms);
+// Interns samples that were loaded after their sources were created, and
+// moves those sources over to the samples that are kept
+void EngineState::intern_source_samples(std::shared_ptr<EffectSamples> const& samples) {
+    std::shared_ptr<EffectSamples> const kept = intern_samples(samples);
+    if (kept == samples) {
+        return;
+    }
+    effect_samples_by_path[samples_key(samples->path, samples->compression)] = kept;
+    // Keep the samples alive until no source uses them anymore
+    std::shared_ptr<EffectSamples> const replaced = samples;
+    for (auto& [source, data] : sound_sources) {
+        if (data.samples == replaced) {
+            data.samples = kept;
+        }
+    }
 }
 
-bool is_valid(Sound sound) { return active_sounds.find(sound) != active_sounds.end(); }
-
-bool is_valid(SoundSource source) { return sound_sources.find(source) != sound_sources.end(); }
-
-std::optional<float> get_volume(Sound sound) {
-    if (!is_valid(sound)) {
-        return std::nullopt;
+// Evicts the least recently used samples that aren't playing until the
+// resident samples fit in the memory budget
+void EngineState::enforce_source_budget() {
+    if (source_memory_budget == 0 || resident_source_bytes <= source_memory_budget) {
+        return;
     }
 
-    SoundData const& data = active_sounds.at(sound);
+    std::unordered_set<EffectSamples*> playing;
+    for (SoundSlot const& slot : sound_slots) {
+        if (slot.active) {
+            playing.insert(sound_sources[slot.data.source].samples.get());
+        }
+    }
+    std::unordered_set<EffectSamples*> seen;
+    std::vector<std::pair<std::uint64_t, EffectSamples*>> candidates;
+    for (auto const& [source, data] : sound_sources) {
+        EffectSamples* samples = data.samples.get();
+        if (samples && samples->resident && !samples->bank && playing.count(samples) == 0 &&
+            seen.insert(samples).second) {
+            candidates.emplace_back(samples->last_used, samples);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](auto const& a, auto const& b) { return a.first < b.first; });
 
-    if (source_is_music(data.source)) {
-        return static_cast<float>(Mix_VolumeMusic(-1)) / MIX_MAX_VOLUME;
-    } else {
-        return static_cast<float>(Mix_Volume(data.channel, -1)) / MIX_MAX_VOLUME;
+    for (auto const& [last_used, samples] : candidates) {
+        if (resident_source_bytes <= source_memory_budget) {
+            break;
+        }
+        unload_effect(*samples);
+        ++source_evictions;
     }
 }
 
-std::optional<vec3f> get_position(Sound sound) {
-    if (!is_valid(sound)) {
-        return std::nullopt;
+// Takes the samples of prefetches that finished in the background
+void EngineState::collect_prefetched_samples() {
+    if (prefetching_samples.empty()) {
+        return;
+    }
+    bool installed = false;
+    for (auto it = prefetching_samples.begin(); it != prefetching_samples.end();) {
+        std::shared_ptr<EffectSamples> samples = it->second.lock();
+        // Samples that played in the meantime already took their load
+        if (samples && samples->pending_load) {
+            if (!source_loader->is_done(*samples->pending_load)) {
+                ++it;
+                continue;
+            }
+            bool const loaded = install_effect(*samples, *samples->pending_load);
+            samples->pending_load.reset();
+            if (loaded) {
+                intern_source_samples(samples);
+            }
+            installed = true;
+        }
+        if (samples && samples->resident) {
+            mixer.lock();
+            push_event(EventType::LoadCompleted, Sound(-1), it->first);
+            mixer.unlock();
+        }
+        it = prefetching_samples.erase(it);
+    }
+    if (installed) {
+        enforce_source_budget();
     }
-
-    SoundData const& data = active_sounds.at(sound);
-
-    // No need to check or music first, as positions for music are always (0, 0,
-    // 0), which is the specified return value
-    return data.position;
 }
 
-vec3f get_listener_position() { return listener_pos; }
-
-vec3f get_listener_forward() { return listener_forward; }
-
-bool pause_sound(Sound sound) {
-    // Check if the sound is valid first
-    if (!is_valid(sound)) {
-        return false;
+// Converts count frames of the voice's source starting at index to floats
+void EngineState::convert_frames(Voice& voice, std::int64_t index, std::int64_t count, float* out) {
+    if (!voice.adpcm) {
+        detail::to_float(device.format, voice.pcm + index * frame_size(), out,
+                         count * device.channels);
+        return;
     }
 
-    // Find the sound data
-    SoundData const& data = active_sounds[sound];
+    while (count > 0) {
+        std::int64_t const block = index / detail::adpcm_block_frames;
+        std::int64_t const offset = index % detail::adpcm_block_frames;
+        if (block != voice.cached_block) {
+            detail::adpcm_decode_block(voice.adpcm, device.channels, block,
+                                       voice.decode_cache.data());
+            voice.cached_block = block;
+        }
+        std::int64_t const n = std::min(count, detail::adpcm_block_frames - offset);
+        std::copy_n(voice.decode_cache.data() + offset * device.channels, n * device.channels, out);
+        index += n;
+        count -= n;
+        out += n * device.channels;
+    }
+}
 
-    // Pause the music channel or the sound's channel, depending on what
-    // this sound is
-    if (source_is_music(data.source)) {
-        Mix_PauseMusic();
-    } else {
-        Mix_Pause(data.channel);
+// Converts count frames starting at source frame first to floats, taking
+// looping into account. Frames before the start or after the last loop read as
+// silence
+void EngineState::gather_frames(Voice& voice, std::int64_t first, std::int64_t count, float* out) {
+    while (count > 0) {
+        std::int64_t n;
+        if (first < 0) {
+            n = std::min(count, -first);
+            std::fill_n(out, n * device.channels, 0.0f);
+        } else {
+            std::int64_t const loop = first / voice.frame_count;
+            std::int64_t const index = first % voice.frame_count;
+            n = std::min(count, voice.frame_count - index);
+            if (voice.loops == -1 || loop <= voice.loops) {
+                convert_frames(voice, index, n, out);
+            } else {
+                std::fill_n(out, n * device.channels, 0.0f);
+            }
+        }
+        first += n;
+        count -= n;
+        out += n * device.channels;
     }
+}
 
-    // Mission success
+// Reads count source frames starting at first from the voice's chunk or stream.
+// Returns false if a stream has not decoded them yet
+bool EngineState::read_frames(Voice& voice, std::int64_t first, std::int64_t count, float* out) {
+    if (voice.stream) {
+        return voice.stream->read(first, count, out);
+    }
+    gather_frames(voice, first, count, out);
     return true;
 }
 
-bool resume_sound(Sound sound) {
-    if (!is_valid(sound)) {
-        return false;
+// Outputs silence for a block the stream worker didn't decode in time. We wait
+// for it instead of skipping
+void EngineState::starve_voice(Voice& voice, float* out, int frames) {
+    std::fill_n(out, frames * device.channels, 0.0f);
+    if (!voice.starved) {
+        voice.starved = true;
+        push_event(EventType::StreamStarved, voice.sound, voice.source);
     }
+}
 
-    SoundData const& data = active_sounds[sound];
-
-    if (source_is_music(data.source)) {
-        Mix_ResumeMusic();
+void EngineState::render_voice_block(Voice& voice, float* out, int frames) {
+    double const whole = std::floor(voice.position);
+    if (voice.step == 1.0 && whole == voice.position) {
+        // Playing at the source rate, no need to resample
+        if (!read_frames(voice, static_cast<std::int64_t>(whole), frames, out)) {
+            starve_voice(voice, out, frames);
+            return;
+        }
     } else {
-        Mix_Resume(data.channel);
+        double const last = std::floor(voice.position + voice.step * (frames - 1));
+        std::int64_t const first_frame =
+            static_cast<std::int64_t>(whole) - detail::resample_padding_before;
+        std::int64_t const last_frame = static_cast<std::int64_t>(last) + detail::resample_padding_after;
+        if (!read_frames(voice, first_frame, last_frame - first_frame + 1, voice_scratch_in.data())) {
+            starve_voice(voice, out, frames);
+            return;
+        }
+        detail::resample(voice_scratch_in.data(), device.channels, voice.position - whole,
+                         voice.step, voice.quality, out, frames);
     }
+    voice.starved = false;
 
-    return true;
+    voice.position += voice.step * frames;
+    if (voice.stream) {
+        voice.finished = voice.stream->finished(voice.position);
+        return;
+    }
+    while (voice.position >= voice.frame_count) {
+        if (voice.loops == 0) {
+            voice.finished = true;
+            return;
+        }
+        voice.position -= voice.frame_count;
+        if (voice.loops > 0) {
+            --voice.loops;
+        }
+        push_event(EventType::SoundLooped, voice.sound, voice.source);
+    }
 }
 
-bool stop_sound(Sound sound, int fade_out_ms) {
-    if (!is_valid(sound)) {
-        return false;
+// Effect callback registered on every effect channel
+void EngineState::render_voice(int channel, void* stream, int length) {
+    AUDEO_TRACE_SCOPE("render_voice");
+    Voice& voice = voices[channel];
+    if (voice.active && voice.first_callback < 0) {
+        voice.first_callback = total_callbacks;
     }
+    auto* out = static_cast<Uint8*>(stream);
+    std::size_t const bytes_per_frame = frame_size();
+    int frames = static_cast<int>(length / bytes_per_frame);
+    // Voices encoded into the ambisonic bus output silence, so SDL_Mixer can't
+    // apply the channel volume for us
+    float const volume =
+        voice.ambisonic.enabled ? static_cast<float>(mixer.volume(channel, -1)) / MIX_MAX_VOLUME : 1.0f;
+
+    StageTimer timer(mix_stats);
+    while (frames > 0) {
+        int const n = std::min(frames, voice_block_frames);
+        // The rest of the callback a voice finished in is still mixed
+        if (voice.finished || !voice.active) {
+            std::fill_n(voice_scratch_out.data(), n * device.channels, 0.0f);
+        } else {
+            render_voice_block(voice, voice_scratch_out.data(), n);
+            apply_fade(voice, voice_scratch_out.data(), n);
+        }
+        timer.lap(stage_voices);
+        if (occlusion_enabled) {
+            detail::occlusion_process(voice.occlusion, occlusion_settings, device.frequency,
+                                      device.channels, voice_scratch_out.data(), n);
+            timer.lap(stage_occlusion);
+        }
+        if (voice.ambisonic.enabled) {
+            float const* in = voice_scratch_out.data();
+            for (int i = 0; i < n; ++i) {
+                float sum = 0.0f;
+                for (int c = 0; c < device.channels; ++c) { sum += in[i * device.channels + c]; }
+                voice_scratch_mono[i] = sum * volume / device.channels;
+            }
+            ambisonic_buses[voice.ambisonic.bus]->encode(voice.ambisonic, voice_scratch_mono.data(), n);
+            std::fill_n(voice_scratch_out.data(), n * device.channels, 0.0f);
+            timer.lap(stage_ambisonics);
+        } else if (voice.hrtf.enabled) {
+            // Also run for finished voices, so the filter tail rings out
+            detail::hrtf_process(voice.hrtf, hrtf_set->length(), voice_scratch_out.data(), n,
+                                 hrtf_work);
+            timer.lap(stage_hrtf);
+        } else if (voice.surround.enabled) {
+            float* samples = voice_scratch_out.data();
+            detail::SpeakerGains const& from = voice.surround.previous_gains;
+            detail::SpeakerGains const& to = voice.surround.gains;
+            for (int i = 0; i < n; ++i) {
+                float* frame = samples + i * device.channels;
+                float mono = 0.0f;
+                for (int c = 0; c < device.channels; ++c) { mono += frame[c]; }
+                mono /= device.channels;
+                float const t = static_cast<float>(i + 1) / n;
+                for (int c = 0; c < device.channels; ++c) {
+                    frame[c] = mono * (from[c] + (to[c] - from[c]) * t);
+                }
+            }
+            voice.surround.previous_gains = to;
+            timer.lap(stage_surround);
+        }
+        detail::from_float(device.format, voice_scratch_out.data(), out, n * device.channels);
+        timer.lap(stage_voices);
+        out += n * bytes_per_frame;
+        frames -= n;
+    }
+    if (voice.finished) {
+        finish_voice(channel);
+    }
+}
 
-    SoundData const& data = active_sounds[sound];
-
-    if (source_is_music(data.source)) {
-        Mix_FadeOutMusic(fade_out_ms);
-    } else {
-        Mix_FadeOutChannel(data.channel, fade_out_ms);
+// Ramps a block of a voice towards its fade target. A fade out that ended
+// finishes the voice, and silences the rest of the block
+void EngineState::apply_fade(Voice& voice, float* out, int frames) {
+    if (voice.fade_frames == 0 && voice.fade_gain == 1.0f) {
+        return;
     }
+    for (int i = 0; i < frames; ++i) {
+        if (voice.fade_frames > 0) {
+            voice.fade_gain += (voice.fade_target - voice.fade_gain) / voice.fade_frames;
+            --voice.fade_frames;
+        }
+        for (int c = 0; c < device.channels; ++c) { out[i * device.channels + c] *= voice.fade_gain; }
+    }
+    if (voice.fading_out && voice.fade_frames == 0) {
+        voice.finished = true;
+    }
+}
 
-    return true;
+// Computes the listener relative azimuth and distance gain of a surround voice
+void EngineState::surround_direction(detail::SurroundVoice const& voice,
+                                     float& azimuth,
+                                     float& gain) {
+    ListenerSnapshot const* listener = &surround_listeners[0];
+    for (ListenerSnapshot const& candidate : surround_listeners) {
+        if (magnitude(voice.position - candidate.position) <
+            magnitude(voice.position - listener->position)) {
+            listener = &candidate;
+        }
+    }
+    vec3f direction = voice.position - listener->position;
+    azimuth = static_cast<float>(
+        std::atan2(dot(direction, listener->right), dot(direction, listener->forward)) * 180.0 / pi);
+    float distance = std::min(magnitude(direction), voice.max_distance);
+    gain = voice.max_distance > 0 ? 1.0f - distance / voice.max_distance : 0.0f;
 }
 
-bool set_volume(Sound sound, float volume) {
-    if (!is_valid(sound)) {
-        return false;
+// Posteffect that pans every surround voice that moved during the last
+// callback in one pass. The new gains are used from the next callback on
+void EngineState::update_surround_panning() {
+    AUDEO_TRACE_SCOPE("update_surround_panning");
+    StageTimer timer(mix_stats);
+    std::size_t count = 0;
+    for (std::size_t channel = 0; channel < voices.size(); ++channel) {
+        detail::SurroundVoice& voice = voices[channel].surround;
+        if (!voice.enabled || !(voice.dirty || surround_listener_dirty)) {
+            continue;
+        }
+        surround_direction(voice, surround_azimuths[count], surround_distance_gains[count]);
+        surround_channels[count] = static_cast<int>(channel);
+        voice.dirty = false;
+        ++count;
     }
+    surround_listener_dirty = false;
 
-    if (volume > 1)
-        volume = 1;
-    if (volume < 0)
-        volume = 0;
+    speaker_layout->pan(surround_azimuths.data(), surround_distance_gains.data(),
+                        surround_gains.data(), count);
+    for (std::size_t i = 0; i < count; ++i) {
+        voices[surround_channels[i]].surround.gains = surround_gains[i];
+    }
+    timer.lap(stage_surround);
+}
 
-    SoundData const& data = active_sounds[sound];
+// Posteffect that decodes the ambisonic bus into the final output stream
+void EngineState::decode_ambisonics(void* stream, int length) {
+    AUDEO_TRACE_SCOPE("decode_ambisonics");
+    StageTimer timer(mix_stats);
+    auto* out = static_cast<Uint8*>(stream);
+    std::size_t const bytes_per_frame = frame_size();
+    int const frames = static_cast<int>(length / bytes_per_frame);
+
+    for (int offset = 0; offset < frames; offset += voice_block_frames) {
+        int const n = std::min(frames - offset, voice_block_frames);
+        Uint8* block = out + offset * bytes_per_frame;
+        detail::to_float(device.format, block, voice_scratch_out.data(), n * device.channels);
+        for (auto& bus : ambisonic_buses) { bus->decode(offset, n, voice_scratch_out.data()); }
+        detail::from_float(device.format, voice_scratch_out.data(), block, n * device.channels);
+    }
+    for (auto& bus : ambisonic_buses) { bus->next_callback(); }
+    timer.lap(stage_ambisonics);
+}
 
-    if (source_is_music(data.source)) {
-        Mix_VolumeMusic(static_cast<int>(MIX_MAX_VOLUME * volume));
-    } else {
-        Mix_Volume(data.channel, static_cast<int>(MIX_MAX_VOLUME * volume));
+// Registered with Mix_SetPostMix(), so it runs at the end of every audio
+// callback
+void EngineState::finish_mix_stats(int length) {
+    AUDEO_TRACE_THREAD("audeo audio");
+    auto const now = std::chrono::steady_clock::now();
+    double us = 0.0;
+    if (mix_stats.in_callback) {
+        us = std::chrono::duration<double, std::micro>(now - mix_stats.callback_start).count();
     }
+    double const budget_us = 1e6 * static_cast<double>(length / frame_size()) / device.frequency;
+    mix_stats.in_callback = false;
 
-    return true;
+    if (mix_stats.callbacks == 0 || us < mix_stats.min_us) {
+        mix_stats.min_us = us;
+    }
+    mix_stats.max_us = std::max(mix_stats.max_us, us);
+    mix_stats.total_us += us;
+    mix_stats.total_budget_us += budget_us;
+    std::size_t const index = mix_stats.callbacks % recent_callback_count;
+    mix_stats.recent_us[index] = static_cast<float>(us);
+    mix_stats.recent_budget_us[index] = static_cast<float>(budget_us);
+    bool const late = last_callback_end != std::chrono::steady_clock::time_point {} &&
+                      std::chrono::duration<double, std::micro>(now - last_callback_end).count() >
+                          2.0 * budget_us;
+    // Engines without an audio device mix whenever they are asked to
+    if (!mixer.is_software() && (us > budget_us || late)) {
+        ++mix_stats.underruns;
+        ++total_underruns;
+    }
+    last_callback_end = now;
+    ++mix_stats.callbacks;
+    ++total_callbacks;
+    mixed_frames += length / frame_size();
 }
 
-bool set_position(Sound sound, float x, float y, float z) { return set_position(sound, {x, y, z}); }
+double EngineState::voice_step(float pitch, int source_rate) {
+    double const step = static_cast<double>(pitch) * source_rate / device.frequency;
+    return std::clamp(step, static_cast<double>(detail::min_resample_step),
+                      static_cast<double>(detail::max_resample_step));
+}
 
-bool set_position(Sound sound, vec3f position) {
-    if (!is_valid(sound)) {
-        return false;
+void EngineState::resize_voices(unsigned int count) {
+    // The audio thread reads from this vector, so it may not be resized while
+    // it is mixing
+    mixer.lock();
+    if (voices.size() < count) {
+        std::size_t const first_new = voices.size();
+        voices.resize(count);
+        // Allocated up front, so playing a compressed source doesn't allocate
+        for (std::size_t i = first_new; i < count; ++i) {
+            voices[i].decode_cache.resize(detail::adpcm_block_frames * device.channels);
+        }
+        sound_slots.resize(count + 1);
+        surround_channels.resize(count);
+        surround_azimuths.resize(count);
+        surround_distance_gains.resize(count);
+        surround_gains.resize(count);
+        for (std::size_t i = first_new; i < count; ++i) { start_channel(static_cast<int>(i)); }
+    }
+    mixer.unlock();
+}
+
+// Returns the first channel no sound plays on, or -1 if all of them are used
+int EngineState::free_channel() {
+    // Voices finish on the audio thread
+    mixer.lock();
+    int channel = -1;
+    for (std::size_t i = 0; i < voices.size(); ++i) {
+        if (!voices[i].active) {
+            channel = static_cast<int>(i);
+            break;
+        }
     }
+    mixer.unlock();
+    return channel;
+}
 
-    SoundData& data = active_sounds[sound];
+// Starts the silent chunk on an effect channel, and registers render_voice() on
+// it once. The channel is paused unless a voice plays on it
+void EngineState::start_channel(int channel) {
+    mixer.play_channel(channel, silent_chunk, -1);
+    mixer.register_effect(channel, render_voice_effect, this);
+    if (!voices[channel].active) {
+        mixer.pause(channel);
+    }
+}
 
-    // Music does not support 3D spatial audio
-    if (source_is_music(data.source)) {
+bool EngineState::init(InitInfo const& info) {
+    if (mixer.is_software()) {
+        AUDEO_THROW(audeo::exception("Audeo: The engine is already initialized"));
         return false;
     }
-    // Set the actual position of the effect
-    set_effect_position(data.channel, position, data.max_distance);
-    data.position = position;
+    EngineState* no_owner = nullptr;
+    if (!device_owner.compare_exchange_strong(no_owner, this)) {
+        AUDEO_THROW(audeo::exception("Audeo: Another engine already uses the audio device"));
+        return false;
+    }
+    // Initialize SDL
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        device_owner = nullptr;
+        std::string error = SDL_GetError();
+        AUDEO_THROW(
+            audeo::exception(("Audeo: Unable to initliaze SDL audeo. Reason: " + error).c_str()));
+        // This return can only be reached when exceptions are disabled
+        return false;
+    }
+    // Initialize SDL_Mixer. The adaptive buffer starts small and grows when
+    // needed
+    unsigned int const chunk_size = info.adaptive_chunk_size
+                                        ? std::min(info.min_chunk_size, info.max_chunk_size)
+                                        : info.chunk_size;
+    if (Mix_OpenAudio(info.frequency, to_mix_format(info.format),
+                      static_cast<int>(info.output_channels), chunk_size) == -1) {
+        device_owner = nullptr;
+        // Mix_GetError() is the same as SDL_GetError()
+        std::string error = Mix_GetError();
+        AUDEO_THROW(
+            audeo::exception(("Audeo: Unable to initialize SDL_Mixer. Reason: " + error).c_str()));
+        return false;
+    }
+    // Load dynamic libraries for SDL_Mixer
+    const int flags = MIX_INIT_FLAC | MIX_INIT_MOD | MIX_INIT_OGG | MIX_INIT_MP3;
+    if ((flags & Mix_Init(flags)) != flags) {
+        Mix_CloseAudio();
+        device_owner = nullptr;
+        std::string error = Mix_GetError();
+        AUDEO_THROW(
+            audeo::exception(("Audeo: Could not load all audio types. Reason: " + error).c_str()));
+        return false;
+    }
+    int frequency = 0;
+    int channels = 0;
+    Mix_QuerySpec(&frequency, &device.format, &channels);
+    device.frequency = frequency;
+    device.channels = channels;
+    device.chunk_frames = static_cast<int>(chunk_size);
+    adaptive_buffer = AdaptiveBuffer {};
+    adaptive_buffer.enabled = info.adaptive_chunk_size;
+    adaptive_buffer.min_frames = static_cast<int>(chunk_size);
+    adaptive_buffer.max_frames =
+        static_cast<int>(std::max(info.min_chunk_size, info.max_chunk_size));
+    adaptive_buffer.stable_ms = info.adaptive_stable_ms;
+    adaptive_buffer.stable_since = mixer.ticks();
+    silent_pcm.assign(device.chunk_frames * frame_size(), 0);
+    silent_chunk = Mix_QuickLoad_RAW(silent_pcm.data(), static_cast<Uint32>(silent_pcm.size()));
+    setup(info);
+
+    // Initialize callbacks
+    Mix_HookMusicFinished(music_finished_hook);
+    Mix_SetPostMix(finish_mix_stats_postmix, this);
 
     return true;
 }
 
-bool set_distance_range_max(Sound sound, float distance) {
-    if (!is_valid(sound)) {
+bool EngineState::init_offline(InitInfo const& info) {
+    if (mixer.is_software() || device_owner.load() == this) {
+        AUDEO_THROW(audeo::exception("Audeo: The engine is already initialized"));
         return false;
     }
-
-    SoundData& data = active_sounds[sound];
-
-    // Music does not support 3D spatial audio
-    if (source_is_music(data.source)) {
+    int const channels = static_cast<int>(info.output_channels);
+    if (channels != 1 && channels != 2 && channels != 4 && channels != 6 && channels != 8) {
+        AUDEO_THROW(audeo::exception("Audeo: Unsupported output channel count"));
+        return false;
+    }
+    if (info.frequency == 0 || info.chunk_size == 0) {
+        AUDEO_THROW(audeo::exception("Audeo: Invalid frequency or chunk size"));
         return false;
     }
+    device.frequency = static_cast<int>(info.frequency);
+    device.format = AUDIO_F32SYS;
+    device.channels = channels;
+    device.chunk_frames = static_cast<int>(info.chunk_size);
+    mixer.open_software(device.frequency, device.channels);
+    // There is no device to resize
+    adaptive_buffer = AdaptiveBuffer {};
+    // Mix_QuickLoad_RAW() needs the audio device
+    silent_pcm.assign(device.chunk_frames * frame_size(), 0);
+    silent_chunk_data = Mix_Chunk {};
+    silent_chunk_data.abuf = silent_pcm.data();
+    silent_chunk_data.alen = static_cast<Uint32>(silent_pcm.size());
+    silent_chunk_data.volume = MIX_MAX_VOLUME;
+    silent_chunk = &silent_chunk_data;
+    setup(info);
+
+    mixer.set_post_mix(finish_mix_stats_postmix, this);
+    return true;
+}
 
-    data.max_distance = distance;
-    // Update positional sound data
-    set_effect_position(data.channel, data.position, data.max_distance);
+// The part of init() and init_offline() that doesn't depend on the device
+void EngineState::setup(InitInfo const& info) {
+    last_callback_end = {};
+    total_underruns = 0;
+    total_callbacks = 0;
+    mixed_frames = 0;
+
+    detail::init_resampler_tables();
+    default_resample_quality = info.resample_quality;
+    source_memory_budget = info.source_memory_budget;
+    source_evictions = 0;
+    source_reloads = 0;
+    lazy_source_loading = info.lazy_source_loading;
+    immediate_finish_callbacks = info.immediate_finish_callbacks;
+    // Enough input for a block at the highest playback rate, plus the frames
+    // the sinc filter reads around it
+    voice_scratch_in.resize((voice_block_frames * detail::max_resample_step +
+                             detail::resample_padding_before + detail::resample_padding_after + 2) *
+                            device.channels);
+    voice_scratch_out.resize(voice_block_frames * device.channels);
+    voice_scratch_mono.resize(voice_block_frames);
+
+    emitter_grid = std::make_unique<detail::EmitterGrid>(info.emitter_grid_cell_size);
 
-    return true;
+    // Allocate channels for effects
+    mixer.allocate_channels(info.effect_channels);
+    // Voices of an earlier init may have buffers for another channel count
+    voices.clear();
+    resize_voices(info.effect_channels);
+
+    // SDL_Mixer's positional effect only knows about stereo panning, so we
+    // pan multichannel output ourselves
+    if (device.channels > 2) {
+        speaker_layout = std::make_unique<detail::SpeakerLayout>(device.channels);
+        update_surround_listener();
+        mixer.register_effect(MIX_CHANNEL_POST, surround_panning_effect, this);
+    }
+    reset_stats();
 }
 
-void set_listener_position(vec3f new_position) {
-    listener_pos = new_position;
-    // Now, update all positions for playing sounds
-    for (auto const& [snd, data] : active_sounds) { set_position(snd, data.position); }
+void EngineState::quit() {
+    // The device may belong to another engine
+    bool const software = mixer.is_software();
+    if (!software && device_owner.load() != this) {
+        return;
+    }
+    stop_recording();
+    clear_occlusion_query();
+    emitters.clear();
+    playing_emitters.clear();
+    emitter_grid.reset();
+
+    // Stop all sounds, then free them. Effects finish right away
+    for (SoundSlot const& slot : sound_slots) {
+        if (slot.active) {
+            stop_sound(slot.sound);
+        }
+    }
+    // Deliver the finish events of the sounds we just stopped
+    poll_events();
+    free_unused_sources();
+    // Finishes the load being decoded, and drops the others. Sources that
+    // outlive the engine load their samples again when they play
+    source_loader.reset();
+    prefetching_samples.clear();
+    for (auto& [source, data] : sound_sources) {
+        if (data.samples) {
+            data.samples->pending_load.reset();
+        }
+    }
+    // Closes the files of all streams
+    stream_worker.reset();
+    if (software) {
+        // Nothing of SDL or SDL_Mixer was started
+        silent_chunk = nullptr;
+        mixer.close_software();
+        return;
+    }
+    Mix_FreeChunk(silent_chunk);
+    silent_chunk = nullptr;
+
+    Mix_HookMusicFinished(nullptr);
+    Mix_SetPostMix(nullptr, nullptr);
+
+    // Stop SDL and SDL_Mixer subsystems
+    Mix_CloseAudio();
+    SDL_Quit();
+    Mix_Quit();
+    device_owner = nullptr;
 }
 
-void set_listener_position(float new_x, float new_y, float new_z) {
-    set_listener_position({new_x, new_y, new_z});
+// Mixes the output of an engine without an audio device on the calling thread,
+// in audio callbacks of at most chunk_frames
+void EngineState::render(float* out, std::size_t frame_count) {
+    AUDEO_TRACE_SCOPE("render");
+    if (!mixer.is_software()) {
+        AUDEO_THROW(audeo::exception("Audeo: Only engines without an audio device can render"));
+        return;
+    }
+    while (frame_count > 0) {
+        std::size_t const frames =
+            std::min(frame_count, static_cast<std::size_t>(device.chunk_frames));
+        mixer.mix(reinterpret_cast<Uint8*>(out), static_cast<int>(frames * frame_size()));
+        out += frames * device.channels;
+        frame_count -= frames;
+    }
 }
 
-void set_listener_forward(vec3f new_forward) {
-    listener_forward = new_forward;
-    // Now, update playing sound positions
-    for (auto const& [snd, data] : active_sounds) { set_position(snd, data.position); }
+// Creates an effect source from samples that are already in the format of an
+// engine without an audio device
+SoundSource
+EngineState::load_converted_source(std::string_view path,
+                                   std::shared_ptr<std::vector<std::uint8_t> const> pcm,
+                                   std::shared_ptr<detail::AdpcmBuffer const> adpcm) {
+    auto samples = std::make_shared<EffectSamples>();
+    samples->owner = this;
+    samples->path = path;
+    detail::EffectLoad load;
+    load.loaded = true;
+    if (adpcm) {
+        // Compressed samples are owned by the samples that play them
+        load.compress = true;
+        load.adpcm = *adpcm;
+        samples->compression = SourceCompression::Adpcm;
+    } else {
+        load.pcm = std::move(pcm);
+    }
+    install_effect(*samples, load);
+    samples = intern_samples(std::move(samples));
+    effect_samples_by_path[samples_key(path, samples->compression)] = samples;
+
+    SoundSource source(SourceHandleGenerator::next());
+    sound_sources[source].samples = std::move(samples);
+    return source;
 }
 
-void set_listener_forward(float new_x, float new_y, float new_z) {
-    set_listener_forward({new_x, new_y, new_z});
+// Music always plays on the audio device, which may belong to another engine
+bool EngineState::is_playing_music() { return !mixer.is_software() && Mix_PlayingMusic(); }
+
+unsigned int EngineState::effect_channel_count() { return mixer.allocate_channels(-1); }
+
+void EngineState::allocate_effect_channels(unsigned int count) {
+    if (effect_channel_count() >= count) {
+        return;
+    }
+    mixer.allocate_channels(count);
+    resize_voices(count);
 }
 
-bool reverse_stereo(Sound sound, bool reverse /* = true */) {
-    if (!is_valid(sound)) {
-        return false;
+SoundSource EngineState::load_source(std::string_view path,
+                                     AudioType type,
+                                     SourceCompression compression /* = SourceCompression::None */) {
+    AUDEO_TRACE_SCOPE("load_source");
+    SoundSource source(SourceHandleGenerator::next());
+    SoundSourceData source_data;
+    switch (type) {
+        case AudioType::Music:
+            // SDL_Mixer only decodes music into the audio device's output
+            if (mixer.is_software()) {
+                AUDEO_THROW(audeo::exception("Audeo: Music needs an audio device"));
+                return SoundSource(-1);
+            }
+            source_data.is_music = true;
+            source_data.music = Mix_LoadMUS(path.data());
+            break;
+        case AudioType::Effect: {
+            std::string const key = samples_key(path, compression);
+            if (auto it = effect_samples_by_path.find(key); it != effect_samples_by_path.end()) {
+                source_data.samples = it->second.lock();
+            }
+            if (!source_data.samples) {
+                auto samples = std::make_shared<EffectSamples>();
+                samples->owner = this;
+                samples->path = path;
+                samples->compression = compression;
+                if (lazy_source_loading) {
+                    // Only make sure the file can be opened. It is decoded when
+                    // the source first plays or is prefetched
+                    if (SDL_RWops* file = SDL_RWFromFile(samples->path.c_str(), "rb")) {
+                        SDL_RWclose(file);
+                    } else {
+                        AUDEO_THROW(audeo::exception("Audeo: Failed to load audio chunk"));
+                    }
+                } else if (load_effect(*samples)) {
+                    samples = intern_samples(std::move(samples));
+                } else {
+                    AUDEO_THROW(audeo::exception("Audeo: Failed to load audio chunk"));
+                }
+                effect_samples_by_path[key] = samples;
+                source_data.samples = std::move(samples);
+            }
+            break;
+        }
+        case AudioType::Stream:
+            source_data.is_stream = true;
+            source_data.stream_path = path;
+            if (!detail::read_wav_info(path, source_data.stream_info)) {
+                AUDEO_THROW(audeo::exception(
+                    "Audeo: Failed to open stream. Only uncompressed WAV files can be streamed"));
+                return SoundSource(-1);
+            }
+            break;
     }
 
-    SoundData& data = active_sounds[sound];
+    // Check for errors
+    if (source_data.is_music) {
+        if (!source_data.music) {
+            AUDEO_THROW(audeo::exception("Audeo: Failed to load music file"));
+        }
+    }
 
-    // If the second parameter is zero (false), the effect will unregister.
-    Mix_SetReverseStereo(data.channel, reverse);
+    sound_sources[source] = std::move(source_data);
+    enforce_source_budget();
 
-    return true;
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::LoadSource)) {
+        log->write_int(source.value());
+        log->write_int(static_cast<std::int64_t>(type));
+        log->write_int(static_cast<std::int64_t>(compression));
+        log->write_string(path);
+    }
+    return source;
 }
 
-bool add_effect(Sound sound, Effect eff) {
-    if (!is_valid(sound)) {
+bool EngineState::free_source(SoundSource source) {
+    if (!is_valid(source)) {
+        return false;
+    }
+    if (is_playing(source)) {
         return false;
     }
 
-    SoundData& data = active_sounds[sound];
+    SoundSourceData& data = sound_sources[source];
+    if (data.is_music) {
+        Mix_FreeMusic(data.music);
+    }
+    // Effect samples are freed with the last source that shares them
 
-    // Temporary always register echo
-    Mix_RegisterEffect(data.channel, echo_callback, nullptr, nullptr);
+    // Remove from sound source map
+    sound_sources.erase(source);
 
     return true;
 }
 
-void set_sound_finish_callback(SoundFinishCallbackT callback) {
-    finish_callback = std::move(callback);
+std::size_t EngineState::free_unused_sources() {
+    // Create list of sources that have to be freed
+    std::vector<SoundSource> to_erase;
+    for (auto const& [source, data] : sound_sources) {
+        if (!is_playing(source)) {
+            to_erase.push_back(source);
+        }
+    }
+
+    // Free all sources that have to be freed
+    for (auto src : to_erase) { free_source(src); }
+
+    return to_erase.size();
 }
 
-// Internal functions
+std::unordered_map<std::string, SoundSource> EngineState::load_bank(std::string_view path) {
+    std::unordered_map<std::string, SoundSource> sources;
 
-static Sound play_music(SoundSource source, int loop_count, int fade_in_ms) {
+    auto bank = std::make_shared<detail::BankFile>();
+    if (!bank->open(path)) {
+        AUDEO_THROW(audeo::exception("Audeo: Failed to open sound bank"));
+        return sources;
+    }
+    detail::BankHeader const& header = bank->header();
+    if (header.frequency != static_cast<std::uint32_t>(device.frequency) ||
+        header.format != device.format ||
+        header.channels != static_cast<std::uint32_t>(device.channels)) {
+        AUDEO_THROW(audeo::exception("Audeo: Sound bank was packed for a different output format"));
+        return sources;
+    }
 
-    SoundSourceData const& data = sound_sources[source];
+    for (std::size_t i = 0; i < header.sound_count; ++i) {
+        detail::BankEntry const& entry = bank->entry(i);
+        bool const is_adpcm = entry.encoding == detail::BankEncoding::Adpcm;
+        std::uint64_t const blocks =
+            (entry.frame_count + detail::adpcm_block_frames - 1) / detail::adpcm_block_frames;
+        std::uint64_t const needed = is_adpcm ? blocks * detail::adpcm_block_size(device.channels)
+                                              : entry.frame_count * frame_size();
+        if ((!is_adpcm && entry.encoding != detail::BankEncoding::Pcm) || entry.data_size < needed) {
+            AUDEO_THROW(audeo::exception("Audeo: Sound bank is corrupt"));
+            return sources;
+        }
 
-    Mix_FadeInMusic(data.data.music, loop_count, fade_in_ms);
-    Mix_VolumeMusic(static_cast<int>(MIX_MAX_VOLUME * data.default_params.volume));
+        // The samples are used straight from the mapping
+        auto samples = std::make_shared<EffectSamples>();
+        samples->owner = this;
+        samples->bank = bank;
+        samples->data = bank->data(i);
+        samples->size = static_cast<std::size_t>(entry.data_size);
+        samples->frame_count = static_cast<std::int64_t>(entry.frame_count);
+        samples->is_adpcm = is_adpcm;
+        samples->sample_rate = device.frequency;
+        samples->resident = true;
+
+        SoundSource source(SourceHandleGenerator::next());
+        SoundSourceData source_data;
+        source_data.samples = std::move(samples);
+        sound_sources[source] = std::move(source_data);
+        sources[std::string(bank->name(i))] = source;
+    }
+    begin_record(detail::LoggedCall::LoadBank);
 
-    return Sound(SoundHandleGenerator::next());
+    return sources;
 }
 
-static std::pair<Sound, int> play_effect(SoundSource source, int loop_count, int fade_in_ms) {
-
-    SoundSourceData const& data = sound_sources[source];
-    auto const& default_params = data.default_params;
+bool EngineState::prefetch(SoundSource source) {
+    if (!is_valid(source)) {
+        return false;
+    }
+    collect_prefetched_samples();
+    std::shared_ptr<EffectSamples> const& samples = sound_sources[source].samples;
+    if (!samples) {
+        return false;
+    }
+    if (samples->resident || samples->pending_load) {
+        return true;
+    }
 
-    int channel;
-    if (fade_in_ms == 0) {
-        channel = Mix_PlayChannel(-1, data.data.chunk, loop_count);
-    } else {
-        channel = Mix_FadeInChannel(-1, data.data.chunk, loop_count, fade_in_ms);
+    if (!source_loader) {
+        source_loader = std::make_unique<detail::SourceLoader>();
     }
+    samples->pending_load = std::make_shared<detail::EffectLoad>();
+    prepare_load(*samples, *samples->pending_load);
+    source_loader->add(samples->pending_load);
+    prefetching_samples.emplace_back(source, samples);
+    return true;
+}
 
-    if (channel == -1) {
-        AUDEO_THROW(audeo::exception("No channel available to play sound effect"));
+void EngineState::set_source_memory_budget(std::size_t bytes) {
+    source_memory_budget = bytes;
+    enforce_source_budget();
+}
+
+SourceCacheStats EngineState::get_source_cache_stats() {
+    collect_prefetched_samples();
+    SourceCacheStats stats;
+    stats.budget_bytes = source_memory_budget;
+    stats.resident_bytes = resident_source_bytes;
+    std::unordered_set<EffectSamples const*> seen;
+    for (auto const& [source, data] : sound_sources) {
+        if (!data.samples || !seen.insert(data.samples.get()).second) {
+            continue;
+        }
+        if (data.samples->resident) {
+            ++stats.resident_sources;
+        } else if (data.samples->pending_load) {
+            ++stats.prefetching_sources;
+        } else {
+            ++stats.evicted_sources;
+        }
     }
+    stats.evictions = source_evictions;
+    stats.reloads = source_reloads;
+    return stats;
+}
 
-    // Set volume
-    Mix_Volume(channel, static_cast<int>(MIX_MAX_VOLUME * default_params.volume));
+EngineStats EngineState::get_stats() {
+    EngineStats stats;
+    std::vector<float> recent_us;
+    std::vector<float> recent_budget_us;
+    double total_budget_us = 0.0;
+    std::array<double, stage_count> stage_us;
+
+    mixer.lock();
+    stats.callbacks = mix_stats.callbacks;
+    stats.chunk_size = static_cast<unsigned int>(device.chunk_frames);
+    stats.buffer_latency_ms = get_output_latency();
+    stats.buffer_resizes = adaptive_buffer.resizes;
+    stats.callback_min_us = mix_stats.min_us;
+    stats.callback_max_us = mix_stats.max_us;
+    stats.underruns = mix_stats.underruns;
+    std::size_t const recent = std::min<std::uint64_t>(mix_stats.callbacks, recent_callback_count);
+    recent_us.assign(mix_stats.recent_us.begin(), mix_stats.recent_us.begin() + recent);
+    recent_budget_us.assign(mix_stats.recent_budget_us.begin(),
+                            mix_stats.recent_budget_us.begin() + recent);
+    stats.callback_avg_us = mix_stats.total_us;
+    total_budget_us = mix_stats.total_budget_us;
+    stage_us = mix_stats.stage_us;
+    for (Voice const& voice : voices) {
+        if (voice.active) {
+            ++stats.real_voices;
+        }
+    }
+    mixer.unlock();
+
+    if (stats.callbacks > 0) {
+        stats.budget_utilization = stats.callback_avg_us / total_budget_us;
+        stats.callback_avg_us /= stats.callbacks;
+        double const callbacks = static_cast<double>(stats.callbacks);
+        stats.voices_us = stage_us[stage_voices] / callbacks;
+        stats.occlusion_us = stage_us[stage_occlusion] / callbacks;
+        stats.hrtf_us = stage_us[stage_hrtf] / callbacks;
+        stats.ambisonics_us = stage_us[stage_ambisonics] / callbacks;
+        stats.surround_us = stage_us[stage_surround] / callbacks;
+    }
+    if (!recent_us.empty()) {
+        std::vector<float> utilization(recent_us.size());
+        for (std::size_t i = 0; i < recent_us.size(); ++i) {
+            utilization[i] = recent_budget_us[i] > 0.0f ? recent_us[i] / recent_budget_us[i] : 0.0f;
+        }
+        std::size_t const p99 = recent_us.size() * 99 / 100;
+        std::nth_element(recent_us.begin(), recent_us.begin() + p99, recent_us.end());
+        std::nth_element(utilization.begin(), utilization.begin() + p99, utilization.end());
+        stats.callback_p99_us = recent_us[p99];
+        stats.budget_utilization_p99 = utilization[p99];
+    }
 
-    set_effect_position(channel, default_params.position, default_params.distance_range_max);
+    stats.virtual_voices = emitters.size() - playing_emitters.size();
+    stats.resident_source_bytes = resident_source_bytes;
+    stats.queued_events = events.size();
+    stats.dropped_events = events.dropped_count();
+    stats.queued_loads = prefetching_samples.size();
+    return stats;
+}
 
-    return {Sound(SoundHandleGenerator::next()), channel};
+void EngineState::reset_stats() {
+    mixer.lock();
+    mix_stats = MixStats {};
+    mixer.unlock();
 }
 
-static void set_effect_position(int channel, vec3f position, float max_distance) {
-    vec3f direction = position - listener_pos;
-    vec3f forward = normalize(listener_forward);
-    float raw_angle = angle(forward, direction);
-    // Now get the distance
-    float raw_distance = magnitude(direction);
-    // Make sure the distance is set to max_distance once we are too far away to
-    // hear it to not break the map_range() function
-    if (raw_distance > max_distance)
-        raw_distance = max_distance;
-    // Now we adjust the angle to the left, depending on whether it is to
-    // the left or to the right of the listener. We test this by testing the
-    // sign of the cross product.
-    float d = dot(cross(direction, forward), vec3f{0, 1, 0});
+bool EngineState::is_playing(SoundSource source) {
+    if (!is_valid(source)) {
+        return false;
+    }
 
-    if (d < 0) {
-        raw_angle += 180.0f;
+    for (SoundSlot const& slot : sound_slots) {
+        if (slot.active && slot.data.source == source) {
+            return true;
+        }
     }
+    return false;
+}
 
-    // Maximum distance SDL provides
-    constexpr std::uint8_t sdl_max_distance = 255;
-    // Map our own max distance to SDL's max_distance
+bool EngineState::source_is_music(SoundSource source) {
+    if (!is_valid(source)) {
+        return false;
+    }
 
-    std::uint8_t mapped_distance =
-        static_cast<std::int8_t>(map_range(0, max_distance, 0, sdl_max_distance, raw_distance));
+    SoundSourceData const& data = sound_sources[source];
+    return data.is_music;
+}
 
-    Mix_SetPosition(channel, static_cast<std::int16_t>(raw_angle), mapped_distance);
+bool EngineState::set_default_volume(SoundSource source, float volume) {
+    if (!is_valid(source)) {
+        return false;
+    }
+
+    // Clamp volume parameter
+    if (volume > 1)
+        volume = 1;
+    if (volume < 0)
+        volume = 0;
+
+    SoundSourceData& data = sound_sources[source];
+    data.default_params.volume = volume;
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetDefaultVolume)) {
+        log->write_int(source.value());
+        log->write_float(volume);
+    }
+
+    return true;
+}
+
+bool EngineState::set_default_position(SoundSource source, float x, float y, float z) {
+    return set_default_position(source, {x, y, z});
+}
+
+bool EngineState::set_default_position(SoundSource source, vec3f position) {
+    if (!is_valid(source)) {
+        return false;
+    }
+
+    SoundSourceData& data = sound_sources[source];
+    data.default_params.position = position;
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetDefaultPosition)) {
+        log->write_int(source.value());
+        log->write_vector(position);
+    }
+
+    return true;
+}
+
+bool EngineState::set_default_distance_range_max(SoundSource source, float distance) {
+    if (!is_valid(source)) {
+        return false;
+    }
+
+    SoundSourceData& data = sound_sources[source];
+    data.default_params.distance_range_max = distance;
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetDefaultDistanceRangeMax)) {
+        log->write_int(source.value());
+        log->write_float(distance);
+    }
+
+    return true;
+}
+
+bool EngineState::set_default_max_instances(SoundSource source,
+                                            unsigned int count,
+                                            InstanceLimitBehavior behavior) {
+    if (!is_valid(source)) {
+        return false;
+    }
+
+    SoundSourceData& data = sound_sources[source];
+    data.default_params.max_instances = count;
+    data.default_params.limit_behavior = behavior;
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetDefaultMaxInstances)) {
+        log->write_int(source.value());
+        log->write_int(count);
+        log->write_int(static_cast<std::int64_t>(behavior));
+    }
+
+    return true;
+}
+
+bool EngineState::set_default_min_retrigger_interval(SoundSource source, int interval_ms) {
+    if (!is_valid(source)) {
+        return false;
+    }
+
+    SoundSourceData& data = sound_sources[source];
+    data.default_params.min_retrigger_ms = static_cast<Uint32>(std::max(interval_ms, 0));
+    detail::LoggedCall const call = detail::LoggedCall::SetDefaultMinRetriggerInterval;
+    if (detail::CommandLog* log = begin_record(call)) {
+        log->write_int(source.value());
+        log->write_int(data.default_params.min_retrigger_ms);
+    }
+
+    return true;
+}
+
+Sound EngineState::play_sound(SoundSource source, int loop_count, int fade_in_ms /* = 0 */) {
+    return play_sound(source, loop_count, fade_in_ms, std::nullopt, std::nullopt);
+}
+
+// Plays a source with the volume and position that are given instead of its
+// defaults, so the sound starts out with them
+Sound EngineState::play_sound(SoundSource source,
+                              int loop_count,
+                              int fade_in_ms,
+                              std::optional<float> volume,
+                              std::optional<vec3f> position) {
+    if (!is_valid(source)) {
+        return Sound(-1);
+    }
+
+    auto const& default_params = sound_sources[source].default_params;
+    volume = std::clamp(volume.value_or(default_params.volume), 0.0f, 1.0f);
+    Sound const sound = play_sound_at(source, loop_count, fade_in_ms,
+                                      position.value_or(default_params.position),
+                                      default_params.distance_range_max, 0.0, *volume);
+    if (sound.value() == -1) {
+        return sound;
+    }
+    if (command_log) {
+        mixer.lock();
+        std::int64_t const frame = mixed_frames;
+        mixer.unlock();
+        detail::CommandLog* log = begin_record(detail::LoggedCall::PlaySound, frame);
+        log->write_int(sound.value());
+        log->write_int(source.value());
+        log->write_int(loop_count);
+        log->write_int(fade_in_ms);
+        // Recorded at the same frame, so they are replayed before the sound is
+        // mixed
+        if (*volume != default_params.volume) {
+            begin_record(detail::LoggedCall::SetVolume, frame);
+            log->write_int(sound.value());
+            log->write_float(*volume);
+        }
+        if (position && !source_is_music(source)) {
+            begin_record(detail::LoggedCall::SetPosition, frame);
+            log->write_int(sound.value());
+            log->write_vector(*position);
+        }
+    }
+    return sound;
+}
+
+Sound EngineState::play_sound(SoundSource source, loop_forever_t, int fade_in_ms /* = 0 */) {
+    // Play the sound with the loop_forever parameter, which is -1
+    return play_sound(source, -1, fade_in_ms);
+}
+
+bool EngineState::is_valid(Sound sound) { return find_sound(sound) != nullptr; }
+
+bool EngineState::is_valid(SoundSource source) {
+    return sound_sources.find(source) != sound_sources.end();
+}
+
+std::optional<float> EngineState::get_volume(Sound sound) {
+    if (!is_valid(sound)) {
+        return std::nullopt;
+    }
+
+    SoundData const& data = find_sound(sound)->data;
+
+    if (source_is_music(data.source)) {
+        return static_cast<float>(Mix_VolumeMusic(-1)) / MIX_MAX_VOLUME;
+    } else {
+        return static_cast<float>(mixer.volume(data.channel, -1)) / MIX_MAX_VOLUME;
+    }
+}
+
+std::optional<vec3f> EngineState::get_position(Sound sound) {
+    if (!is_valid(sound)) {
+        return std::nullopt;
+    }
+
+    SoundData const& data = find_sound(sound)->data;
+
+    // No need to check or music first, as positions for music are always (0, 0,
+    // 0), which is the specified return value
+    return data.position;
+}
+
+std::optional<float> EngineState::get_pitch(Sound sound) {
+    if (!is_valid(sound)) {
+        return std::nullopt;
+    }
+
+    SoundData const& data = find_sound(sound)->data;
+
+    if (source_is_music(data.source)) {
+        return std::nullopt;
+    }
+    return data.pitch;
+}
+
+double EngineState::get_output_latency() { return 1000.0 * device.chunk_frames / device.frequency; }
+
+std::optional<double> EngineState::get_time_until_audible(Sound sound) {
+    double const latency_ms = get_output_latency();
+    // The sound may finish on the audio thread, which frees its slot
+    mixer.lock();
+    if (!is_valid(sound)) {
+        mixer.unlock();
+        return std::nullopt;
+    }
+    SoundData const& data = find_sound(sound)->data;
+    std::int64_t const callbacks = total_callbacks;
+    auto const callback_end = last_callback_end;
+    // Sounds that weren't rendered yet are mixed by the next callback
+    std::int64_t mix_callback = callbacks;
+    if (source_is_music(data.source)) {
+        mix_callback = music_start_callback;
+    } else if (voices[data.channel].first_callback >= 0) {
+        mix_callback = voices[data.channel].first_callback;
+    }
+    mixer.unlock();
+
+    // A buffer starts playing about one buffer after the callback that mixed
+    // it, once the device played the previous one. After that, it's audible
+    if (mix_callback < callbacks - 1) {
+        return 0.0;
+    }
+    double since_callback_ms = latency_ms;
+    if (callback_end != std::chrono::steady_clock::time_point {}) {
+        since_callback_ms = std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - callback_end)
+                                .count();
+    }
+    double remaining_ms = latency_ms - since_callback_ms;
+    if (mix_callback >= callbacks) {
+        // Wait for the next callback as well
+        remaining_ms += latency_ms;
+    }
+    return std::max(remaining_ms, 0.0);
+}
+
+vec3f EngineState::get_listener_position() { return listeners[0].position; }
+
+vec3f EngineState::get_listener_forward() { return listeners[0].forward; }
+
+vec3f EngineState::get_listener_position(std::size_t listener) {
+    if (listener >= listeners.size()) {
+        AUDEO_THROW(audeo::exception("Audeo: Invalid listener index"));
+        return {};
+    }
+    return listeners[listener].position;
+}
+
+vec3f EngineState::get_listener_forward(std::size_t listener) {
+    if (listener >= listeners.size()) {
+        AUDEO_THROW(audeo::exception("Audeo: Invalid listener index"));
+        return {};
+    }
+    return listeners[listener].forward;
+}
+
+std::size_t EngineState::get_listener_count() { return listeners.size(); }
+
+bool EngineState::pause_sound(Sound sound) {
+    // Check if the sound is valid first
+    if (!is_valid(sound)) {
+        return false;
+    }
+
+    // Find the sound data
+    SoundData const& data = find_sound(sound)->data;
+
+    // Pause the music channel or the sound's channel, depending on what
+    // this sound is
+    if (source_is_music(data.source)) {
+        Mix_PauseMusic();
+    } else {
+        mixer.pause(data.channel);
+    }
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::PauseSound)) {
+        log->write_int(sound.value());
+    }
+
+    // Mission success
+    return true;
+}
+
+bool EngineState::resume_sound(Sound sound) {
+    if (!is_valid(sound)) {
+        return false;
+    }
+
+    SoundData const& data = find_sound(sound)->data;
+
+    if (source_is_music(data.source)) {
+        Mix_ResumeMusic();
+    } else {
+        mixer.resume(data.channel);
+    }
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::ResumeSound)) {
+        log->write_int(sound.value());
+    }
+
+    return true;
+}
+
+bool EngineState::stop_sound(Sound sound, int fade_out_ms) {
+    if (!is_valid(sound)) {
+        return false;
+    }
+
+    SoundData const& data = find_sound(sound)->data;
+
+    if (source_is_music(data.source)) {
+        Mix_FadeOutMusic(fade_out_ms);
+    } else {
+        int const channel = data.channel;
+        // The sound may finish on the audio thread
+        mixer.lock();
+        Voice& voice = voices[channel];
+        if (voice.active && voice.sound == sound) {
+            // Paused sounds are silent already
+            if (fade_out_ms > 0 && !mixer.paused(channel)) {
+                voice.fade_target = 0.0f;
+                voice.fade_frames =
+                    std::max<std::int64_t>(1, std::int64_t {fade_out_ms} * device.frequency / 1000);
+                voice.fading_out = true;
+            } else {
+                finish_voice(channel);
+            }
+        }
+        mixer.unlock();
+    }
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::StopSound)) {
+        log->write_int(sound.value());
+        log->write_int(fade_out_ms);
+    }
+
+    return true;
+}
+
+bool EngineState::set_volume(Sound sound, float volume) {
+    if (!is_valid(sound)) {
+        return false;
+    }
+
+    if (volume > 1)
+        volume = 1;
+    if (volume < 0)
+        volume = 0;
+
+    SoundData const& data = find_sound(sound)->data;
+
+    if (source_is_music(data.source)) {
+        Mix_VolumeMusic(static_cast<int>(MIX_MAX_VOLUME * volume));
+    } else {
+        mixer.volume(data.channel, static_cast<int>(MIX_MAX_VOLUME * volume));
+    }
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetVolume)) {
+        log->write_int(sound.value());
+        log->write_float(volume);
+    }
+
+    return true;
+}
+
+bool EngineState::set_position(Sound sound, float x, float y, float z) {
+    return set_position(sound, {x, y, z});
+}
+
+bool EngineState::set_position(Sound sound, vec3f position) {
+    if (!is_valid(sound)) {
+        return false;
+    }
+
+    SoundData& data = find_sound(sound)->data;
+
+    // Music does not support 3D spatial audio
+    if (source_is_music(data.source)) {
+        return false;
+    }
+    // Set the actual position of the effect
+    set_effect_position(data.channel, position, data.max_distance);
+    data.position = position;
+    if (occlusion_worker) {
+        occlusion_worker->move(sound, position);
+    }
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetPosition)) {
+        log->write_int(sound.value());
+        log->write_vector(position);
+    }
+
+    return true;
+}
+
+bool EngineState::set_distance_range_max(Sound sound, float distance) {
+    if (!is_valid(sound)) {
+        return false;
+    }
+
+    SoundData& data = find_sound(sound)->data;
+
+    // Music does not support 3D spatial audio
+    if (source_is_music(data.source)) {
+        return false;
+    }
+
+    data.max_distance = distance;
+    // Update positional sound data
+    set_effect_position(data.channel, data.position, data.max_distance);
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetDistanceRangeMax)) {
+        log->write_int(sound.value());
+        log->write_float(distance);
+    }
+
+    return true;
+}
+
+bool EngineState::set_pitch(Sound sound, float pitch) {
+    if (!is_valid(sound)) {
+        return false;
+    }
+
+    SoundData& data = find_sound(sound)->data;
+
+    // Music is decoded and mixed by SDL_Mixer, so we can't resample it
+    if (source_is_music(data.source)) {
+        return false;
+    }
+
+    pitch = std::clamp(pitch, detail::min_resample_step, detail::max_resample_step);
+    data.pitch = pitch;
+
+    mixer.lock();
+    Voice& voice = voices[data.channel];
+    voice.step = voice_step(pitch, voice.source_rate);
+    mixer.unlock();
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetPitch)) {
+        log->write_int(sound.value());
+        log->write_float(pitch);
+    }
+
+    return true;
+}
+
+bool EngineState::set_resample_quality(Sound sound, ResampleQuality quality) {
+    if (!is_valid(sound)) {
+        return false;
+    }
+
+    SoundData const& data = find_sound(sound)->data;
+
+    if (source_is_music(data.source)) {
+        return false;
+    }
+
+    mixer.lock();
+    voices[data.channel].quality = quality;
+    mixer.unlock();
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetResampleQuality)) {
+        log->write_int(sound.value());
+        log->write_int(static_cast<std::int64_t>(quality));
+    }
+
+    return true;
+}
+
+void EngineState::submit(CommandBuffer& buffer) {
+    AUDEO_TRACE_SCOPE("submit");
+    using CommandType = CommandBuffer::CommandType;
+    buffer.played.clear();
+    // Plays may load their source, so they run before the audio device is
+    // locked
+    for (CommandBuffer::Command const& command : buffer.commands) {
+        if (command.type == CommandType::Play) {
+            buffer.played.push_back(play_sound(command.source, command.loop_count,
+                                               command.fade_ms, command.volume, command.position));
+        } else if (command.type == CommandType::Stop) {
+            // Plays always come before the commands that refer to them
+            Sound const sound = command.play ? buffer.played[*command.play] : command.sound;
+            stop_sound(sound, command.fade_ms);
+        }
+    }
+
+    mixer.lock();
+    batched_positions.clear();
+    batched_records.clear();
+    for (CommandBuffer::Command const& command : buffer.commands) {
+        // Plays already applied their own volume and position
+        if (command.type != CommandType::SetVolume && command.type != CommandType::SetPosition) {
+            continue;
+        }
+        SoundSlot const* slot = find_sound(command.sound);
+        if (!slot) {
+            continue;
+        }
+        int const channel = slot->data.channel;
+        if (command.type == CommandType::SetPosition) {
+            // Music does not support 3D spatial audio
+            if (channel != -1) {
+                batched_positions.emplace_back(channel, *command.position);
+            }
+            continue;
+        }
+        float const volume = std::clamp(*command.volume, 0.0f, 1.0f);
+        if (channel == -1) {
+            Mix_VolumeMusic(static_cast<int>(MIX_MAX_VOLUME * volume));
+        } else {
+            mixer.volume(channel, static_cast<int>(MIX_MAX_VOLUME * volume));
+        }
+        if (command_log) {
+            BatchedRecord& record = batched_records.emplace_back();
+            record.call = detail::LoggedCall::SetVolume;
+            record.sound = command.sound;
+            record.volume = volume;
+        }
+    }
+
+    // Move every sound once, in channel order
+    std::stable_sort(batched_positions.begin(), batched_positions.end(),
+                     [](auto const& a, auto const& b) { return a.first < b.first; });
+    for (std::size_t i = 0; i < batched_positions.size(); ++i) {
+        auto const [channel, position] = batched_positions[i];
+        if (i + 1 < batched_positions.size() && batched_positions[i + 1].first == channel) {
+            // A later command moves this sound again
+            continue;
+        }
+        SoundSlot& slot = sound_slots[channel + 1];
+        set_effect_position(channel, position, slot.data.max_distance);
+        slot.data.position = position;
+        if (occlusion_worker) {
+            occlusion_worker->move(slot.sound, position);
+        }
+        if (command_log) {
+            BatchedRecord& record = batched_records.emplace_back();
+            record.call = detail::LoggedCall::SetPosition;
+            record.sound = slot.sound;
+            record.position = position;
+        }
+    }
+    std::int64_t const frame = mixed_frames;
+    mixer.unlock();
+
+    // Writing the log may block on the disk, so it waits for the audio device
+    // to be unlocked
+    for (BatchedRecord const& record : batched_records) {
+        detail::CommandLog* log = begin_record(record.call, frame);
+        log->write_int(record.sound.value());
+        if (record.call == detail::LoggedCall::SetVolume) {
+            log->write_float(record.volume);
+        } else {
+            log->write_vector(record.position);
+        }
+    }
+
+    buffer.clear();
+}
+
+void EngineState::set_listener_position(vec3f new_position) {
+    set_listener_position(0, new_position);
+}
+
+void EngineState::set_listener_position(float new_x, float new_y, float new_z) {
+    set_listener_position({new_x, new_y, new_z});
+}
+
+void EngineState::set_listener_position(std::size_t listener, vec3f new_position) {
+    if (listener >= listeners.size()) {
+        AUDEO_THROW(audeo::exception("Audeo: Invalid listener index"));
+        return;
+    }
+
+    listeners[listener].position = new_position;
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetListenerPosition)) {
+        log->write_int(static_cast<std::int64_t>(listener));
+        log->write_vector(new_position);
+    }
+    if (occlusion_worker) {
+        occlusion_worker->set_listeners(listener_positions());
+    }
+    if (speaker_layout) {
+        update_surround_listener();
+        return;
+    }
+    // Now, update all positions for playing sounds. Slot 0 is the music,
+    // which isn't positioned
+    for (std::size_t i = 1; i < sound_slots.size(); ++i) {
+        SoundSlot const& slot = sound_slots[i];
+        if (slot.active) {
+            set_effect_position(slot.data.channel, slot.data.position, slot.data.max_distance);
+        }
+    }
+}
+
+void EngineState::set_listener_forward(vec3f new_forward) { set_listener_forward(0, new_forward); }
+
+void EngineState::set_listener_forward(float new_x, float new_y, float new_z) {
+    set_listener_forward({new_x, new_y, new_z});
+}
+
+void EngineState::set_listener_forward(std::size_t listener, vec3f new_forward) {
+    if (listener >= listeners.size()) {
+        AUDEO_THROW(audeo::exception("Audeo: Invalid listener index"));
+        return;
+    }
+
+    listeners[listener].forward = new_forward;
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetListenerForward)) {
+        log->write_int(static_cast<std::int64_t>(listener));
+        log->write_vector(new_forward);
+    }
+    if (!ambisonic_buses.empty()) {
+        // Directions in the ambisonic bus are stored in world space, so we
+        // only have to rotate the bus itself
+        mixer.lock();
+        orient_ambisonic_bus(listener);
+        mixer.unlock();
+        return;
+    }
+    if (speaker_layout) {
+        update_surround_listener();
+        return;
+    }
+    // Now, update playing sound positions
+    for (std::size_t i = 1; i < sound_slots.size(); ++i) {
+        SoundSlot const& slot = sound_slots[i];
+        if (slot.active) {
+            set_effect_position(slot.data.channel, slot.data.position, slot.data.max_distance);
+        }
+    }
+}
+
+void EngineState::set_listener_count(std::size_t count) {
+    if (count == 0) {
+        AUDEO_THROW(audeo::exception("Audeo: There must be at least one listener"));
+        return;
+    }
+
+    listeners.resize(count);
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetListenerCount)) {
+        log->write_int(static_cast<std::int64_t>(count));
+    }
+    if (!ambisonic_buses.empty()) {
+        // New buses have to be in step with the existing ones, since voices
+        // keep their write offset when they move to another bus
+        AmbisonicOrder const order = ambisonic_buses[0]->order();
+        mixer.lock();
+        for (Voice& voice : voices) {
+            if (voice.ambisonic.bus >= count) {
+                voice.ambisonic.bus = 0;
+                voice.ambisonic.previous_coefficients = voice.ambisonic.coefficients;
+            }
+        }
+        unsigned int const generation = ambisonic_buses[0]->current_generation();
+        ambisonic_buses.resize(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!ambisonic_buses[i]) {
+                ambisonic_buses[i] =
+                    std::make_unique<detail::AmbisonicBus>(order, device.chunk_frames, generation);
+                ambisonic_buses[i]->set_hrtf(hrtf_set.get());
+                orient_ambisonic_bus(i);
+            }
+        }
+        mixer.unlock();
+    }
+    if (occlusion_worker) {
+        occlusion_worker->set_listeners(listener_positions());
+    }
+    if (speaker_layout) {
+        update_surround_listener();
+        return;
+    }
+    // Sounds may now be nearest to another listener. Slot 0 is the music,
+    // which isn't positioned
+    for (std::size_t i = 1; i < sound_slots.size(); ++i) {
+        SoundSlot const& slot = sound_slots[i];
+        if (slot.active) {
+            set_effect_position(slot.data.channel, slot.data.position, slot.data.max_distance);
+        }
+    }
+}
+
+bool EngineState::reverse_stereo(Sound sound, bool reverse /* = true */) {
+    if (!is_valid(sound)) {
+        return false;
+    }
+
+    SoundData& data = find_sound(sound)->data;
+
+    // If the second parameter is zero (false), the effect will unregister.
+    mixer.set_reverse_stereo(data.channel, reverse);
+    if (data.channel >= 0) {
+        voices[data.channel].extra_effects = true;
+    }
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::ReverseStereo)) {
+        log->write_int(sound.value());
+        log->write_int(reverse ? 1 : 0);
+    }
+
+    return true;
+}
+
+bool EngineState::add_effect(Sound sound, Effect effect) {
+    if (!is_valid(sound)) {
+        return false;
+    }
+    if (effect == Effect::None) {
+        return true;
+    }
+
+    SoundData& data = find_sound(sound)->data;
+
+    mixer.register_effect(data.channel, echo_callback, nullptr);
+    if (data.channel >= 0) {
+        voices[data.channel].extra_effects = true;
+    }
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::AddEffect)) {
+        log->write_int(sound.value());
+        log->write_int(static_cast<std::int64_t>(effect));
+    }
+
+    return true;
+}
+
+Emitter EngineState::create_emitter(SoundSource source, vec3f position) {
+    if (!is_valid(source) || source_is_music(source)) {
+        return Emitter(-1);
+    }
+
+    Emitter emitter(EmitterHandleGenerator::next());
+    EmitterData data;
+    data.source = source;
+    data.position = position;
+    data.max_distance = sound_sources[source].default_params.distance_range_max;
+    data.start_ticks = mixer.ticks();
+
+    emitter_query_radius = std::max(emitter_query_radius, data.max_distance);
+    emitter_grid->insert(emitter, position);
+    emitters[emitter] = data;
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::CreateEmitter)) {
+        log->write_int(emitter.value());
+        log->write_int(source.value());
+        log->write_vector(position);
+    }
+
+    return emitter;
+}
+
+bool EngineState::destroy_emitter(Emitter emitter) {
+    auto it = emitters.find(emitter);
+    if (it == emitters.end()) {
+        return false;
+    }
+
+    // Recorded first, so the replay destroys the emitter before the stop of
+    // its sound is applied, which then does nothing
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::DestroyEmitter)) {
+        log->write_int(emitter.value());
+    }
+    EmitterData const& data = it->second;
+    stop_sound(data.sound);
+    emitter_grid->remove(emitter, data.position);
+    playing_emitters.erase(std::remove(playing_emitters.begin(), playing_emitters.end(), emitter),
+                           playing_emitters.end());
+
+    bool const was_largest = data.max_distance >= emitter_query_radius;
+    emitters.erase(it);
+    if (was_largest) {
+        emitter_query_radius = 0.0f;
+        for (auto const& [e, d] : emitters) {
+            emitter_query_radius = std::max(emitter_query_radius, d.max_distance);
+        }
+    }
+
+    return true;
+}
+
+bool EngineState::is_valid(Emitter emitter) { return emitters.find(emitter) != emitters.end(); }
+
+bool EngineState::set_emitter_position(Emitter emitter, vec3f position) {
+    auto it = emitters.find(emitter);
+    if (it == emitters.end()) {
+        return false;
+    }
+
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::SetEmitterPosition)) {
+        log->write_int(emitter.value());
+        log->write_vector(position);
+    }
+    EmitterData& data = it->second;
+    emitter_grid->move(emitter, data.position, position);
+    data.position = position;
+    // Does nothing if the emitter is virtual
+    set_position(data.sound, position);
+
+    return true;
+}
+
+std::optional<Sound> EngineState::get_emitter_sound(Emitter emitter) {
+    auto it = emitters.find(emitter);
+    if (it == emitters.end() || !is_valid(it->second.sound)) {
+        return std::nullopt;
+    }
+    return it->second.sound;
+}
+
+void EngineState::update_emitters() {
+    // Recorded first, like destroy_emitter(), for the sounds it stops
+    begin_record(detail::LoggedCall::UpdateEmitters);
+    ++emitter_update_count;
+    collect_prefetched_samples();
+    emitter_candidates.clear();
+    emitters_in_range.clear();
+    for (Listener const& listener : listeners) {
+        emitter_grid->query(listener.position, emitter_query_radius, emitter_candidates);
+    }
+    for (Emitter emitter : emitter_candidates) {
+        EmitterData& data = emitters[emitter];
+        // Listeners close together find the same emitters more than once
+        if (data.audible_update == emitter_update_count) {
+            continue;
+        }
+        float distance = magnitude(data.position - listeners[nearest_listener(data.position)].position);
+        if (distance <= data.max_distance) {
+            data.audible_update = emitter_update_count;
+            emitters_in_range.emplace_back(distance, emitter);
+        }
+    }
+
+    // Virtualize the emitters that went out of range
+    for (Emitter emitter : playing_emitters) {
+        EmitterData& data = emitters[emitter];
+        if (data.audible_update != emitter_update_count) {
+            stop_sound(data.sound);
+            data.sound = Sound(-1);
+        }
+    }
+
+    // Start the closest emitters first, in case we run out of channels
+    std::sort(emitters_in_range.begin(), emitters_in_range.end(),
+              [](auto const& a, auto const& b) { return a.first < b.first; });
+    playing_emitters.clear();
+    for (auto const& [distance, emitter] : emitters_in_range) {
+        EmitterData& data = emitters[emitter];
+        if (is_valid(data.sound)) {
+            playing_emitters.push_back(emitter);
+            continue;
+        }
+        if (!is_valid(data.source) || free_channel() == -1) {
+            continue;
+        }
+
+        // Start at the emitter's current offset, as if it never stopped
+        double const elapsed = (mixer.ticks() - data.start_ticks) / 1000.0;
+        data.sound = play_sound_at(data.source, -1, 0, data.position, data.max_distance, elapsed,
+                                   sound_sources[data.source].default_params.volume);
+        if (is_valid(data.sound)) {
+            playing_emitters.push_back(emitter);
+            if (detail::CommandLog* log = begin_record(detail::LoggedCall::EmitterSound)) {
+                log->write_int(emitter.value());
+                log->write_int(data.sound.value());
+            }
+        }
+    }
+}
+
+bool EngineState::load_hrtf(std::string_view directory) {
+    if (device.channels != 2) {
+        AUDEO_THROW(audeo::exception("Audeo: HRTF spatialization requires stereo output"));
+        return false;
+    }
+
+    auto new_set = std::make_unique<detail::HrtfSet>();
+    if (!new_set->load(directory, device.frequency)) {
+        return false;
+    }
+
+    // Voices may still point into the old set's filters, so disable them while
+    // the audio thread is locked
+    mixer.lock();
+    for (Voice& voice : voices) { voice.hrtf = detail::HrtfVoice {}; }
+    hrtf_set = std::move(new_set);
+    for (auto& bus : ambisonic_buses) { bus->set_hrtf(hrtf_set.get()); }
+    mixer.unlock();
+    hrtf_directory = directory;
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::LoadHrtf)) {
+        log->write_string(directory);
+    }
+
+    reset_effect_positions();
+    return true;
+}
+
+void EngineState::unload_hrtf() {
+    mixer.lock();
+    for (Voice& voice : voices) { voice.hrtf = detail::HrtfVoice {}; }
+    for (auto& bus : ambisonic_buses) { bus->set_hrtf(nullptr); }
+    hrtf_set.reset();
+    mixer.unlock();
+    hrtf_directory.clear();
+    begin_record(detail::LoggedCall::UnloadHrtf);
+
+    reset_effect_positions();
+}
+
+bool EngineState::is_hrtf_enabled() { return hrtf_set != nullptr; }
+
+bool EngineState::enable_ambisonics(AmbisonicOrder order) {
+    if (device.channels != 2) {
+        AUDEO_THROW(audeo::exception("Audeo: Ambisonic spatialization requires stereo output"));
+        return false;
+    }
+
+    // One bus per listener, each rotated to its own listener
+    std::vector<std::unique_ptr<detail::AmbisonicBus>> buses;
+    for (std::size_t i = 0; i < listeners.size(); ++i) {
+        buses.push_back(std::make_unique<detail::AmbisonicBus>(order, device.chunk_frames));
+        buses.back()->set_hrtf(hrtf_set.get());
+    }
+
+    mixer.lock();
+    bool const registered = !ambisonic_buses.empty();
+    for (Voice& voice : voices) { voice.ambisonic = detail::AmbisonicVoice {}; }
+    ambisonic_buses = std::move(buses);
+    for (std::size_t i = 0; i < ambisonic_buses.size(); ++i) { orient_ambisonic_bus(i); }
+    mixer.unlock();
+
+    if (!registered) {
+        mixer.register_effect(MIX_CHANNEL_POST, decode_ambisonics_effect, this);
+    }
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::EnableAmbisonics)) {
+        log->write_int(static_cast<std::int64_t>(order));
+    }
+    reset_effect_positions();
+    return true;
+}
+
+void EngineState::disable_ambisonics() {
+    if (ambisonic_buses.empty()) {
+        return;
+    }
+
+    mixer.unregister_effect(MIX_CHANNEL_POST, decode_ambisonics_effect);
+    mixer.lock();
+    for (Voice& voice : voices) { voice.ambisonic = detail::AmbisonicVoice {}; }
+    ambisonic_buses.clear();
+    mixer.unlock();
+    begin_record(detail::LoggedCall::DisableAmbisonics);
+
+    reset_effect_positions();
+}
+
+bool EngineState::is_ambisonics_enabled() { return !ambisonic_buses.empty(); }
+
+void EngineState::set_occlusion_query(OcclusionQueryT query, OcclusionSettings const& settings) {
+    clear_occlusion_query();
+
+    auto publish = [this](Sound sound, float occlusion) {
+        mixer.lock();
+        // The channel may already play another sound
+        if (SoundSlot const* slot = find_sound(sound)) {
+            voices[slot->data.channel].occlusion.target = occlusion;
+        }
+        mixer.unlock();
+    };
+    occlusion_worker =
+        std::make_unique<detail::OcclusionWorker>(std::move(query), settings, publish);
+    occlusion_worker->set_listeners(listener_positions());
+    for (SoundSlot const& slot : sound_slots) {
+        if (slot.active && !source_is_music(slot.data.source)) {
+            occlusion_worker->track(slot.sound, slot.data.position);
+        }
+    }
+
+    mixer.lock();
+    occlusion_settings = settings;
+    occlusion_enabled = true;
+    mixer.unlock();
+    begin_record(detail::LoggedCall::SetOcclusionQuery);
+}
+
+void EngineState::clear_occlusion_query() {
+    mixer.lock();
+    occlusion_enabled = false;
+    for (Voice& voice : voices) { voice.occlusion = detail::OcclusionVoice {}; }
+    mixer.unlock();
+
+    // This joins the worker thread, which may be waiting on the audio lock, so
+    // it must happen after unlocking
+    occlusion_worker.reset();
+}
+
+std::optional<float> EngineState::get_occlusion(Sound sound) {
+    if (!occlusion_worker) {
+        return std::nullopt;
+    }
+    return occlusion_worker->occlusion(sound);
+}
+
+void EngineState::set_sound_finish_callback(SoundFinishCallbackT callback, void* user_data) {
+    // The audio thread calls it with immediate_finish_callbacks
+    mixer.lock();
+    finish_callback = callback ? callback : detail::no_callback;
+    finish_callback_data = user_data;
+    mixer.unlock();
+}
+
+namespace {
+
+void call_finish_function(Sound sound, void* state) {
+    static_cast<EngineState*>(state)->finish_function(sound);
+}
+
+} // namespace
+
+void EngineState::set_sound_finish_callback(std::function<void(Sound)> callback) {
+    if (!callback) {
+        set_sound_finish_callback(nullptr, nullptr);
+        return;
+    }
+    mixer.lock();
+    finish_function = std::move(callback);
+    finish_callback = call_finish_function;
+    finish_callback_data = this;
+    mixer.unlock();
+}
+
+void EngineState::set_event_callback(EventCallbackT callback) {
+    event_callback = std::move(callback);
+}
+
+std::size_t EngineState::poll_events() {
+    adapt_buffer_size();
+    std::size_t count = 0;
+    Event event;
+    while (poll_event(event)) {
+        if (event.type == EventType::SoundFinished && !immediate_finish_callbacks) {
+            AUDEO_TRACE_SCOPE("finish_callback");
+            finish_callback(event.sound, finish_callback_data);
+        }
+        if (event_callback) {
+            AUDEO_TRACE_SCOPE("event_callback");
+            event_callback(event);
+        }
+        ++count;
+    }
+    return count;
+}
+
+bool EngineState::poll_event(Event& event) { return events.pop(event); }
+
+bool EngineState::wait_event(Event& event, int timeout_ms) {
+    return wait_until(timeout_ms, [this, &event] { return poll_event(event); });
+}
+
+bool EngineState::wait_for(Sound sound, int timeout_ms) {
+    return wait_until(timeout_ms, [this, sound] {
+        // Sounds finish on the audio thread
+        mixer.lock();
+        bool const finished = !is_valid(sound);
+        mixer.unlock();
+        return finished;
+    });
+}
+
+bool EngineState::start_recording(std::string_view path) {
+    stop_recording();
+    auto opened = std::make_unique<detail::CommandLog>(path, device.frequency, device.channels,
+                                                       default_resample_quality);
+    if (!opened->is_open()) {
+        return false;
+    }
+    mixer.lock();
+    recording_start_frame = mixed_frames;
+    mixer.unlock();
+    command_log = std::move(opened);
+    std::int64_t const start = recording_start_frame;
+
+    // Sources loaded before the recording started are used by the calls it
+    // records, so they are recorded as if they were loaded at its start. So
+    // is the rest of the state that changes what is heard
+    bool uses_bank = false;
+    for (auto const& [source, data] : sound_sources) {
+        std::string_view path = data.stream_path;
+        AudioType type = AudioType::Stream;
+        SourceCompression compression = SourceCompression::None;
+        if (data.is_music) {
+            // Music is not replayed, so its path isn't needed
+            path = {};
+            type = AudioType::Music;
+        } else if (!data.is_stream) {
+            if (data.samples->bank) {
+                uses_bank = true;
+                continue;
+            }
+            path = data.samples->path;
+            type = AudioType::Effect;
+            compression = data.samples->compression;
+        }
+        auto const& defaults = data.default_params;
+        detail::CommandLog* log = begin_record(detail::LoggedCall::LoadSource, start);
+        log->write_int(source.value());
+        log->write_int(static_cast<std::int64_t>(type));
+        log->write_int(static_cast<std::int64_t>(compression));
+        log->write_string(path);
+        begin_record(detail::LoggedCall::SetDefaultVolume, start);
+        log->write_int(source.value());
+        log->write_float(defaults.volume);
+        begin_record(detail::LoggedCall::SetDefaultPosition, start);
+        log->write_int(source.value());
+        log->write_vector(defaults.position);
+        begin_record(detail::LoggedCall::SetDefaultDistanceRangeMax, start);
+        log->write_int(source.value());
+        log->write_float(defaults.distance_range_max);
+        begin_record(detail::LoggedCall::SetDefaultMaxInstances, start);
+        log->write_int(source.value());
+        log->write_int(defaults.max_instances);
+        log->write_int(static_cast<std::int64_t>(defaults.limit_behavior));
+        begin_record(detail::LoggedCall::SetDefaultMinRetriggerInterval, start);
+        log->write_int(source.value());
+        log->write_int(defaults.min_retrigger_ms);
+    }
+    if (uses_bank) {
+        begin_record(detail::LoggedCall::LoadBank, start);
+    }
+
+    detail::CommandLog* log = begin_record(detail::LoggedCall::SetListenerCount, start);
+    log->write_int(static_cast<std::int64_t>(listeners.size()));
+    for (std::size_t i = 0; i < listeners.size(); ++i) {
+        begin_record(detail::LoggedCall::SetListenerPosition, start);
+        log->write_int(static_cast<std::int64_t>(i));
+        log->write_vector(listeners[i].position);
+        begin_record(detail::LoggedCall::SetListenerForward, start);
+        log->write_int(static_cast<std::int64_t>(i));
+        log->write_vector(listeners[i].forward);
+    }
+    if (hrtf_set) {
+        begin_record(detail::LoggedCall::LoadHrtf, start);
+        log->write_string(hrtf_directory);
+    }
+    if (!ambisonic_buses.empty()) {
+        begin_record(detail::LoggedCall::EnableAmbisonics, start);
+        log->write_int(static_cast<std::int64_t>(ambisonic_buses[0]->order()));
+    }
+    if (occlusion_worker) {
+        begin_record(detail::LoggedCall::SetOcclusionQuery, start);
+    }
+    // Emitters replay as if they were created at the start, and play their
+    // sounds from the next update_emitters() on
+    for (auto const& [emitter, data] : emitters) {
+        begin_record(detail::LoggedCall::CreateEmitter, start);
+        log->write_int(emitter.value());
+        log->write_int(data.source.value());
+        log->write_vector(data.position);
+    }
+    return true;
+}
+
+void EngineState::stop_recording() {
+    if (!command_log) {
+        return;
+    }
+    // Stamped with the frames mixed until now, so the replay is as long as the
+    // recording
+    begin_record(detail::LoggedCall::End);
+    command_log.reset();
+}
+
+Sound EngineState::play_music(SoundSource source, int loop_count, int fade_in_ms, float volume) {
+
+    SoundSourceData const& data = sound_sources[source];
+    Sound const sound = make_sound_handle(-1);
+
+    // Lock the audio device so we know which callback mixes the start, and so
+    // the music can't finish before it has its slot. Music that was playing is
+    // halted here, which frees the slot
+    mixer.lock();
+    Mix_FadeInMusic(data.music, loop_count, fade_in_ms);
+    Mix_VolumeMusic(static_cast<int>(MIX_MAX_VOLUME * volume));
+    music_start_callback = total_callbacks;
+    music_loops = loop_count;
+    music_start_ticks = mixer.ticks();
+    SoundSlot& slot = sound_slots[0];
+    slot.sound = sound;
+    slot.data = SoundData {};
+    slot.data.source = source;
+    slot.data.channel = -1;
+    slot.active = true;
+    push_event(EventType::SoundStarted, sound, source);
+    mixer.unlock();
+    return sound;
+}
+
+// Plays a source like play_sound(), but at a given position and volume instead
+// of the source's defaults
+Sound EngineState::play_sound_at(SoundSource source,
+                                 int loop_count,
+                                 int fade_in_ms,
+                                 vec3f position,
+                                 float max_distance,
+                                 double start_seconds,
+                                 float volume) {
+    AUDEO_TRACE_SCOPE("play_sound");
+
+    Sound sound(-1);
+    if (!admit_play(source)) {
+        return sound;
+    }
+
+    if (source_is_music(source)) {
+        sound = play_music(source, loop_count, fade_in_ms, volume);
+    } else {
+        // play_effect returns a pair with the sound and the channel it is
+        // played on
+        auto effect_data =
+            play_effect(source, loop_count, fade_in_ms, position, max_distance, start_seconds, volume);
+        sound = effect_data.first;
+        if (effect_data.second == -1) {
+            return sound;
+        }
+    }
+    sound_sources[source].last_play_ticks = mixer.ticks();
+    // Loading the source again may have pushed us over the budget. The source
+    // is playing now, so it won't be evicted itself
+    enforce_source_budget();
+
+    return sound;
+}
+
+// Applies the retrigger interval and instance limit of a source before it
+// plays, stealing an instance if needed. Returns false if the play is
+// rejected. Music has a single channel, so it is never limited
+bool EngineState::admit_play(SoundSource source) {
+    SoundSourceData const& data = sound_sources[source];
+    auto const& params = data.default_params;
+    if (data.is_music) {
+        return true;
+    }
+    if (params.min_retrigger_ms > 0 && data.last_play_ticks &&
+        mixer.ticks() - *data.last_play_ticks < params.min_retrigger_ms) {
+        return false;
+    }
+    if (params.max_instances == 0) {
+        return true;
+    }
+
+    // Sounds finish on the audio thread
+    mixer.lock();
+    unsigned int instances = 0;
+    SoundSlot const* victim = nullptr;
+    float victim_gain = 0.0f;
+    // Slot 0 is the music
+    for (std::size_t i = 1; i < sound_slots.size(); ++i) {
+        SoundSlot const& slot = sound_slots[i];
+        if (!slot.active || slot.data.source != source) {
+            continue;
+        }
+        ++instances;
+        if (params.limit_behavior == InstanceLimitBehavior::StealOldest) {
+            // Handles are handed out in increasing order
+            if (!victim || slot.sound.value() < victim->sound.value()) {
+                victim = &slot;
+            }
+        } else if (params.limit_behavior == InstanceLimitBehavior::StealQuietest) {
+            vec3f const position = slot.data.position;
+            float const distance = std::min(
+                magnitude(position - listeners[nearest_listener(position)].position),
+                slot.data.max_distance);
+            float const distance_gain =
+                slot.data.max_distance > 0 ? 1.0f - distance / slot.data.max_distance : 0.0f;
+            float const gain = static_cast<float>(mixer.volume(slot.data.channel, -1)) /
+                               MIX_MAX_VOLUME * distance_gain;
+            if (!victim || gain < victim_gain) {
+                victim = &slot;
+                victim_gain = gain;
+            }
+        }
+    }
+    if (instances < params.max_instances) {
+        mixer.unlock();
+        return true;
+    }
+    if (!victim) {
+        mixer.unlock();
+        return false;
+    }
+    Sound const stolen = victim->sound;
+    // Finish the sound right away, so its channel is free for the new one
+    finish_voice(victim->data.channel);
+    mixer.unlock();
+    if (detail::CommandLog* log = begin_record(detail::LoggedCall::StopSound)) {
+        log->write_int(stolen.value());
+        log->write_int(0);
+    }
+    return true;
+}
+
+std::pair<Sound, int> EngineState::play_effect(SoundSource source,
+                                               int loop_count,
+                                               int fade_in_ms,
+                                               vec3f position,
+                                               float max_distance,
+                                               double start_seconds,
+                                               float volume) {
+
+    SoundSourceData const& data = sound_sources[source];
+    EffectSamples* samples = data.samples.get();
+
+    if (samples) {
+        if (!samples->resident) {
+            bool loaded;
+            if (samples->pending_load && source_loader) {
+                // Finish the prefetch rather than decoding the file twice
+                source_loader->wait(samples->pending_load);
+                loaded = install_effect(*samples, *samples->pending_load);
+            } else {
+                loaded = load_effect(*samples);
+            }
+            samples->pending_load.reset();
+            if (!loaded) {
+                AUDEO_THROW(audeo::exception("Audeo: Failed to load audio chunk"));
+                return {Sound(-1), -1};
+            }
+            ++source_reloads;
+            intern_source_samples(data.samples);
+            // The source may have moved to samples with the same contents
+            samples = data.samples.get();
+        }
+        samples->last_used = ++source_use_count;
+    }
+    // After marking the samples as used, so they aren't evicted to make room
+    collect_prefetched_samples();
+
+    std::int64_t frame_count;
+    int sample_rate;
+    if (data.is_stream) {
+        frame_count = data.stream_info.frame_count;
+        sample_rate = data.stream_info.sample_rate;
+    } else {
+        frame_count = samples->frame_count;
+        sample_rate = samples->sample_rate;
+    }
+    std::int64_t const start_frame =
+        frame_count > 0 ? static_cast<std::int64_t>(std::fmod(start_seconds * sample_rate,
+                                                              static_cast<double>(frame_count)))
+                        : 0;
+
+    // Open and prefill streams before locking the audio device, so the file
+    // access doesn't hold up the mixer
+    std::shared_ptr<detail::Stream> stream;
+    if (data.is_stream) {
+        int const window_frames = static_cast<int>(voice_scratch_in.size() / device.channels);
+        stream = std::make_shared<detail::Stream>(data.stream_path, data.stream_info, device.channels,
+                                                  loop_count, start_frame, window_frames);
+        if (!stream->open()) {
+            AUDEO_THROW(audeo::exception("Audeo: Failed to open stream"));
+            return {Sound(-1), -1};
+        }
+        stream->fill();
+    }
+
+    // Lock the audio device so the channel can't be mixed before its voice is
+    // set up
+    mixer.lock();
+    int const channel = free_channel();
+
+    if (channel == -1) {
+        mixer.unlock();
+        AUDEO_THROW(audeo::exception("No channel available to play sound effect"));
+        return {Sound(-1), -1};
+    }
+
+    Sound const sound = make_sound_handle(channel);
+    Voice& voice = voices[channel];
+    if (voice.extra_effects) {
+        // Also drops the positional effect, which set_effect_position() adds
+        // again. render_voice() has to stay the first effect
+        mixer.unregister_all_effects(channel);
+        mixer.register_effect(channel, render_voice_effect, this);
+    }
+    // Reset the voice, but keep its preallocated decode buffer
+    std::vector<float> decode_cache = std::move(voice.decode_cache);
+    voice = Voice {};
+    voice.decode_cache = std::move(decode_cache);
+    voice.active = true;
+    voice.sound = sound;
+    voice.source = source;
+    voice.frame_count = frame_count;
+    voice.source_rate = sample_rate;
+    voice.step = voice_step(1.0f, voice.source_rate);
+    voice.loops = loop_count;
+    voice.quality = default_resample_quality;
+    if (stream) {
+        // The stream already starts at start_frame
+        voice.stream = stream;
+    } else {
+        if (samples->is_adpcm) {
+            voice.adpcm = samples->data;
+        } else {
+            voice.pcm = samples->data;
+        }
+        voice.position = static_cast<double>(start_frame);
+    }
+    if (fade_in_ms > 0) {
+        voice.fade_gain = 0.0f;
+        voice.fade_frames =
+            std::max<std::int64_t>(1, std::int64_t {fade_in_ms} * device.frequency / 1000);
+    }
+    // Empty sources finish in their first callback
+    voice.finished = voice.frame_count == 0;
+    mixer.volume(channel, static_cast<int>(MIX_MAX_VOLUME * volume));
+    set_effect_position(channel, position, max_distance);
+
+    // Take the slot of the channel before the sound is mixed. It may finish
+    // in its first callback, which frees the slot again
+    SoundSlot& slot = sound_slots[channel + 1];
+    slot.sound = sound;
+    slot.data = SoundData {};
+    slot.data.source = source;
+    slot.data.channel = channel;
+    slot.data.position = position;
+    slot.data.max_distance = max_distance;
+    slot.active = true;
+    if (occlusion_worker) {
+        // Also tracked before the sound can finish and untrack itself
+        occlusion_worker->track(sound, position);
+    }
+    push_event(EventType::SoundStarted, sound, source);
+    mixer.resume(channel);
+    mixer.unlock();
+
+    if (stream) {
+        if (!stream_worker) {
+            stream_worker = std::make_unique<detail::StreamWorker>();
+        }
+        stream_worker->add(std::move(stream));
+    }
+
+    return {sound, channel};
+}
+
+void EngineState::set_effect_position(int channel, vec3f position, float max_distance) {
+    AUDEO_TRACE_SCOPE("set_effect_position");
+    if (!ambisonic_buses.empty()) {
+        set_ambisonic_position(channel, position, max_distance);
+        return;
+    }
+    if (hrtf_set) {
+        set_hrtf_position(channel, position, max_distance);
+        return;
+    }
+    if (speaker_layout) {
+        set_surround_position(channel, position, max_distance);
+        return;
+    }
+
+    Listener const& listener = listeners[nearest_listener(position)];
+    vec3f direction = position - listener.position;
+    vec3f forward = normalize(listener.forward);
+    float raw_angle = angle(forward, direction);
+    // Now get the distance
+    float raw_distance = magnitude(direction);
+    // Make sure the distance is set to max_distance once we are too far away to
+    // hear it to not break the map_range() function
+    if (raw_distance > max_distance)
+        raw_distance = max_distance;
+    // Now we adjust the angle to the left, depending on whether it is to
+    // the left or to the right of the listener. We test this by testing the
+    // sign of the cross product.
+    float d = dot(cross(direction, forward), vec3f{0, 1, 0});
+
+    if (d < 0) {
+        raw_angle += 180.0f;
+    }
+
+    // Maximum distance SDL provides
+    constexpr std::uint8_t sdl_max_distance = 255;
+    // Map our own max distance to SDL's max_distance
+
+    std::uint8_t mapped_distance =
+        static_cast<std::int8_t>(map_range(0, max_distance, 0, sdl_max_distance, raw_distance));
+
+    mixer.set_position(channel, static_cast<std::int16_t>(raw_angle), mapped_distance);
+}
+
+void EngineState::set_hrtf_position(int channel, vec3f position, float max_distance) {
+    Listener const& listener = listeners[nearest_listener(position)];
+    vec3f direction = position - listener.position;
+    vec3f forward, right, up;
+    listener_basis(listener, forward, right, up);
+
+    float x = dot(direction, right);
+    float y = dot(direction, up);
+    float z = dot(direction, forward);
+    // Azimuth is clockwise from the front, elevation upwards from the
+    // horizontal plane. A sound on top of the listener is treated as in front
+    float azimuth = static_cast<float>(std::atan2(x, z) * 180.0 / pi);
+    float elevation = static_cast<float>(std::atan2(y, std::sqrt(x * x + z * z)) * 180.0 / pi);
+
+    float distance = std::min(magnitude(direction), max_distance);
+    float gain = max_distance > 0 ? 1.0f - distance / max_distance : 0.0f;
+
+    detail::HrirFilter const* filter = hrtf_set->filter(azimuth, elevation);
+
+    mixer.lock();
+    detail::HrtfVoice& voice = voices[channel].hrtf;
+    if (!voice.enabled) {
+        // Don't fade in from the previous sound that played on this channel
+        voice.enabled = true;
+        voice.previous_gain = gain;
+    }
+    voice.current = filter;
+    voice.gain = gain;
+    mixer.unlock();
+}
+
+void EngineState::set_ambisonic_position(int channel, vec3f position, float max_distance) {
+    std::size_t const bus = nearest_listener(position);
+    vec3f direction = position - listeners[bus].position;
+    float distance = std::min(magnitude(direction), max_distance);
+    float gain = max_distance > 0 ? 1.0f - distance / max_distance : 0.0f;
+
+    detail::AmbisonicCoefficients coefficients =
+        detail::encode_direction(direction, ambisonic_buses[bus]->order());
+    for (float& c : coefficients) { c *= gain; }
+
+    mixer.lock();
+    detail::AmbisonicVoice& voice = voices[channel].ambisonic;
+    if (!voice.enabled || voice.bus != bus) {
+        // Coefficients of another bus don't mean anything on this one, so
+        // don't ramp from them
+        voice.enabled = true;
+        voice.bus = bus;
+        voice.previous_coefficients = coefficients;
+    }
+    voice.coefficients = coefficients;
+    mixer.unlock();
+}
+
+void EngineState::set_surround_position(int channel, vec3f position, float max_distance) {
+    mixer.lock();
+    detail::SurroundVoice& voice = voices[channel].surround;
+    voice.position = position;
+    voice.max_distance = max_distance;
+    if (voice.enabled) {
+        // Picked up by the next batched panning pass
+        voice.dirty = true;
+    } else {
+        // Pan new voices right away, so they don't play unpanned for a block
+        float azimuth, gain;
+        surround_direction(voice, azimuth, gain);
+        speaker_layout->pan(&azimuth, &gain, &voice.gains, 1);
+        voice.previous_gains = voice.gains;
+        voice.enabled = true;
+    }
+    mixer.unlock();
+}
+
+void EngineState::update_surround_listener() {
+    std::vector<ListenerSnapshot> snapshots(listeners.size());
+    for (std::size_t i = 0; i < listeners.size(); ++i) {
+        snapshots[i].position = listeners[i].position;
+        listener_basis(listeners[i], snapshots[i].forward, snapshots[i].right, snapshots[i].up);
+    }
+
+    mixer.lock();
+    surround_listeners.swap(snapshots);
+    surround_listener_dirty = true;
+    mixer.unlock();
+}
+
+// Switches all playing effects between the spatialization modes. Channels
+// keep the positional effect of their last sound, so it is dropped from idle
+// channels too
+void EngineState::reset_effect_positions() {
+    for (std::size_t channel = 0; channel < voices.size(); ++channel) {
+        // An angle and distance of zero unregisters SDL_Mixer's position effect
+        mixer.set_position(static_cast<int>(channel), 0, 0);
+    }
+    for (SoundSlot const& slot : sound_slots) {
+        if (slot.active && slot.data.channel >= 0) {
+            set_effect_position(slot.data.channel, slot.data.position, slot.data.max_distance);
+        }
+    }
+}
+
+// Reopens the audio device with another buffer size. Closing the device halts
+// all channels and the music, and removes all effects, so they are started and
+// registered again. Voices keep their state, so effects continue where they
+// were
+bool EngineState::reopen_device(int chunk_frames) {
+    AUDEO_TRACE_SCOPE("reopen_device");
+    struct ChannelState {
+        int volume = 0;
+        bool paused = false;
+    };
+    std::vector<ChannelState> channels(voices.size());
+    for (std::size_t channel = 0; channel < voices.size(); ++channel) {
+        int const c = static_cast<int>(channel);
+        channels[channel] = {mixer.volume(c, -1), mixer.paused(c) != 0};
+    }
+    Mix_Music* music = nullptr;
+    bool music_paused = false;
+    int const music_volume = Mix_VolumeMusic(-1);
+    if (sound_slots[0].active && Mix_PlayingMusic()) {
+        music = sound_sources[sound_slots[0].data.source].music;
+        music_paused = Mix_PausedMusic() != 0;
+    }
+    std::optional<AmbisonicOrder> ambisonic_order;
+    if (!ambisonic_buses.empty()) {
+        ambisonic_order = ambisonic_buses[0]->order();
+    }
+
+    reopening_device = true;
+    Mix_CloseAudio();
+    auto open = [this](int frames) {
+        return Mix_OpenAudio(device.frequency, device.format, device.channels, frames) != -1;
+    };
+    if (!open(chunk_frames)) {
+        // Keep the old buffer size rather than having no device at all
+        if (!open(device.chunk_frames)) {
+            reopening_device = false;
+            std::string error = Mix_GetError();
+            AUDEO_THROW(audeo::exception(
+                ("Audeo: Unable to reopen the audio device. Reason: " + error).c_str()));
+            return false;
+        }
+    } else {
+        device.chunk_frames = chunk_frames;
+    }
+    last_callback_end = {};
+    mixer.allocate_channels(static_cast<int>(voices.size()));
+
+    if (speaker_layout) {
+        mixer.register_effect(MIX_CHANNEL_POST, surround_panning_effect, this);
+    }
+    // The buses hold a buffer of audio, so they are created anew for the new
+    // buffer size
+    ambisonic_buses.clear();
+    if (ambisonic_order) {
+        enable_ambisonics(*ambisonic_order);
+    }
+    Mix_HookMusicFinished(music_finished_hook);
+    Mix_SetPostMix(finish_mix_stats_postmix, this);
+
+    mixer.lock();
+    for (std::size_t channel = 0; channel < channels.size(); ++channel) {
+        int const c = static_cast<int>(channel);
+        start_channel(c);
+        mixer.volume(c, channels[channel].volume);
+        if (channels[channel].paused) {
+            mixer.pause(c);
+        }
+        // Closing the device dropped the effects reverse_stereo() and
+        // add_effect() registered
+        voices[channel].extra_effects = false;
+    }
+    mixer.unlock();
+    reset_effect_positions();
+
+    if (music) {
+        // Best effort, not every music format can seek
+        double const elapsed = (mixer.ticks() - music_start_ticks) / 1000.0;
+        Mix_PlayMusic(music, music_loops);
+        Mix_SetMusicPosition(elapsed);
+        if (music_paused) {
+            Mix_PauseMusic();
+        }
+    }
+    Mix_VolumeMusic(music_volume);
+
+    reopening_device = false;
+    ++adaptive_buffer.resizes;
+    return true;
+}
+
+// Called by poll_events(). Grows the buffer when callbacks underran since the
+// last call, and shrinks it after a long enough stable period
+void EngineState::adapt_buffer_size() {
+    if (!adaptive_buffer.enabled) {
+        return;
+    }
+    Uint32 const now = mixer.ticks();
+    mixer.lock();
+    std::uint64_t const underruns = total_underruns;
+    mixer.unlock();
+    bool const underran = underruns != adaptive_buffer.underruns;
+    adaptive_buffer.underruns = underruns;
+    if (!SDL_TICKS_PASSED(now, adaptive_buffer.settle_until)) {
+        return;
+    }
+
+    int chunk_frames = device.chunk_frames;
+    if (underran) {
+        adaptive_buffer.stable_since = now;
+        chunk_frames = std::min(chunk_frames * 2, adaptive_buffer.max_frames);
+    } else if (now - adaptive_buffer.stable_since >= adaptive_buffer.stable_ms) {
+        adaptive_buffer.stable_since = now;
+        chunk_frames = std::max(chunk_frames / 2, adaptive_buffer.min_frames);
+    }
+    if (chunk_frames == device.chunk_frames) {
+        return;
+    }
+    reopen_device(chunk_frames);
+    // Callbacks right after opening the device are irregular
+    adaptive_buffer.settle_until = mixer.ticks() + 500;
+    adaptive_buffer.underruns = total_underruns;
+}
+
+} // namespace detail
+
+// EffectSamples are freed by the last source using them, which may belong to
+// any engine
+EffectSamples::~EffectSamples() {
+    if (owner) {
+        owner->unload_effect(*this);
+    }
+}
+
+Engine::Engine() : state(std::make_unique<detail::EngineState>()) {}
+
+Engine::~Engine() = default;
+
+Engine::Engine(Engine&&) noexcept = default;
+
+Engine& Engine::operator=(Engine&&) noexcept = default;
+
+bool Engine::init(InitInfo const& info) { return state->init(info); }
+
+bool Engine::init_offline(InitInfo const& info) { return state->init_offline(info); }
+
+void Engine::quit() { state->quit(); }
+
+void Engine::render(float* out, std::size_t frame_count) { state->render(out, frame_count); }
+
+bool Engine::is_playing_music() { return state->is_playing_music(); }
+
+unsigned int Engine::effect_channel_count() { return state->effect_channel_count(); }
+
+void Engine::allocate_effect_channels(unsigned int count) {
+    state->allocate_effect_channels(count);
+}
+
+SoundSource Engine::load_source(std::string_view path,
+                                AudioType type,
+                                SourceCompression compression) {
+    return state->load_source(path, type, compression);
+}
+
+std::unordered_map<std::string, SoundSource> Engine::load_bank(std::string_view path) {
+    return state->load_bank(path);
+}
+
+bool Engine::free_source(SoundSource source) { return state->free_source(source); }
+
+std::size_t Engine::free_unused_sources() { return state->free_unused_sources(); }
+
+bool Engine::prefetch(SoundSource source) { return state->prefetch(source); }
+
+void Engine::set_source_memory_budget(std::size_t bytes) { state->set_source_memory_budget(bytes); }
+
+SourceCacheStats Engine::get_source_cache_stats() { return state->get_source_cache_stats(); }
+
+EngineStats Engine::get_stats() { return state->get_stats(); }
+
+void Engine::reset_stats() { state->reset_stats(); }
+
+bool Engine::is_playing(SoundSource source) { return state->is_playing(source); }
+
+bool Engine::source_is_music(SoundSource source) { return state->source_is_music(source); }
+
+bool Engine::set_default_volume(SoundSource source, float volume) {
+    return state->set_default_volume(source, volume);
+}
+
+bool Engine::set_default_position(SoundSource source, float x, float y, float z) {
+    return state->set_default_position(source, x, y, z);
+}
+
+bool Engine::set_default_position(SoundSource source, vec3f position) {
+    return state->set_default_position(source, position);
+}
+
+bool Engine::set_default_distance_range_max(SoundSource source, float distance) {
+    return state->set_default_distance_range_max(source, distance);
+}
+
+bool Engine::set_default_max_instances(SoundSource source,
+                                       unsigned int count,
+                                       InstanceLimitBehavior behavior) {
+    return state->set_default_max_instances(source, count, behavior);
+}
+
+bool Engine::set_default_min_retrigger_interval(SoundSource source, int interval_ms) {
+    return state->set_default_min_retrigger_interval(source, interval_ms);
+}
+
+Sound Engine::play_sound(SoundSource source, int loop_count, int fade_in_ms) {
+    return state->play_sound(source, loop_count, fade_in_ms);
+}
+
+Sound Engine::play_sound(SoundSource source, loop_forever_t, int fade_in_ms) {
+    return state->play_sound(source, loop_forever, fade_in_ms);
+}
+
+bool Engine::is_valid(Sound sound) { return state->is_valid(sound); }
+
+bool Engine::is_valid(SoundSource source) { return state->is_valid(source); }
+
+std::optional<float> Engine::get_volume(Sound sound) { return state->get_volume(sound); }
+
+std::optional<vec3f> Engine::get_position(Sound sound) { return state->get_position(sound); }
+
+std::optional<float> Engine::get_pitch(Sound sound) { return state->get_pitch(sound); }
+
+double Engine::get_output_latency() { return state->get_output_latency(); }
+
+std::optional<double> Engine::get_time_until_audible(Sound sound) {
+    return state->get_time_until_audible(sound);
+}
+
+bool Engine::pause_sound(Sound sound) { return state->pause_sound(sound); }
+
+bool Engine::resume_sound(Sound sound) { return state->resume_sound(sound); }
+
+bool Engine::stop_sound(Sound sound, int fade_out_ms) {
+    return state->stop_sound(sound, fade_out_ms);
+}
+
+bool Engine::set_volume(Sound sound, float volume) { return state->set_volume(sound, volume); }
+
+bool Engine::set_position(Sound sound, vec3f position) {
+    return state->set_position(sound, position);
+}
+
+bool Engine::set_position(Sound sound, float x, float y, float z) {
+    return state->set_position(sound, x, y, z);
+}
+
+bool Engine::set_distance_range_max(Sound sound, float distance) {
+    return state->set_distance_range_max(sound, distance);
+}
+
+bool Engine::set_pitch(Sound sound, float pitch) { return state->set_pitch(sound, pitch); }
+
+bool Engine::set_resample_quality(Sound sound, ResampleQuality quality) {
+    return state->set_resample_quality(sound, quality);
+}
+
+void Engine::submit(CommandBuffer& buffer) { state->submit(buffer); }
+
+vec3f Engine::get_listener_position() { return state->get_listener_position(); }
+
+vec3f Engine::get_listener_forward() { return state->get_listener_forward(); }
+
+vec3f Engine::get_listener_position(std::size_t listener) {
+    return state->get_listener_position(listener);
+}
+
+vec3f Engine::get_listener_forward(std::size_t listener) {
+    return state->get_listener_forward(listener);
+}
+
+std::size_t Engine::get_listener_count() { return state->get_listener_count(); }
+
+void Engine::set_listener_position(vec3f new_position) {
+    state->set_listener_position(new_position);
+}
+
+void Engine::set_listener_position(float new_x, float new_y, float new_z) {
+    state->set_listener_position(new_x, new_y, new_z);
+}
+
+void Engine::set_listener_forward(vec3f new_forward) { state->set_listener_forward(new_forward); }
+
+void Engine::set_listener_forward(float new_x, float new_y, float new_z) {
+    state->set_listener_forward(new_x, new_y, new_z);
+}
+
+void Engine::set_listener_count(std::size_t count) { state->set_listener_count(count); }
+
+void Engine::set_listener_position(std::size_t listener, vec3f new_position) {
+    state->set_listener_position(listener, new_position);
+}
+
+void Engine::set_listener_forward(std::size_t listener, vec3f new_forward) {
+    state->set_listener_forward(listener, new_forward);
+}
+
+Emitter Engine::create_emitter(SoundSource source, vec3f position) {
+    return state->create_emitter(source, position);
+}
+
+bool Engine::destroy_emitter(Emitter emitter) { return state->destroy_emitter(emitter); }
+
+bool Engine::is_valid(Emitter emitter) { return state->is_valid(emitter); }
+
+bool Engine::set_emitter_position(Emitter emitter, vec3f position) {
+    return state->set_emitter_position(emitter, position);
+}
+
+std::optional<Sound> Engine::get_emitter_sound(Emitter emitter) {
+    return state->get_emitter_sound(emitter);
+}
+
+void Engine::update_emitters() { state->update_emitters(); }
+
+bool Engine::load_hrtf(std::string_view directory) { return state->load_hrtf(directory); }
+
+void Engine::unload_hrtf() { state->unload_hrtf(); }
+
+bool Engine::is_hrtf_enabled() { return state->is_hrtf_enabled(); }
+
+bool Engine::enable_ambisonics(AmbisonicOrder order) { return state->enable_ambisonics(order); }
+
+void Engine::disable_ambisonics() { state->disable_ambisonics(); }
+
+bool Engine::is_ambisonics_enabled() { return state->is_ambisonics_enabled(); }
+
+void Engine::set_occlusion_query(OcclusionQueryT query, OcclusionSettings const& settings) {
+    state->set_occlusion_query(query, settings);
+}
+
+void Engine::clear_occlusion_query() { state->clear_occlusion_query(); }
+
+std::optional<float> Engine::get_occlusion(Sound sound) { return state->get_occlusion(sound); }
+
+bool Engine::reverse_stereo(Sound sound, bool reverse) {
+    return state->reverse_stereo(sound, reverse);
+}
+
+bool Engine::add_effect(Sound sound, Effect effect) { return state->add_effect(sound, effect); }
+
+void Engine::set_sound_finish_callback(SoundFinishCallbackT callback, void* user_data) {
+    state->set_sound_finish_callback(callback, user_data);
+}
+
+void Engine::set_sound_finish_callback(std::function<void(Sound)> callback) {
+    state->set_sound_finish_callback(std::move(callback));
+}
+
+void Engine::set_event_callback(EventCallbackT callback) { state->set_event_callback(callback); }
+
+std::size_t Engine::poll_events() { return state->poll_events(); }
+
+bool Engine::poll_event(Event& event) { return state->poll_event(event); }
+
+bool Engine::wait_event(Event& event, int timeout_ms) {
+    return state->wait_event(event, timeout_ms);
+}
+
+bool Engine::wait_for(Sound sound, int timeout_ms) { return state->wait_for(sound, timeout_ms); }
+
+bool Engine::start_recording(std::string_view path) { return state->start_recording(path); }
+
+void Engine::stop_recording() { state->stop_recording(); }
+
+SoundSource detail::load_converted_source(Engine& engine,
+                                          std::string_view path,
+                                          std::shared_ptr<std::vector<std::uint8_t> const> pcm,
+                                          std::shared_ptr<AdpcmBuffer const> adpcm) {
+    return engine.state->load_converted_source(path, std::move(pcm), std::move(adpcm));
+}
+
+Engine& default_engine() {
+    // Leaked on purpose, so the free functions still work while other static
+    // objects are destroyed
+    static Engine* engine = new Engine();
+    return *engine;
+}
+
+std::string get_audio_driver_name() { return SDL_GetCurrentAudioDriver(); }
+
+bool init(InitInfo const& info) { return default_engine().init(info); }
+
+void quit() { default_engine().quit(); }
+
+bool is_playing_music() { return default_engine().is_playing_music(); }
+
+unsigned int effect_channel_count() { return default_engine().effect_channel_count(); }
+
+void allocate_effect_channels(unsigned int count) {
+    default_engine().allocate_effect_channels(count);
+}
+
+SoundSource load_source(std::string_view path, AudioType type, SourceCompression compression) {
+    return default_engine().load_source(path, type, compression);
+}
+
+std::unordered_map<std::string, SoundSource> load_bank(std::string_view path) {
+    return default_engine().load_bank(path);
+}
+
+bool free_source(SoundSource source) { return default_engine().free_source(source); }
+
+std::size_t free_unused_sources() { return default_engine().free_unused_sources(); }
+
+bool prefetch(SoundSource source) { return default_engine().prefetch(source); }
+
+void set_source_memory_budget(std::size_t bytes) {
+    default_engine().set_source_memory_budget(bytes);
+}
+
+SourceCacheStats get_source_cache_stats() { return default_engine().get_source_cache_stats(); }
+
+EngineStats get_stats() { return default_engine().get_stats(); }
+
+void reset_stats() { default_engine().reset_stats(); }
+
+bool is_playing(SoundSource source) { return default_engine().is_playing(source); }
+
+bool source_is_music(SoundSource source) { return default_engine().source_is_music(source); }
+
+bool set_default_volume(SoundSource source, float volume) {
+    return default_engine().set_default_volume(source, volume);
+}
+
+bool set_default_position(SoundSource source, float x, float y, float z) {
+    return default_engine().set_default_position(source, x, y, z);
+}
+
+bool set_default_position(SoundSource source, vec3f position) {
+    return default_engine().set_default_position(source, position);
+}
+
+bool set_default_distance_range_max(SoundSource source, float distance) {
+    return default_engine().set_default_distance_range_max(source, distance);
+}
+
+bool set_default_max_instances(SoundSource source,
+                               unsigned int count,
+                               InstanceLimitBehavior behavior) {
+    return default_engine().set_default_max_instances(source, count, behavior);
+}
+
+bool set_default_min_retrigger_interval(SoundSource source, int interval_ms) {
+    return default_engine().set_default_min_retrigger_interval(source, interval_ms);
+}
+
+Sound play_sound(SoundSource source, int loop_count, int fade_in_ms) {
+    return default_engine().play_sound(source, loop_count, fade_in_ms);
+}
+
+Sound play_sound(SoundSource source, loop_forever_t, int fade_in_ms) {
+    return default_engine().play_sound(source, loop_forever, fade_in_ms);
+}
+
+bool is_valid(Sound sound) { return default_engine().is_valid(sound); }
+
+bool is_valid(SoundSource source) { return default_engine().is_valid(source); }
+
+std::optional<float> get_volume(Sound sound) { return default_engine().get_volume(sound); }
+
+std::optional<vec3f> get_position(Sound sound) { return default_engine().get_position(sound); }
+
+std::optional<float> get_pitch(Sound sound) { return default_engine().get_pitch(sound); }
+
+double get_output_latency() { return default_engine().get_output_latency(); }
+
+std::optional<double> get_time_until_audible(Sound sound) {
+    return default_engine().get_time_until_audible(sound);
+}
+
+bool pause_sound(Sound sound) { return default_engine().pause_sound(sound); }
+
+bool resume_sound(Sound sound) { return default_engine().resume_sound(sound); }
+
+bool stop_sound(Sound sound, int fade_out_ms) {
+    return default_engine().stop_sound(sound, fade_out_ms);
+}
+
+bool set_volume(Sound sound, float volume) { return default_engine().set_volume(sound, volume); }
+
+bool set_position(Sound sound, vec3f position) {
+    return default_engine().set_position(sound, position);
+}
+
+bool set_position(Sound sound, float x, float y, float z) {
+    return default_engine().set_position(sound, x, y, z);
+}
+
+bool set_distance_range_max(Sound sound, float distance) {
+    return default_engine().set_distance_range_max(sound, distance);
+}
+
+bool set_pitch(Sound sound, float pitch) { return default_engine().set_pitch(sound, pitch); }
+
+bool set_resample_quality(Sound sound, ResampleQuality quality) {
+    return default_engine().set_resample_quality(sound, quality);
+}
+
+void submit(CommandBuffer& buffer) { default_engine().submit(buffer); }
+
+vec3f get_listener_position() { return default_engine().get_listener_position(); }
+
+vec3f get_listener_forward() { return default_engine().get_listener_forward(); }
+
+vec3f get_listener_position(std::size_t listener) {
+    return default_engine().get_listener_position(listener);
+}
+
+vec3f get_listener_forward(std::size_t listener) {
+    return default_engine().get_listener_forward(listener);
+}
+
+std::size_t get_listener_count() { return default_engine().get_listener_count(); }
+
+void set_listener_position(vec3f new_position) {
+    default_engine().set_listener_position(new_position);
+}
+
+void set_listener_position(float new_x, float new_y, float new_z) {
+    default_engine().set_listener_position(new_x, new_y, new_z);
+}
+
+void set_listener_forward(vec3f new_forward) { default_engine().set_listener_forward(new_forward); }
+
+void set_listener_forward(float new_x, float new_y, float new_z) {
+    default_engine().set_listener_forward(new_x, new_y, new_z);
+}
+
+void set_listener_count(std::size_t count) { default_engine().set_listener_count(count); }
+
+void set_listener_position(std::size_t listener, vec3f new_position) {
+    default_engine().set_listener_position(listener, new_position);
+}
+
+void set_listener_forward(std::size_t listener, vec3f new_forward) {
+    default_engine().set_listener_forward(listener, new_forward);
+}
+
+Emitter create_emitter(SoundSource source, vec3f position) {
+    return default_engine().create_emitter(source, position);
+}
+
+bool destroy_emitter(Emitter emitter) { return default_engine().destroy_emitter(emitter); }
+
+bool is_valid(Emitter emitter) { return default_engine().is_valid(emitter); }
+
+bool set_emitter_position(Emitter emitter, vec3f position) {
+    return default_engine().set_emitter_position(emitter, position);
+}
+
+std::optional<Sound> get_emitter_sound(Emitter emitter) {
+    return default_engine().get_emitter_sound(emitter);
+}
+
+void update_emitters() { default_engine().update_emitters(); }
+
+bool load_hrtf(std::string_view directory) { return default_engine().load_hrtf(directory); }
+
+void unload_hrtf() { default_engine().unload_hrtf(); }
+
+bool is_hrtf_enabled() { return default_engine().is_hrtf_enabled(); }
+
+bool enable_ambisonics(AmbisonicOrder order) { return default_engine().enable_ambisonics(order); }
+
+void disable_ambisonics() { default_engine().disable_ambisonics(); }
+
+bool is_ambisonics_enabled() { return default_engine().is_ambisonics_enabled(); }
+
+void set_occlusion_query(OcclusionQueryT query, OcclusionSettings const& settings) {
+    default_engine().set_occlusion_query(query, settings);
+}
+
+void clear_occlusion_query() { default_engine().clear_occlusion_query(); }
+
+std::optional<float> get_occlusion(Sound sound) { return default_engine().get_occlusion(sound); }
+
+bool reverse_stereo(Sound sound, bool reverse) {
+    return default_engine().reverse_stereo(sound, reverse);
+}
+
+bool add_effect(Sound sound, Effect effect) { return default_engine().add_effect(sound, effect); }
+
+void set_sound_finish_callback(SoundFinishCallbackT callback, void* user_data) {
+    default_engine().set_sound_finish_callback(callback, user_data);
+}
+
+void set_sound_finish_callback(std::function<void(Sound)> callback) {
+    default_engine().set_sound_finish_callback(std::move(callback));
+}
+
+void set_event_callback(EventCallbackT callback) { default_engine().set_event_callback(callback); }
+
+std::size_t poll_events() { return default_engine().poll_events(); }
+
+bool poll_event(Event& event) { return default_engine().poll_event(event); }
+
+bool wait_event(Event& event, int timeout_ms) {
+    return default_engine().wait_event(event, timeout_ms);
+}
+
+bool wait_for(Sound sound, int timeout_ms) { return default_engine().wait_for(sound, timeout_ms); }
+
+bool start_recording(std::string_view path) { return default_engine().start_recording(path); }
+
+void stop_recording() { default_engine().stop_recording(); }
+
+bool write_trace([[maybe_unused]] std::string_view path) {
+#ifdef AUDEO_TRACING
+    return detail::write_trace_file(path);
+#else
+    return false;
+#endif
 }
 
 } // namespace audeo
@@ -0,0 +1,129 @@
+#include "audeo/adpcm.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace audeo::detail {
+
+namespace {
+
+constexpr int step_table[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,
+    25,    28,    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,
+    88,    97,    107,   118,   130,   143,   157,   173,   190,   209,   230,   253,   279,
+    307,   337,   371,   408,   449,   494,   544,   598,   658,   724,   796,   876,   963,
+    1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,  2272,  2499,  2749,  3024,  3327,
+    3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+constexpr int index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+// Bytes of decoder state at the start of every channel in a block
+constexpr std::size_t header_size = 4;
+constexpr std::size_t channel_data_size = adpcm_block_frames / 2;
+
+struct State {
+    int predictor = 0;
+    int index = 0;
+};
+
+// Applies a nibble to the decoder state. Shared by the encoder, so both stay
+// in sync
+int step(State& state, int nibble) {
+    int const step_size = step_table[state.index];
+    int difference = step_size >> 3;
+    if (nibble & 4) {
+        difference += step_size;
+    }
+    if (nibble & 2) {
+        difference += step_size >> 1;
+    }
+    if (nibble & 1) {
+        difference += step_size >> 2;
+    }
+    state.predictor += (nibble & 8) ? -difference : difference;
+    state.predictor = std::clamp(state.predictor, -32768, 32767);
+    state.index = std::clamp(state.index + index_table[nibble], 0, 88);
+    return state.predictor;
+}
+
+int encode_sample(State& state, int sample) {
+    int difference = sample - state.predictor;
+    int nibble = 0;
+    if (difference < 0) {
+        nibble = 8;
+        difference = -difference;
+    }
+    int step_size = step_table[state.index];
+    for (int bit = 4; bit > 0; bit >>= 1) {
+        if (difference >= step_size) {
+            nibble |= bit;
+            difference -= step_size;
+        }
+        step_size >>= 1;
+    }
+    step(state, nibble);
+    return nibble;
+}
+
+} // namespace
+
+std::size_t adpcm_block_size(int channels) {
+    return static_cast<std::size_t>(channels) * (header_size + channel_data_size);
+}
+
+AdpcmBuffer adpcm_encode(float const* samples, int channels, std::int64_t frame_count) {
+    AdpcmBuffer buffer;
+    buffer.channels = channels;
+    buffer.frame_count = frame_count;
+    std::int64_t const blocks = (frame_count + adpcm_block_frames - 1) / adpcm_block_frames;
+    buffer.data.resize(blocks * adpcm_block_size(channels));
+
+    std::vector<State> states(channels);
+    for (std::int64_t block = 0; block < blocks; ++block) {
+        std::uint8_t* out = buffer.data.data() + block * adpcm_block_size(channels);
+        for (int c = 0; c < channels; ++c) {
+            State& state = states[c];
+            std::uint8_t* header = out + c * header_size;
+            auto const predictor = static_cast<std::uint16_t>(static_cast<std::int16_t>(state.predictor));
+            header[0] = static_cast<std::uint8_t>(predictor & 0xFF);
+            header[1] = static_cast<std::uint8_t>(predictor >> 8);
+            header[2] = static_cast<std::uint8_t>(state.index);
+            header[3] = 0;
+
+            std::uint8_t* nibbles = out + channels * header_size + c * channel_data_size;
+            for (int i = 0; i < adpcm_block_frames; ++i) {
+                std::int64_t const frame = block * adpcm_block_frames + i;
+                float value = frame < frame_count ? samples[frame * channels + c] : 0.0f;
+                int const sample = static_cast<int>(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f));
+                int const nibble = encode_sample(state, sample);
+                if (i % 2 == 0) {
+                    nibbles[i / 2] = static_cast<std::uint8_t>(nibble);
+                } else {
+                    nibbles[i / 2] |= static_cast<std::uint8_t>(nibble << 4);
+                }
+            }
+        }
+    }
+    return buffer;
+}
+
+void adpcm_decode_block(std::uint8_t const* blocks, int channels, std::int64_t block, float* out) {
+    std::uint8_t const* in = blocks + block * adpcm_block_size(channels);
+    for (int c = 0; c < channels; ++c) {
+        std::uint8_t const* header = in + c * header_size;
+        State state;
+        state.predictor = static_cast<std::int16_t>(header[0] | (header[1] << 8));
+        state.index = std::min<int>(header[2], 88);
+
+        std::uint8_t const* nibbles = in + channels * header_size + c * channel_data_size;
+        float* dst = out + c;
+        for (int i = 0; i < adpcm_block_frames / 2; ++i) {
+            std::uint8_t const byte = nibbles[i];
+            dst[(2 * i) * channels] = step(state, byte & 0x0F) * (1.0f / 32768.0f);
+            dst[(2 * i + 1) * channels] = step(state, byte >> 4) * (1.0f / 32768.0f);
+        }
+    }
+}
+
+} // namespace audeo::detail
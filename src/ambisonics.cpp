@@ -0,0 +1,313 @@
+#include "audeo/ambisonics.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace audeo::detail {
+
+namespace {
+
+constexpr double pi = 3.14159265358979323846;
+
+// Amount of points used to fit the rotation matrix. This has to be a good deal
+// larger than the amount of ambisonic channels for the fit to be well
+// conditioned
+constexpr int fit_point_count = 64;
+
+// Real spherical harmonics in ACN order with SN3D normalization, for a unit
+// vector in ambisonic coordinates
+AmbisonicCoefficients spherical_harmonics(vec3f v, int channels) {
+    float const x = v.x;
+    float const y = v.y;
+    float const z = v.z;
+    AmbisonicCoefficients c {};
+    c[0] = 1.0f;
+    c[1] = y;
+    c[2] = z;
+    c[3] = x;
+    if (channels > 4) {
+        float const sqrt3 = std::sqrt(3.0f);
+        float const sqrt15 = std::sqrt(15.0f);
+        float const sqrt5_8 = std::sqrt(5.0f / 8.0f);
+        float const sqrt3_8 = std::sqrt(3.0f / 8.0f);
+        c[4] = sqrt3 * x * y;
+        c[5] = sqrt3 * y * z;
+        c[6] = 0.5f * (3.0f * z * z - 1.0f);
+        c[7] = sqrt3 * x * z;
+        c[8] = 0.5f * sqrt3 * (x * x - y * y);
+        c[9] = sqrt5_8 * y * (3.0f * x * x - y * y);
+        c[10] = sqrt15 * x * y * z;
+        c[11] = sqrt3_8 * y * (5.0f * z * z - 1.0f);
+        c[12] = 0.5f * z * (5.0f * z * z - 3.0f);
+        c[13] = sqrt3_8 * x * (5.0f * z * z - 1.0f);
+        c[14] = 0.5f * sqrt15 * z * (x * x - y * y);
+        c[15] = sqrt5_8 * x * (x * x - 3.0f * y * y);
+    }
+    return c;
+}
+
+int degree(int acn) { return static_cast<int>(std::sqrt(static_cast<float>(acn))); }
+
+// Converts from audeo's world space (x right, y up, -z forward) to ambisonic
+// coordinates (x forward, y left, z up)
+vec3f to_ambisonic(vec3f v) { return {-v.z, -v.x, v.y}; }
+
+vec3f rotate(float const (&matrix)[3][3], vec3f v) {
+    return {matrix[0][0] * v.x + matrix[0][1] * v.y + matrix[0][2] * v.z,
+            matrix[1][0] * v.x + matrix[1][1] * v.y + matrix[1][2] * v.z,
+            matrix[2][0] * v.x + matrix[2][1] * v.y + matrix[2][2] * v.z};
+}
+
+// Evenly distributes points on the unit sphere
+std::vector<vec3f> fibonacci_sphere(int count) {
+    std::vector<vec3f> points(count);
+    double const golden_angle = pi * (3.0 - std::sqrt(5.0));
+    for (int i = 0; i < count; ++i) {
+        double const z = 1.0 - 2.0 * (i + 0.5) / count;
+        double const r = std::sqrt(1.0 - z * z);
+        double const phi = golden_angle * i;
+        points[i] = {static_cast<float>(r * std::cos(phi)), static_cast<float>(r * std::sin(phi)),
+                     static_cast<float>(z)};
+    }
+    return points;
+}
+
+// Inverts a square row major matrix in place using Gauss-Jordan elimination
+void invert(std::vector<double>& m, int n) {
+    std::vector<double> inverse(n * n, 0.0);
+    for (int i = 0; i < n; ++i) { inverse[i * n + i] = 1.0; }
+    for (int col = 0; col < n; ++col) {
+        int pivot = col;
+        for (int row = col + 1; row < n; ++row) {
+            if (std::abs(m[row * n + col]) > std::abs(m[pivot * n + col]))
+                pivot = row;
+        }
+        for (int k = 0; k < n; ++k) {
+            std::swap(m[col * n + k], m[pivot * n + k]);
+            std::swap(inverse[col * n + k], inverse[pivot * n + k]);
+        }
+        double const scale = 1.0 / m[col * n + col];
+        for (int k = 0; k < n; ++k) {
+            m[col * n + k] *= scale;
+            inverse[col * n + k] *= scale;
+        }
+        for (int row = 0; row < n; ++row) {
+            if (row == col)
+                continue;
+            double const factor = m[row * n + col];
+            for (int k = 0; k < n; ++k) {
+                m[row * n + k] -= factor * m[col * n + k];
+                inverse[row * n + k] -= factor * inverse[col * n + k];
+            }
+        }
+    }
+    m = std::move(inverse);
+}
+
+std::vector<vec3f> speaker_layout(AmbisonicOrder order) {
+    std::vector<vec3f> layout;
+    // Cube corners resolve a first order bus. For third order, add the face
+    // centers and edge midpoints
+    for (int x = -1; x <= 1; ++x) {
+        for (int y = -1; y <= 1; ++y) {
+            for (int z = -1; z <= 1; ++z) {
+                int const nonzero = (x != 0) + (y != 0) + (z != 0);
+                if (nonzero == 3 || (order == AmbisonicOrder::Third && nonzero > 0)) {
+                    layout.push_back(normalize(vec3f {static_cast<float>(x), static_cast<float>(y),
+                                                      static_cast<float>(z)}));
+                }
+            }
+        }
+    }
+    return layout;
+}
+
+} // namespace
+
+int ambisonic_channel_count(AmbisonicOrder order) {
+    int const n = static_cast<int>(order) + 1;
+    return n * n;
+}
+
+AmbisonicCoefficients encode_direction(vec3f direction, AmbisonicOrder order) {
+    float const length = magnitude(direction);
+    if (length < 1e-6f) {
+        // A sound at the listener position has no direction
+        AmbisonicCoefficients omni {};
+        omni[0] = 1.0f;
+        return omni;
+    }
+    return spherical_harmonics(to_ambisonic(direction * (1.0f / length)),
+                               ambisonic_channel_count(order));
+}
+
+AmbisonicBus::AmbisonicBus(AmbisonicOrder order, int capacity_frames, unsigned int generation) :
+    bus_order(order),
+    channels(ambisonic_channel_count(order)),
+    capacity_frames(capacity_frames),
+    generation(generation),
+    data(channels * capacity_frames, 0.0f),
+    rotation(channels * channels, 0.0f),
+    rotated_block(channels * hrtf_max_block_frames),
+    speaker_block(2 * hrtf_max_block_frames) {
+
+    for (int c = 0; c < channels; ++c) { rotation[c * channels + c] = 1.0f; }
+
+    // Rotating spherical harmonics is linear, so the rotation matrix M satisfies
+    // M * Y = Y_rotated for any set of points, where Y holds the harmonics of
+    // every point as a column. We solve this in the least squares sense:
+    // M = Y_rotated * Y^T * (Y * Y^T)^-1. Everything but Y_rotated can be
+    // computed once, here
+    fit_points = fibonacci_sphere(fit_point_count);
+    std::vector<double> gram(channels * channels, 0.0);
+    std::vector<AmbisonicCoefficients> harmonics;
+    for (vec3f const& p : fit_points) { harmonics.push_back(spherical_harmonics(p, channels)); }
+    for (int i = 0; i < channels; ++i) {
+        for (int j = 0; j < channels; ++j) {
+            for (auto const& h : harmonics) { gram[i * channels + j] += h[i] * h[j]; }
+        }
+    }
+    invert(gram, channels);
+    fit_inverse.resize(fit_point_count * channels);
+    for (int k = 0; k < fit_point_count; ++k) {
+        for (int j = 0; j < channels; ++j) {
+            double sum = 0.0;
+            for (int i = 0; i < channels; ++i) { sum += harmonics[k][i] * gram[i * channels + j]; }
+            fit_inverse[k * channels + j] = static_cast<float>(sum);
+        }
+    }
+
+    // Basic sampling decoder. The (2l + 1) factor converts SN3D to N3D
+    speakers = speaker_layout(order);
+    int const speaker_count = static_cast<int>(speakers.size());
+    speaker_decode.resize(speaker_count * channels);
+    stereo_decode.assign(2 * channels, 0.0f);
+    speaker_hrtf.resize(speaker_count);
+    for (int s = 0; s < speaker_count; ++s) {
+        AmbisonicCoefficients const h = spherical_harmonics(speakers[s], channels);
+        // Constant power panning of the virtual speaker, y points left
+        float const left = std::sqrt(0.5f * (1.0f + speakers[s].y));
+        float const right = std::sqrt(0.5f * (1.0f - speakers[s].y));
+        for (int c = 0; c < channels; ++c) {
+            float const gain = (2 * degree(c) + 1) * h[c] / speaker_count;
+            speaker_decode[s * channels + c] = gain;
+            stereo_decode[c] += left * gain;
+            stereo_decode[channels + c] += right * gain;
+        }
+    }
+}
+
+void AmbisonicBus::encode(AmbisonicVoice& voice, float const* mono, int frames) {
+    if (voice.generation != generation) {
+        voice.generation = generation;
+        voice.offset = 0;
+    }
+    frames = std::min(frames, capacity_frames - voice.offset);
+    if (frames <= 0) {
+        return;
+    }
+
+    for (int c = 0; c < channels; ++c) {
+        float const from = voice.previous_coefficients[c];
+        float const delta = (voice.coefficients[c] - from) / frames;
+        float* out = data.data() + c * capacity_frames + voice.offset;
+        for (int n = 0; n < frames; ++n) { out[n] += mono[n] * (from + delta * (n + 1)); }
+    }
+    voice.previous_coefficients = voice.coefficients;
+    voice.offset += frames;
+}
+
+void AmbisonicBus::set_listener_orientation(vec3f forward, vec3f right, vec3f up) {
+    // Rows are the listener axes in ambisonic coordinates, so this maps world
+    // directions to listener relative directions
+    vec3f const f = to_ambisonic(forward);
+    vec3f const l = to_ambisonic(right) * -1.0f;
+    vec3f const u = to_ambisonic(up);
+    float const matrix[3][3] = {{f.x, f.y, f.z}, {l.x, l.y, l.z}, {u.x, u.y, u.z}};
+
+    std::vector<AmbisonicCoefficients> rotated;
+    for (vec3f const& p : fit_points) {
+        rotated.push_back(spherical_harmonics(rotate(matrix, p), channels));
+    }
+    for (int i = 0; i < channels; ++i) {
+        for (int j = 0; j < channels; ++j) {
+            float sum = 0.0f;
+            for (int k = 0; k < fit_point_count; ++k) {
+                sum += rotated[k][i] * fit_inverse[k * channels + j];
+            }
+            rotation[i * channels + j] = sum;
+        }
+    }
+}
+
+void AmbisonicBus::set_hrtf(HrtfSet* hrtf) {
+    binaural = hrtf;
+    for (std::size_t s = 0; s < speakers.size(); ++s) {
+        speaker_hrtf[s] = HrtfVoice {};
+        if (!hrtf) {
+            continue;
+        }
+        vec3f const& p = speakers[s];
+        // HRTF azimuth is clockwise, ambisonic y points left
+        float const azimuth = static_cast<float>(std::atan2(-p.y, p.x) * 180.0 / pi);
+        float const elevation =
+            static_cast<float>(std::atan2(p.z, std::sqrt(p.x * p.x + p.y * p.y)) * 180.0 / pi);
+        speaker_hrtf[s].enabled = true;
+        speaker_hrtf[s].current = hrtf->filter(azimuth, elevation);
+    }
+}
+
+void AmbisonicBus::decode(int offset, int frames, float* out) {
+    frames = std::min(frames, capacity_frames - offset);
+    if (frames <= 0) {
+        return;
+    }
+    for (int i = 0; i < channels; ++i) {
+        float* dst = rotated_block.data() + i * frames;
+        std::fill_n(dst, frames, 0.0f);
+        for (int j = 0; j < channels; ++j) {
+            float const m = rotation[i * channels + j];
+            if (m == 0.0f)
+                continue;
+            float const* src = data.data() + j * capacity_frames + offset;
+            for (int n = 0; n < frames; ++n) { dst[n] += m * src[n]; }
+        }
+    }
+
+    if (!binaural) {
+        for (int n = 0; n < frames; ++n) {
+            float left = 0.0f;
+            float right = 0.0f;
+            for (int c = 0; c < channels; ++c) {
+                float const sample = rotated_block[c * frames + n];
+                left += stereo_decode[c] * sample;
+                right += stereo_decode[channels + c] * sample;
+            }
+            out[2 * n] += left;
+            out[2 * n + 1] += right;
+        }
+        return;
+    }
+
+    for (std::size_t s = 0; s < speakers.size(); ++s) {
+        float const* gains = speaker_decode.data() + s * channels;
+        for (int n = 0; n < frames; ++n) {
+            float sample = 0.0f;
+            for (int c = 0; c < channels; ++c) {
+                sample += gains[c] * rotated_block[c * frames + n];
+            }
+            speaker_block[2 * n] = sample;
+            speaker_block[2 * n + 1] = sample;
+        }
+        hrtf_process(speaker_hrtf[s], binaural->length(), speaker_block.data(), frames,
+                     speaker_work);
+        for (int n = 0; n < 2 * frames; ++n) { out[n] += speaker_block[n]; }
+    }
+}
+
+void AmbisonicBus::next_callback() {
+    std::fill(data.begin(), data.end(), 0.0f);
+    ++generation;
+}
+
+} // namespace audeo::detail
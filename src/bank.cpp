@@ -0,0 +1,181 @@
+#include "audeo/bank.hpp"
+
+#ifdef _WIN32
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+
+namespace audeo::detail {
+
+namespace {
+
+std::uint64_t align(std::uint64_t offset) {
+    return (offset + bank_alignment - 1) / bank_alignment * bank_alignment;
+}
+
+} // namespace
+
+BankFile::~BankFile() {
+#ifdef _WIN32
+    if (mapping) {
+        UnmapViewOfFile(mapping);
+    }
+    if (mapping_handle) {
+        CloseHandle(mapping_handle);
+    }
+    if (file_handle) {
+        CloseHandle(file_handle);
+    }
+#else
+    if (mapping) {
+        munmap(const_cast<std::uint8_t*>(mapping), mapping_size);
+    }
+#endif
+}
+
+bool BankFile::open(std::string_view path) {
+    std::string const file_name(path);
+#ifdef _WIN32
+    HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    file_handle = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        return false;
+    }
+    mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping_handle) {
+        return false;
+    }
+    mapping = static_cast<std::uint8_t const*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (!mapping) {
+        return false;
+    }
+    mapping_size = static_cast<std::size_t>(size.QuadPart);
+#else
+    int const file = ::open(file_name.c_str(), O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        ::close(file);
+        return false;
+    }
+    void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    // The mapping keeps the file alive on its own
+    ::close(file);
+    if (address == MAP_FAILED) {
+        return false;
+    }
+    mapping = static_cast<std::uint8_t const*>(address);
+    mapping_size = static_cast<std::size_t>(info.st_size);
+#endif
+    return validate();
+}
+
+bool BankFile::validate() const {
+    if (mapping_size < sizeof(BankHeader)) {
+        return false;
+    }
+    BankHeader const& bank = header();
+    if (std::memcmp(bank.magic, bank_magic, sizeof(bank_magic)) != 0 || bank.version != bank_version) {
+        return false;
+    }
+    // The offsets and sizes come from the file, so every check subtracts from
+    // the mapping size instead of adding them up, which could wrap around
+    if (bank.entries_offset % alignof(BankEntry) != 0 || bank.entries_offset > mapping_size ||
+        bank.sound_count > (mapping_size - bank.entries_offset) / sizeof(BankEntry) ||
+        bank.names_offset > mapping_size) {
+        return false;
+    }
+    std::uint64_t const names_size = mapping_size - bank.names_offset;
+    for (std::size_t i = 0; i < bank.sound_count; ++i) {
+        BankEntry const& sound = entry(i);
+        if (sound.data_offset > mapping_size ||
+            sound.data_size > mapping_size - sound.data_offset ||
+            sound.name_offset > names_size || sound.name_size > names_size - sound.name_offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+BankHeader const& BankFile::header() const { return *reinterpret_cast<BankHeader const*>(mapping); }
+
+BankEntry const& BankFile::entry(std::size_t index) const {
+    return reinterpret_cast<BankEntry const*>(mapping + header().entries_offset)[index];
+}
+
+std::string_view BankFile::name(std::size_t index) const {
+    BankEntry const& sound = entry(index);
+    return {reinterpret_cast<char const*>(mapping + header().names_offset + sound.name_offset),
+            sound.name_size};
+}
+
+std::uint8_t const* BankFile::data(std::size_t index) const { return mapping + entry(index).data_offset; }
+
+bool write_bank(std::string_view path,
+                std::uint32_t frequency,
+                std::uint32_t format,
+                std::uint32_t channels,
+                std::vector<BankSound> const& sounds) {
+    BankHeader header {};
+    std::memcpy(header.magic, bank_magic, sizeof(bank_magic));
+    header.version = bank_version;
+    header.frequency = frequency;
+    header.format = format;
+    header.channels = channels;
+    header.sound_count = static_cast<std::uint32_t>(sounds.size());
+    header.entries_offset = sizeof(BankHeader);
+    header.names_offset = header.entries_offset + sounds.size() * sizeof(BankEntry);
+
+    std::string names;
+    std::vector<BankEntry> entries(sounds.size());
+    for (std::size_t i = 0; i < sounds.size(); ++i) {
+        entries[i].name_offset = static_cast<std::uint32_t>(names.size());
+        entries[i].name_size = static_cast<std::uint32_t>(sounds[i].name.size());
+        names += sounds[i].name;
+    }
+
+    std::uint64_t offset = align(header.names_offset + names.size());
+    for (std::size_t i = 0; i < sounds.size(); ++i) {
+        entries[i].data_offset = offset;
+        entries[i].data_size = sounds[i].data.size();
+        entries[i].frame_count = sounds[i].frame_count;
+        entries[i].encoding = sounds[i].encoding;
+        entries[i].reserved = 0;
+        offset = align(offset + sounds[i].data.size());
+    }
+
+    std::FILE* file = std::fopen(std::string(path).c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && std::fwrite(entries.data(), sizeof(BankEntry), entries.size(), file) == entries.size();
+    ok = ok && std::fwrite(names.data(), 1, names.size(), file) == names.size();
+    std::uint64_t written = header.names_offset + names.size();
+    std::vector<std::uint8_t> const padding(bank_alignment, 0);
+    for (std::size_t i = 0; ok && i < sounds.size(); ++i) {
+        std::size_t const gap = static_cast<std::size_t>(entries[i].data_offset - written);
+        ok = std::fwrite(padding.data(), 1, gap, file) == gap;
+        ok = ok && std::fwrite(sounds[i].data.data(), 1, sounds[i].data.size(), file) ==
+                       sounds[i].data.size();
+        written = entries[i].data_offset + sounds[i].data.size();
+    }
+    return std::fclose(file) == 0 && ok;
+}
+
+} // namespace audeo::detail
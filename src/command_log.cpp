@@ -0,0 +1,493 @@
+#include "audeo/command_log.hpp"
+#include "audeo/OfflineRender.hpp"
+#include "audeo/SoundSource.hpp"
+#include "audeo/exception.hpp"
+
+#include <cstring>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace audeo {
+
+namespace {
+
+constexpr char log_magic[8] = {'A', 'U', 'D', 'E', 'O', 'L', 'O', 'G'};
+constexpr std::uint64_t log_version = 2;
+
+// Reads the encoding CommandLog writes. Reading past the end sets failed and
+// returns zeroes
+struct LogReader {
+    std::vector<std::uint8_t> data;
+    std::size_t offset = 0;
+    bool failed = false;
+
+    std::uint64_t read_uint() {
+        std::uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (offset >= data.size()) {
+                failed = true;
+                return 0;
+            }
+            std::uint8_t const byte = data[offset++];
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        failed = true;
+        return 0;
+    }
+
+    std::int64_t read_int() {
+        // Zigzag encoded, so small negative values stay short
+        std::uint64_t const value = read_uint();
+        return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+    }
+
+    float read_float() {
+        if (data.size() - offset < 4) {
+            failed = true;
+            offset = data.size();
+            return 0.0f;
+        }
+        std::uint32_t bits = 0;
+        for (int i = 0; i < 4; ++i) {
+            bits |= static_cast<std::uint32_t>(data[offset++]) << (8 * i);
+        }
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    vec3f read_vector() {
+        vec3f value;
+        value.x = read_float();
+        value.y = read_float();
+        value.z = read_float();
+        return value;
+    }
+
+    std::string read_string() {
+        auto const size = static_cast<std::uint64_t>(read_int());
+        if (failed || data.size() - offset < size) {
+            failed = true;
+            offset = data.size();
+            return {};
+        }
+        std::string value(reinterpret_cast<char const*>(&data[offset]), size);
+        offset += size;
+        return value;
+    }
+};
+
+bool read_file(std::string_view path, std::vector<std::uint8_t>& data) {
+    std::FILE* file = std::fopen(std::string(path).c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    std::uint8_t buffer[4096];
+    std::size_t read;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + read);
+    }
+    std::fclose(file);
+    return true;
+}
+
+} // namespace
+
+namespace detail {
+
+CommandLog::CommandLog(std::string_view path,
+                       unsigned int frequency,
+                       unsigned int channels,
+                       ResampleQuality resample_quality) {
+    file = std::fopen(std::string(path).c_str(), "wb");
+    if (!file) {
+        return;
+    }
+    std::fwrite(log_magic, 1, sizeof(log_magic), file);
+    write_int(static_cast<std::int64_t>(log_version));
+    write_int(frequency);
+    write_int(channels);
+    write_int(static_cast<std::int64_t>(resample_quality));
+}
+
+CommandLog::~CommandLog() {
+    if (file) {
+        std::fclose(file);
+    }
+}
+
+void CommandLog::begin(LoggedCall call, std::int64_t frame) {
+    std::fputc(static_cast<int>(call), file);
+    // Frames only ever increase, so the delta is never negative
+    write_int(frame - last_frame);
+    last_frame = frame;
+}
+
+void CommandLog::write_int(std::int64_t value) {
+    std::uint64_t zigzag = (static_cast<std::uint64_t>(value) << 1) ^
+                           static_cast<std::uint64_t>(value >> 63);
+    do {
+        std::uint8_t byte = zigzag & 0x7f;
+        zigzag >>= 7;
+        if (zigzag) {
+            byte |= 0x80;
+        }
+        std::fputc(byte, file);
+    } while (zigzag);
+}
+
+void CommandLog::write_float(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 4; ++i) {
+        std::fputc(static_cast<int>((bits >> (8 * i)) & 0xff), file);
+    }
+}
+
+void CommandLog::write_vector(vec3f value) {
+    write_float(value.x);
+    write_float(value.y);
+    write_float(value.z);
+}
+
+void CommandLog::write_string(std::string_view value) {
+    write_int(static_cast<std::int64_t>(value.size()));
+    std::fwrite(value.data(), 1, value.size(), file);
+}
+
+} // namespace detail
+
+bool load_recording(std::string_view path, Scene& scene, OfflineRenderInfo& info) {
+    LogReader log;
+    if (!read_file(path, log.data) || log.data.size() < sizeof(log_magic) ||
+        std::memcmp(log.data.data(), log_magic, sizeof(log_magic)) != 0) {
+        return false;
+    }
+    log.offset = sizeof(log_magic);
+    if (static_cast<std::uint64_t>(log.read_int()) != log_version) {
+        return false;
+    }
+    auto const frequency = static_cast<unsigned int>(log.read_int());
+    auto const channels = static_cast<unsigned int>(log.read_int());
+    auto const resample_quality = static_cast<ResampleQuality>(log.read_int());
+    if (log.failed) {
+        return false;
+    }
+    info.frequency = frequency;
+    info.output_channels = channels;
+    info.resample_quality = resample_quality;
+
+    scene = Scene {};
+    // Scene source of every recorded source. Music sources have none. Changing
+    // the defaults of a source adds a new scene source, so sounds that already
+    // played keep the old defaults. Files are still decoded only once
+    std::unordered_map<std::int64_t, std::optional<std::size_t>> sources;
+    // Scene sound index of every recorded sound that is replayed
+    std::unordered_map<std::int64_t, std::size_t> sounds;
+    std::size_t sound_count = 0;
+    // Scene emitter index of every recorded emitter that is replayed, and of
+    // the emitter that played each recorded emitter sound
+    std::unordered_map<std::int64_t, std::size_t> emitters;
+    std::unordered_map<std::int64_t, std::size_t> emitter_sounds;
+    std::size_t emitter_count = 0;
+    std::int64_t frame = 0;
+
+    auto change_default = [&scene, &sources](std::int64_t source, auto const& change) {
+        auto it = sources.find(source);
+        if (it == sources.end() || !it->second) {
+            return;
+        }
+        SceneSource changed = scene.sources[*it->second];
+        change(changed);
+        it->second = scene.sources.size();
+        scene.sources.push_back(std::move(changed));
+    };
+    auto add_command = [&](SceneCommandType type, std::int64_t sound) {
+        SceneCommand command;
+        command.type = type;
+        command.frame = frame;
+        if (auto it = sounds.find(sound); it != sounds.end()) {
+            command.sound = it->second;
+        } else if (auto played = emitter_sounds.find(sound); played != emitter_sounds.end()) {
+            command.sound = emitter_sound;
+            command.emitter = played->second;
+        } else {
+            // The sound is music, or wasn't recorded
+            return static_cast<SceneCommand*>(nullptr);
+        }
+        return &scene.commands.emplace_back(command);
+    };
+    auto add_emitter_command = [&](SceneCommandType type, std::int64_t emitter) {
+        auto it = emitters.find(emitter);
+        if (it == emitters.end()) {
+            return static_cast<SceneCommand*>(nullptr);
+        }
+        SceneCommand& command = scene.commands.emplace_back();
+        command.type = type;
+        command.frame = frame;
+        command.emitter = it->second;
+        return &command;
+    };
+    auto add_global_command = [&](SceneCommandType type) -> SceneCommand& {
+        SceneCommand& command = scene.commands.emplace_back();
+        command.type = type;
+        command.frame = frame;
+        return command;
+    };
+
+    while (!log.failed && log.offset < log.data.size()) {
+        auto const call = static_cast<detail::LoggedCall>(log.data[log.offset++]);
+        std::int64_t const delta = log.read_int();
+        frame += delta;
+        // Only complete calls are replayed, so remember where this one started
+        std::size_t const command_count = scene.commands.size();
+        std::size_t const source_count = scene.sources.size();
+        switch (call) {
+            case detail::LoggedCall::LoadSource: {
+                std::int64_t const source = log.read_int();
+                auto const type = static_cast<AudioType>(log.read_int());
+                auto const compression = static_cast<SourceCompression>(log.read_int());
+                std::string file = log.read_string();
+                if (type == AudioType::Music) {
+                    sources[source] = std::nullopt;
+                } else {
+                    sources[source] = scene.sources.size();
+                    SceneSource& scene_source = scene.sources.emplace_back();
+                    scene_source.path = std::move(file);
+                    // Streams keep no samples in memory, so they are never
+                    // compressed
+                    if (type == AudioType::Effect) {
+                        scene_source.compression = compression;
+                    }
+                }
+                break;
+            }
+            case detail::LoggedCall::SetDefaultVolume: {
+                std::int64_t const source = log.read_int();
+                float const volume = log.read_float();
+                change_default(source, [volume](SceneSource& s) { s.volume = volume; });
+                break;
+            }
+            case detail::LoggedCall::SetDefaultPosition: {
+                std::int64_t const source = log.read_int();
+                vec3f const position = log.read_vector();
+                change_default(source, [position](SceneSource& s) { s.position = position; });
+                break;
+            }
+            case detail::LoggedCall::SetDefaultDistanceRangeMax: {
+                std::int64_t const source = log.read_int();
+                float const distance = log.read_float();
+                change_default(source,
+                               [distance](SceneSource& s) { s.distance_range_max = distance; });
+                break;
+            }
+            case detail::LoggedCall::SetDefaultMaxInstances: {
+                std::int64_t const source = log.read_int();
+                auto const count = static_cast<unsigned int>(log.read_int());
+                auto const behavior = static_cast<InstanceLimitBehavior>(log.read_int());
+                change_default(source, [count, behavior](SceneSource& s) {
+                    s.max_instances = count;
+                    s.limit_behavior = behavior;
+                });
+                break;
+            }
+            case detail::LoggedCall::SetDefaultMinRetriggerInterval: {
+                std::int64_t const source = log.read_int();
+                int const interval_ms = static_cast<int>(log.read_int());
+                change_default(source, [interval_ms](SceneSource& s) {
+                    s.min_retrigger_interval_ms = interval_ms;
+                });
+                break;
+            }
+            case detail::LoggedCall::PlaySound: {
+                std::int64_t const sound = log.read_int();
+                std::int64_t const source = log.read_int();
+                int const loop_count = static_cast<int>(log.read_int());
+                int const fade_in_ms = static_cast<int>(log.read_int());
+                auto it = sources.find(source);
+                if (it == sources.end() || !it->second) {
+                    break;
+                }
+                SceneCommand command;
+                command.type = SceneCommandType::Play;
+                command.frame = frame;
+                command.source = *it->second;
+                command.loop_count = loop_count;
+                command.fade_ms = fade_in_ms;
+                scene.commands.push_back(command);
+                sounds[sound] = sound_count++;
+                break;
+            }
+            case detail::LoggedCall::PauseSound:
+            case detail::LoggedCall::ResumeSound: {
+                std::int64_t const sound = log.read_int();
+                add_command(call == detail::LoggedCall::PauseSound ? SceneCommandType::Pause
+                                                                   : SceneCommandType::Resume,
+                            sound);
+                break;
+            }
+            case detail::LoggedCall::StopSound: {
+                std::int64_t const sound = log.read_int();
+                int const fade_out_ms = static_cast<int>(log.read_int());
+                if (SceneCommand* command = add_command(SceneCommandType::Stop, sound)) {
+                    command->fade_ms = fade_out_ms;
+                }
+                break;
+            }
+            case detail::LoggedCall::SetVolume:
+            case detail::LoggedCall::SetDistanceRangeMax:
+            case detail::LoggedCall::SetPitch: {
+                std::int64_t const sound = log.read_int();
+                float const value = log.read_float();
+                SceneCommandType type = SceneCommandType::SetDistanceRangeMax;
+                if (call == detail::LoggedCall::SetVolume) {
+                    type = SceneCommandType::SetVolume;
+                } else if (call == detail::LoggedCall::SetPitch) {
+                    type = SceneCommandType::SetPitch;
+                }
+                if (SceneCommand* command = add_command(type, sound)) {
+                    command->value = value;
+                }
+                break;
+            }
+            case detail::LoggedCall::SetPosition: {
+                std::int64_t const sound = log.read_int();
+                vec3f const position = log.read_vector();
+                if (SceneCommand* command = add_command(SceneCommandType::SetPosition, sound)) {
+                    command->vector = position;
+                }
+                break;
+            }
+            case detail::LoggedCall::SetResampleQuality: {
+                std::int64_t const sound = log.read_int();
+                auto const quality = static_cast<ResampleQuality>(log.read_int());
+                SceneCommand* command = add_command(SceneCommandType::SetResampleQuality, sound);
+                if (command) {
+                    command->quality = quality;
+                }
+                break;
+            }
+            case detail::LoggedCall::ReverseStereo: {
+                std::int64_t const sound = log.read_int();
+                bool const reverse = log.read_int() != 0;
+                if (SceneCommand* command = add_command(SceneCommandType::ReverseStereo, sound)) {
+                    command->value = reverse ? 1.0f : 0.0f;
+                }
+                break;
+            }
+            case detail::LoggedCall::AddEffect: {
+                std::int64_t const sound = log.read_int();
+                auto const effect = static_cast<Effect>(log.read_int());
+                if (SceneCommand* command = add_command(SceneCommandType::AddEffect, sound)) {
+                    command->effect = effect;
+                }
+                break;
+            }
+            case detail::LoggedCall::SetListenerPosition:
+            case detail::LoggedCall::SetListenerForward: {
+                std::int64_t const listener = log.read_int();
+                vec3f const vector = log.read_vector();
+                SceneCommand& command = add_global_command(
+                    call == detail::LoggedCall::SetListenerPosition
+                        ? SceneCommandType::SetListenerPosition
+                        : SceneCommandType::SetListenerForward);
+                command.listener = static_cast<std::size_t>(listener);
+                command.vector = vector;
+                break;
+            }
+            case detail::LoggedCall::SetListenerCount: {
+                std::int64_t const count = log.read_int();
+                add_global_command(SceneCommandType::SetListenerCount).listener =
+                    static_cast<std::size_t>(count);
+                break;
+            }
+            case detail::LoggedCall::CreateEmitter: {
+                std::int64_t const emitter = log.read_int();
+                std::int64_t const source = log.read_int();
+                vec3f const position = log.read_vector();
+                auto it = sources.find(source);
+                if (it == sources.end() || !it->second) {
+                    break;
+                }
+                SceneCommand& command = add_global_command(SceneCommandType::CreateEmitter);
+                command.source = *it->second;
+                command.vector = position;
+                emitters[emitter] = emitter_count++;
+                break;
+            }
+            case detail::LoggedCall::DestroyEmitter: {
+                std::int64_t const emitter = log.read_int();
+                add_emitter_command(SceneCommandType::DestroyEmitter, emitter);
+                break;
+            }
+            case detail::LoggedCall::SetEmitterPosition: {
+                std::int64_t const emitter = log.read_int();
+                vec3f const position = log.read_vector();
+                if (SceneCommand* command =
+                        add_emitter_command(SceneCommandType::SetEmitterPosition, emitter)) {
+                    command->vector = position;
+                }
+                break;
+            }
+            case detail::LoggedCall::UpdateEmitters:
+                add_global_command(SceneCommandType::UpdateEmitters);
+                break;
+            case detail::LoggedCall::EmitterSound: {
+                std::int64_t const emitter = log.read_int();
+                std::int64_t const sound = log.read_int();
+                if (auto it = emitters.find(emitter); it != emitters.end()) {
+                    emitter_sounds[sound] = it->second;
+                }
+                break;
+            }
+            case detail::LoggedCall::LoadHrtf: {
+                std::string directory = log.read_string();
+                add_global_command(SceneCommandType::LoadHrtf).path = std::move(directory);
+                break;
+            }
+            case detail::LoggedCall::UnloadHrtf:
+                add_global_command(SceneCommandType::UnloadHrtf);
+                break;
+            case detail::LoggedCall::EnableAmbisonics: {
+                auto const order = static_cast<AmbisonicOrder>(log.read_int());
+                add_global_command(SceneCommandType::EnableAmbisonics).order = order;
+                break;
+            }
+            case detail::LoggedCall::DisableAmbisonics:
+                add_global_command(SceneCommandType::DisableAmbisonics);
+                break;
+            case detail::LoggedCall::LoadBank:
+                AUDEO_THROW(audeo::exception(
+                    "Audeo: The recording uses a sound bank, which can't be replayed"));
+                return false;
+            case detail::LoggedCall::SetOcclusionQuery:
+                AUDEO_THROW(audeo::exception(
+                    "Audeo: The recording uses an occlusion query, which can't be replayed"));
+                return false;
+            case detail::LoggedCall::End: break;
+            default:
+                // Written by a newer version. Its arguments can't be skipped
+                log.failed = true;
+                break;
+        }
+        if (log.failed) {
+            // Drop the truncated call
+            scene.commands.resize(command_count);
+            scene.sources.resize(source_count);
+            frame -= delta;
+            break;
+        }
+        if (call == detail::LoggedCall::End) {
+            break;
+        }
+    }
+    scene.frame_count = frame;
+    return true;
+}
+
+} // namespace audeo
@@ -1,4 +1,5 @@
 #include "audeo/effects.hpp"
+#include "audeo/trace.hpp"
 
 #include <SDL_mixer.h>
 
@@ -8,6 +9,7 @@
 namespace audeo {
 
 void echo_callback(int channel, void* stream, int length, void* user_data) {
+    AUDEO_TRACE_SCOPE("echo_callback");
     auto* data = reinterpret_cast<std::int16_t*>(stream);
     int bufsize = length / sizeof(std::int16_t);
 
@@ -0,0 +1,98 @@
+#include "audeo/emitter_grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace audeo::detail {
+
+EmitterGrid::CellKey EmitterGrid::key(int x, int y, int z) const {
+    // 21 bits per axis, which is plenty for any sensible cell size
+    constexpr std::int64_t mask = (1 << 21) - 1;
+    return ((static_cast<std::int64_t>(x) & mask) << 42) |
+           ((static_cast<std::int64_t>(y) & mask) << 21) | (static_cast<std::int64_t>(z) & mask);
+}
+
+void EmitterGrid::coordinates(CellKey cell, int& x, int& y, int& z) const {
+    // Sign extend every 21 bit field
+    auto field = [cell](int shift) {
+        std::int64_t value = (cell >> shift) & ((1 << 21) - 1);
+        return static_cast<int>(value >= (1 << 20) ? value - (1 << 21) : value);
+    };
+    x = field(42);
+    y = field(21);
+    z = field(0);
+}
+
+int EmitterGrid::cell_coordinate(float value) const {
+    return static_cast<int>(std::floor(value / cell_size));
+}
+
+EmitterGrid::CellKey EmitterGrid::key_for(vec3f position) const {
+    return key(cell_coordinate(position.x), cell_coordinate(position.y),
+               cell_coordinate(position.z));
+}
+
+void EmitterGrid::insert(Emitter emitter, vec3f position) {
+    cells[key_for(position)].push_back(emitter);
+}
+
+void EmitterGrid::remove(Emitter emitter, vec3f position) {
+    auto it = cells.find(key_for(position));
+    if (it == cells.end()) {
+        return;
+    }
+    auto& cell = it->second;
+    if (auto pos = std::find(cell.begin(), cell.end(), emitter); pos != cell.end()) {
+        // Order inside a cell doesn't matter
+        *pos = cell.back();
+        cell.pop_back();
+    }
+    if (cell.empty()) {
+        cells.erase(it);
+    }
+}
+
+void EmitterGrid::move(Emitter emitter, vec3f from, vec3f to) {
+    if (key_for(from) == key_for(to)) {
+        return;
+    }
+    remove(emitter, from);
+    insert(emitter, to);
+}
+
+void EmitterGrid::query(vec3f center, float radius, std::vector<Emitter>& out) const {
+    int const min_x = cell_coordinate(center.x - radius);
+    int const max_x = cell_coordinate(center.x + radius);
+    int const min_y = cell_coordinate(center.y - radius);
+    int const max_y = cell_coordinate(center.y + radius);
+    int const min_z = cell_coordinate(center.z - radius);
+    int const max_z = cell_coordinate(center.z + radius);
+
+    // When the query box spans more cells than are occupied, walking the
+    // occupied cells is cheaper
+    auto const box_cells = static_cast<std::int64_t>(max_x - min_x + 1) * (max_y - min_y + 1) *
+                           (max_z - min_z + 1);
+    if (box_cells > static_cast<std::int64_t>(cells.size())) {
+        for (auto const& [cell_key, emitters] : cells) {
+            int x, y, z;
+            coordinates(cell_key, x, y, z);
+            if (x >= min_x && x <= max_x && y >= min_y && y <= max_y && z >= min_z &&
+                z <= max_z) {
+                out.insert(out.end(), emitters.begin(), emitters.end());
+            }
+        }
+        return;
+    }
+
+    for (int x = min_x; x <= max_x; ++x) {
+        for (int y = min_y; y <= max_y; ++y) {
+            for (int z = min_z; z <= max_z; ++z) {
+                if (auto it = cells.find(key(x, y, z)); it != cells.end()) {
+                    out.insert(out.end(), it->second.begin(), it->second.end());
+                }
+            }
+        }
+    }
+}
+
+} // namespace audeo::detail
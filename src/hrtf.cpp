@@ -0,0 +1,262 @@
+#include "audeo/hrtf.hpp"
+#include "audeo/exception.hpp"
+#include "audeo/resampler.hpp"
+
+#include <SDL.h>
+#include <SDL_audio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+namespace audeo::detail {
+
+namespace {
+
+// Directions are quantized to this grid before looking up a filter
+constexpr float azimuth_quantum = 3.0f;
+constexpr float elevation_quantum = 5.0f;
+
+bool parse_kemar_name(std::string const& name, int& elevation, int& azimuth) {
+    char a = 0;
+    int consumed = 0;
+    if (std::sscanf(name.c_str(), "H%de%d%c.wav%n", &elevation, &azimuth, &a, &consumed) != 3) {
+        return false;
+    }
+    return a == 'a' && consumed == static_cast<int>(name.size());
+}
+
+// Loads a WAV file as two deinterleaved float channels at the file's frequency
+bool load_stereo_wav(std::string const& path,
+                     std::vector<float>& left,
+                     std::vector<float>& right,
+                     int& frequency) {
+    SDL_AudioSpec spec;
+    Uint8* buffer = nullptr;
+    Uint32 length = 0;
+    if (!SDL_LoadWAV(path.c_str(), &spec, &buffer, &length)) {
+        return false;
+    }
+
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, AUDIO_F32SYS, 2,
+                          spec.freq) < 0) {
+        SDL_FreeWAV(buffer);
+        return false;
+    }
+    std::vector<Uint8> converted(length * cvt.len_mult);
+    std::memcpy(converted.data(), buffer, length);
+    SDL_FreeWAV(buffer);
+    cvt.len = static_cast<int>(length);
+    cvt.buf = converted.data();
+    if (SDL_ConvertAudio(&cvt) < 0) {
+        return false;
+    }
+
+    std::size_t const frames = cvt.len_cvt / (2 * sizeof(float));
+    auto const* samples = reinterpret_cast<float const*>(converted.data());
+    left.resize(frames);
+    right.resize(frames);
+    for (std::size_t i = 0; i < frames; ++i) {
+        left[i] = samples[2 * i];
+        right[i] = samples[2 * i + 1];
+    }
+    frequency = spec.freq;
+    return true;
+}
+
+std::vector<float> resample_hrir(std::vector<float> const& hrir, int from, int to) {
+    if (from == to) {
+        return hrir;
+    }
+    double const step = static_cast<double>(from) / to;
+    auto const out_frames = static_cast<std::size_t>(hrir.size() / step);
+    std::vector<float> padded(hrir.size() + resample_padding_before + resample_padding_after + 1);
+    std::copy(hrir.begin(), hrir.end(), padded.begin() + resample_padding_before);
+    std::vector<float> out(out_frames);
+    resample(padded.data(), 1, 0.0, step, ResampleQuality::Sinc, out.data(), out_frames);
+    // Downsampling an impulse response spreads its energy over less samples
+    for (float& sample : out) { sample *= static_cast<float>(step); }
+    return out;
+}
+
+} // namespace
+
+bool HrtfSet::load(std::string_view directory, int device_frequency) {
+    rings.clear();
+    cache.clear();
+    hrir_length = 0;
+
+    std::error_code error;
+    std::filesystem::recursive_directory_iterator it(std::filesystem::path(directory), error);
+    if (error) {
+        AUDEO_THROW(audeo::exception("Audeo: Could not open HRTF directory"));
+        return false;
+    }
+
+    for (auto const& entry : it) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        int elevation = 0;
+        int azimuth = 0;
+        if (!parse_kemar_name(entry.path().filename().string(), elevation, azimuth)) {
+            continue;
+        }
+
+        Measurement measurement;
+        measurement.azimuth = static_cast<float>(((azimuth % 360) + 360) % 360);
+        int frequency = 0;
+        if (!load_stereo_wav(entry.path().string(), measurement.left, measurement.right,
+                             frequency)) {
+            AUDEO_THROW(audeo::exception("Audeo: Failed to load HRIR file"));
+            return false;
+        }
+        measurement.left = resample_hrir(measurement.left, frequency, device_frequency);
+        measurement.right = resample_hrir(measurement.right, frequency, device_frequency);
+        hrir_length = std::max(hrir_length, static_cast<int>(measurement.left.size()));
+
+        auto ring = std::find_if(rings.begin(), rings.end(), [elevation](Ring const& r) {
+            return r.elevation == elevation;
+        });
+        if (ring == rings.end()) {
+            rings.push_back(Ring {static_cast<float>(elevation), {}});
+            ring = rings.end() - 1;
+        }
+        ring->measurements.push_back(std::move(measurement));
+    }
+
+    if (rings.empty()) {
+        AUDEO_THROW(audeo::exception("Audeo: No HRIR files found"));
+        return false;
+    }
+
+    hrir_length = std::min(hrir_length, max_hrir_length);
+    std::sort(rings.begin(), rings.end(),
+              [](Ring const& a, Ring const& b) { return a.elevation < b.elevation; });
+    for (Ring& ring : rings) {
+        std::sort(ring.measurements.begin(), ring.measurements.end(),
+                  [](Measurement const& a, Measurement const& b) { return a.azimuth < b.azimuth; });
+    }
+
+    return true;
+}
+
+void HrtfSet::interpolate_ring(Ring const& ring,
+                               float azimuth,
+                               float weight,
+                               HrirFilter& out) const {
+    auto const& measurements = ring.measurements;
+    // Find the two measurements surrounding the azimuth, wrapping around at 360
+    auto upper = std::upper_bound(
+        measurements.begin(), measurements.end(), azimuth,
+        [](float az, Measurement const& m) { return az < m.azimuth; });
+    Measurement const& b = upper == measurements.end() ? measurements.front() : *upper;
+    Measurement const& a = upper == measurements.begin() ? measurements.back() : *(upper - 1);
+
+    float span = b.azimuth - a.azimuth;
+    float offset = azimuth - a.azimuth;
+    if (span <= 0.0f)
+        span += 360.0f;
+    if (offset < 0.0f)
+        offset += 360.0f;
+    float const t = span > 0.0f ? std::min(offset / span, 1.0f) : 0.0f;
+
+    auto accumulate = [&](Measurement const& m, float w) {
+        int const n = std::min(hrir_length, static_cast<int>(m.left.size()));
+        // Store reversed, see HrirFilter
+        for (int i = 0; i < n; ++i) {
+            out.left[max_hrir_length - 1 - i] += m.left[i] * w;
+            out.right[max_hrir_length - 1 - i] += m.right[i] * w;
+        }
+    };
+    accumulate(a, weight * (1.0f - t));
+    if (&a != &b) {
+        accumulate(b, weight * t);
+    }
+}
+
+HrirFilter const* HrtfSet::filter(float azimuth, float elevation) {
+    if (rings.empty()) {
+        return nullptr;
+    }
+
+    constexpr int azimuth_steps = static_cast<int>(360 / azimuth_quantum);
+    int const quantized_azimuth =
+        (static_cast<int>(std::lround(azimuth / azimuth_quantum)) % azimuth_steps + azimuth_steps) %
+        azimuth_steps;
+    int const quantized_elevation = static_cast<int>(std::lround(elevation / elevation_quantum));
+    int const key = quantized_elevation * azimuth_steps + quantized_azimuth;
+    if (auto it = cache.find(key); it != cache.end()) {
+        return &it->second;
+    }
+
+    float const az = quantized_azimuth * azimuth_quantum;
+    float const el = std::clamp(quantized_elevation * elevation_quantum, rings.front().elevation,
+                                rings.back().elevation);
+
+    HrirFilter result;
+    // Find the two elevation rings around this direction and blend them
+    auto upper = std::lower_bound(rings.begin(), rings.end(), el,
+                                  [](Ring const& r, float e) { return r.elevation < e; });
+    if (upper == rings.end()) {
+        --upper;
+    }
+    if (upper == rings.begin() || upper->elevation == el) {
+        interpolate_ring(*upper, az, 1.0f, result);
+    } else {
+        Ring const& below = *(upper - 1);
+        float const t = (el - below.elevation) / (upper->elevation - below.elevation);
+        interpolate_ring(below, az, 1.0f - t, result);
+        interpolate_ring(*upper, az, t, result);
+    }
+
+    return &cache.emplace(key, result).first->second;
+}
+
+void hrtf_process(HrtfVoice& voice, int length, float* frames, int frame_count, HrtfWork& work) {
+    constexpr int history_length = max_hrir_length - 1;
+
+    if (!voice.current) {
+        return;
+    }
+
+    std::copy(voice.history.begin(), voice.history.end(), work.begin());
+    for (int i = 0; i < frame_count; ++i) {
+        work[history_length + i] = 0.5f * (frames[2 * i] + frames[2 * i + 1]);
+    }
+
+    int const offset = max_hrir_length - length;
+    auto convolve = [&](std::array<float, max_hrir_length> const& h, int n) {
+        float const* x = work.data() + n + offset;
+        float sum = 0.0f;
+        for (int j = 0; j < length; ++j) { sum += h[max_hrir_length - length + j] * x[j]; }
+        return sum;
+    };
+
+    bool const crossfade = voice.previous && voice.previous != voice.current;
+    for (int n = 0; n < frame_count; ++n) {
+        float const t = static_cast<float>(n + 1) / frame_count;
+        float const gain = voice.previous_gain + (voice.gain - voice.previous_gain) * t;
+        float left = convolve(voice.current->left, n);
+        float right = convolve(voice.current->right, n);
+        if (crossfade) {
+            float const old_left = convolve(voice.previous->left, n);
+            float const old_right = convolve(voice.previous->right, n);
+            left = old_left + (left - old_left) * t;
+            right = old_right + (right - old_right) * t;
+        }
+        frames[2 * n] = left * gain;
+        frames[2 * n + 1] = right * gain;
+    }
+
+    std::copy(work.begin() + frame_count, work.begin() + frame_count + history_length,
+              voice.history.begin());
+    voice.previous = voice.current;
+    voice.previous_gain = voice.gain;
+}
+
+} // namespace audeo::detail
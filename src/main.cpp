@@ -51,7 +51,7 @@ int test_main() {
 
         audeo::set_listener_forward(0, 0, 1);
 
-        audeo::set_sound_finish_callback([](audeo::Sound snd) {
+        audeo::set_sound_finish_callback([](audeo::Sound snd, void*) {
             std::cout << "Finished playing sound with ID " << snd.value()
                       << "\n";
         });
@@ -0,0 +1,369 @@
+#include "audeo/mixer.hpp"
+#include "audeo/trace.hpp"
+
+#include <SDL.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace audeo::detail {
+
+namespace {
+
+// Applies Mix_SetPosition()'s gains. Mono output only has the distance
+void position_effect(int, void* stream, int length, void* user_data) {
+    auto const& gains = *static_cast<PositionGains const*>(user_data);
+    auto* samples = static_cast<float*>(stream);
+    int const count = length / static_cast<int>(sizeof(float));
+    if (gains.channels != 2) {
+        for (int i = 0; i < count; ++i) {
+            samples[i] *= gains.distance;
+        }
+        return;
+    }
+    float const left = gains.left * gains.distance;
+    float const right = gains.right * gains.distance;
+    for (int i = 0; i + 1 < count; i += 2) {
+        samples[i] *= left;
+        samples[i + 1] *= right;
+    }
+}
+
+void reverse_stereo_effect(int, void* stream, int length, void*) {
+    auto* samples = static_cast<float*>(stream);
+    int const count = length / static_cast<int>(sizeof(float));
+    for (int i = 0; i + 1 < count; i += 2) {
+        std::swap(samples[i], samples[i + 1]);
+    }
+}
+
+} // namespace
+
+void Mixer::open_software(int frequency, int channels) {
+    software = true;
+    this->frequency = frequency;
+    output_channels = channels;
+    mixed_frames = 0;
+    this->channels.clear();
+    post_effects.clear();
+}
+
+void Mixer::close_software() {
+    software = false;
+    channels.clear();
+    post_effects.clear();
+    post_mix = nullptr;
+}
+
+void Mixer::lock() {
+    if (software) {
+        mutex.lock();
+    } else {
+        SDL_LockAudio();
+    }
+}
+
+void Mixer::unlock() {
+    if (software) {
+        mutex.unlock();
+    } else {
+        SDL_UnlockAudio();
+    }
+}
+
+Uint32 Mixer::ticks() const {
+    if (!software) {
+        return SDL_GetTicks();
+    }
+    return static_cast<Uint32>(mixed_frames * 1000 / frequency);
+}
+
+int Mixer::allocate_channels(int count) {
+    if (!software) {
+        return Mix_AllocateChannels(count);
+    }
+    std::lock_guard lock(mutex);
+    if (count < 0) {
+        return static_cast<int>(channels.size());
+    }
+    // Like SDL_Mixer, channels that are dropped are halted first
+    for (int channel = count; valid(channel); ++channel) {
+        halt_channel(channel);
+    }
+    channels.resize(count);
+    for (Channel& channel : channels) {
+        channel.position.channels = output_channels;
+    }
+    return count;
+}
+
+int Mixer::play_channel(int channel, Mix_Chunk* chunk, int loops) {
+    if (!software) {
+        return Mix_PlayChannel(channel, chunk, loops);
+    }
+    std::lock_guard lock(mutex);
+    if (!valid(channel)) {
+        return -1;
+    }
+    halt_channel(channel);
+    Channel& c = channels[channel];
+    c.chunk = chunk;
+    c.playing = true;
+    c.offset = 0;
+    c.loops = loops;
+    c.paused = false;
+    return channel;
+}
+
+int Mixer::halt_channel(int channel) {
+    if (!software) {
+        return Mix_HaltChannel(channel);
+    }
+    std::lock_guard lock(mutex);
+    if (valid(channel) && channels[channel].playing) {
+        channels[channel].playing = false;
+        channels[channel].loops = 0;
+        done_playing(channel);
+    }
+    return 0;
+}
+
+void Mixer::pause(int channel) {
+    if (!software) {
+        Mix_Pause(channel);
+        return;
+    }
+    std::lock_guard lock(mutex);
+    if (valid(channel) && channels[channel].playing) {
+        channels[channel].paused = true;
+    }
+}
+
+void Mixer::resume(int channel) {
+    if (!software) {
+        Mix_Resume(channel);
+        return;
+    }
+    std::lock_guard lock(mutex);
+    if (valid(channel)) {
+        channels[channel].paused = false;
+    }
+}
+
+int Mixer::paused(int channel) {
+    if (!software) {
+        return Mix_Paused(channel);
+    }
+    std::lock_guard lock(mutex);
+    return valid(channel) && channels[channel].paused;
+}
+
+int Mixer::playing(int channel) {
+    if (!software) {
+        return Mix_Playing(channel);
+    }
+    std::lock_guard lock(mutex);
+    return valid(channel) && channels[channel].playing;
+}
+
+int Mixer::volume(int channel, int volume) {
+    if (!software) {
+        return Mix_Volume(channel, volume);
+    }
+    std::lock_guard lock(mutex);
+    if (!valid(channel)) {
+        return 0;
+    }
+    int const previous = channels[channel].volume;
+    if (volume >= 0) {
+        channels[channel].volume = std::min(volume, MIX_MAX_VOLUME);
+    }
+    return previous;
+}
+
+std::vector<Mixer::Effect>* Mixer::effects_of(int channel) {
+    if (channel == MIX_CHANNEL_POST) {
+        return &post_effects;
+    }
+    return valid(channel) ? &channels[channel].effects : nullptr;
+}
+
+int Mixer::register_effect(int channel, EffectT effect, void* user_data) {
+    if (!software) {
+        return Mix_RegisterEffect(channel, effect, nullptr, user_data);
+    }
+    std::lock_guard lock(mutex);
+    std::vector<Effect>* effects = effects_of(channel);
+    if (!effects) {
+        return 0;
+    }
+    effects->push_back({effect, user_data});
+    return 1;
+}
+
+int Mixer::unregister_effect(int channel, EffectT effect) {
+    if (!software) {
+        return Mix_UnregisterEffect(channel, effect);
+    }
+    std::lock_guard lock(mutex);
+    std::vector<Effect>* effects = effects_of(channel);
+    if (!effects) {
+        return 0;
+    }
+    auto it = std::find_if(effects->begin(), effects->end(),
+                           [effect](Effect const& e) { return e.function == effect; });
+    if (it == effects->end()) {
+        return 0;
+    }
+    effects->erase(it);
+    return 1;
+}
+
+int Mixer::unregister_all_effects(int channel) {
+    if (!software) {
+        return Mix_UnregisterAllEffects(channel);
+    }
+    std::lock_guard lock(mutex);
+    std::vector<Effect>* effects = effects_of(channel);
+    if (!effects) {
+        return 0;
+    }
+    effects->clear();
+    return 1;
+}
+
+int Mixer::set_position(int channel, Sint16 angle, Uint8 distance) {
+    if (!software) {
+        return Mix_SetPosition(channel, angle, distance);
+    }
+    std::lock_guard lock(mutex);
+    if (!valid(channel)) {
+        return 0;
+    }
+    if (angle == 0 && distance == 0) {
+        // No effect at all, like in SDL_Mixer
+        unregister_effect(channel, position_effect);
+        return 1;
+    }
+    // SDL_Mixer's stereo law. Angle 0 is in front, and 90 to the right. Only
+    // the channel on the far side is attenuated
+    PositionGains& gains = channels[channel].position;
+    int const degrees = std::abs(angle) % 360;
+    gains.left = 1.0f;
+    gains.right = 1.0f;
+    if (degrees < 90) {
+        gains.left = 1.0f - degrees / 89.0f;
+    } else if (degrees < 180) {
+        gains.left = (degrees - 90) / 89.0f;
+    } else if (degrees < 270) {
+        gains.right = 1.0f - (degrees - 180) / 89.0f;
+    } else {
+        gains.right = (degrees - 270) / 89.0f;
+    }
+    gains.left = std::clamp(gains.left, 0.0f, 1.0f);
+    gains.right = std::clamp(gains.right, 0.0f, 1.0f);
+    gains.distance = (255 - distance) / 255.0f;
+
+    std::vector<Effect>& effects = channels[channel].effects;
+    bool const registered = std::any_of(effects.begin(), effects.end(), [](Effect const& e) {
+        return e.function == position_effect;
+    });
+    if (!registered) {
+        effects.push_back({position_effect, &gains});
+    }
+    return 1;
+}
+
+int Mixer::set_reverse_stereo(int channel, int flip) {
+    if (!software) {
+        return Mix_SetReverseStereo(channel, flip);
+    }
+    std::lock_guard lock(mutex);
+    if (!valid(channel) || output_channels != 2) {
+        return 0;
+    }
+    unregister_effect(channel, reverse_stereo_effect);
+    if (flip) {
+        register_effect(channel, reverse_stereo_effect, nullptr);
+    }
+    return 1;
+}
+
+void Mixer::set_post_mix(PostMixT callback, void* user_data) {
+    std::lock_guard lock(mutex);
+    post_mix = callback;
+    post_mix_data = user_data;
+}
+
+void Mixer::mix(Uint8* stream, int length) {
+    AUDEO_TRACE_SCOPE("Mixer::mix");
+    std::lock_guard lock(mutex);
+    if (scratch.size() < static_cast<std::size_t>(length)) {
+        scratch.resize(length);
+    }
+    std::fill_n(reinterpret_cast<float*>(stream), length / sizeof(float), 0.0f);
+
+    for (std::size_t i = 0; i < channels.size(); ++i) {
+        if (channels[i].playing && !channels[i].paused) {
+            mix_channel(static_cast<int>(i), stream, length);
+        }
+    }
+    run_effects(MIX_CHANNEL_POST, stream, length);
+    if (post_mix) {
+        post_mix(post_mix_data, stream, length);
+    }
+    mixed_frames += static_cast<std::uint64_t>(length) / (sizeof(float) * output_channels);
+}
+
+void Mixer::run_effects(int channel, Uint8* stream, int length) {
+    std::vector<Effect>* effects = effects_of(channel);
+    // Effects may unregister effects of their channel while they run
+    for (std::size_t i = 0; effects && i < effects->size(); ++i) {
+        Effect const effect = (*effects)[i];
+        effect.function(channel, stream, length, effect.user_data);
+    }
+}
+
+void Mixer::mix_channel(int index, Uint8* stream, int length) {
+    Channel& channel = channels[index];
+    int done = 0;
+    while (channel.playing && done < length) {
+        Mix_Chunk* chunk = channel.chunk;
+        if (channel.offset >= chunk->alen) {
+            // Empty chunks finish right away, instead of looping forever
+            if (channel.loops == 0 || chunk->alen == 0) {
+                channel.playing = false;
+                done_playing(index);
+                break;
+            }
+            if (channel.loops > 0) {
+                --channel.loops;
+            }
+            channel.offset = 0;
+        }
+        int const count =
+            static_cast<int>(std::min<Uint32>(length - done, chunk->alen - channel.offset));
+        std::memcpy(scratch.data(), chunk->abuf + channel.offset, count);
+        run_effects(index, scratch.data(), count);
+
+        float const gain = static_cast<float>(channel.volume * chunk->volume / MIX_MAX_VOLUME) /
+                           MIX_MAX_VOLUME;
+        auto const* in = reinterpret_cast<float const*>(scratch.data());
+        auto* out = reinterpret_cast<float*>(stream + done);
+        for (std::size_t i = 0; i < count / sizeof(float); ++i) {
+            out[i] += in[i] * gain;
+        }
+        channel.offset += count;
+        done += count;
+        if (channel.offset >= chunk->alen && channel.loops == 0) {
+            channel.playing = false;
+            done_playing(index);
+        }
+    }
+}
+
+// Like SDL_Mixer, a channel's effects are dropped when it stops playing
+void Mixer::done_playing(int channel) { channels[channel].effects.clear(); }
+
+} // namespace audeo::detail
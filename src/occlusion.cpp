@@ -0,0 +1,171 @@
+#include "audeo/occlusion.hpp"
+#include "audeo/trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+namespace audeo::detail {
+
+namespace {
+
+constexpr float pi = 3.14159265358979323846f;
+
+float distance(vec3f a, vec3f b) { return magnitude(a - b); }
+
+} // namespace
+
+void occlusion_process(OcclusionVoice& voice,
+                       OcclusionSettings const& settings,
+                       int frequency,
+                       int channels,
+                       float* frames,
+                       int frame_count) {
+    if (voice.current == 0.0f && voice.target == 0.0f) {
+        return;
+    }
+
+    // One pole smoothing of the occlusion value, advanced once per block
+    float const block_ms = 1000.0f * frame_count / frequency;
+    float const smoothing =
+        settings.smoothing_ms > 0 ? 1.0f - std::exp(-block_ms / settings.smoothing_ms) : 1.0f;
+    float const from = voice.current;
+    voice.current += (voice.target - voice.current) * smoothing;
+    if (std::abs(voice.current - voice.target) < 1e-4f) {
+        voice.current = voice.target;
+    }
+
+    // Coefficient of a one pole low-pass at the occluded cutoff. An unoccluded
+    // voice uses a coefficient of 1, which passes the signal unchanged
+    float const occluded_coefficient =
+        1.0f - std::exp(-2.0f * pi * settings.occluded_cutoff_hz / frequency);
+
+    for (int n = 0; n < frame_count; ++n) {
+        float const t = static_cast<float>(n + 1) / frame_count;
+        float const amount = from + (voice.current - from) * t;
+        float const gain = 1.0f + (settings.occluded_volume - 1.0f) * amount;
+        float const coefficient = 1.0f + (occluded_coefficient - 1.0f) * amount;
+        float* frame = frames + n * channels;
+        for (int c = 0; c < channels; ++c) {
+            voice.lowpass[c] += (frame[c] - voice.lowpass[c]) * coefficient;
+            frame[c] = voice.lowpass[c] * gain;
+        }
+    }
+}
+
+OcclusionWorker::OcclusionWorker(OcclusionQueryT query, OcclusionSettings settings, PublishT publish) :
+    query(std::move(query)),
+    occlusion_settings(settings),
+    publish(std::move(publish)),
+    worker(&OcclusionWorker::run, this) {}
+
+OcclusionWorker::~OcclusionWorker() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void OcclusionWorker::track(Sound sound, vec3f position) {
+    std::lock_guard lock(mutex);
+    Emitter emitter;
+    emitter.position = position;
+    emitters[sound] = emitter;
+}
+
+void OcclusionWorker::move(Sound sound, vec3f position) {
+    std::lock_guard lock(mutex);
+    if (auto it = emitters.find(sound); it != emitters.end()) {
+        it->second.position = position;
+    }
+}
+
+void OcclusionWorker::untrack(Sound sound) {
+    std::lock_guard lock(mutex);
+    emitters.erase(sound);
+}
+
+void OcclusionWorker::set_listeners(std::vector<vec3f> positions) {
+    std::lock_guard lock(mutex);
+    listeners = std::move(positions);
+}
+
+std::optional<float> OcclusionWorker::occlusion(Sound sound) {
+    std::lock_guard lock(mutex);
+    if (auto it = emitters.find(sound); it != emitters.end()) {
+        return it->second.occlusion;
+    }
+    return std::nullopt;
+}
+
+void OcclusionWorker::run() {
+    AUDEO_TRACE_THREAD("audeo occlusion worker");
+    struct Job {
+        Sound sound;
+        vec3f position;
+        vec3f listener;
+    };
+    std::vector<Job> jobs;
+    std::vector<std::pair<Sound, float>> changed;
+
+    std::unique_lock lock(mutex);
+    while (!stopping) {
+        // Collect every emitter that moved far enough since its last query
+        jobs.clear();
+        for (auto const& [sound, emitter] : emitters) {
+            // Sounds are only heard through their nearest listener
+            vec3f listener_position = listeners.empty() ? vec3f{} : listeners[0];
+            for (vec3f const& candidate : listeners) {
+                if (distance(emitter.position, candidate) < distance(emitter.position, listener_position)) {
+                    listener_position = candidate;
+                }
+            }
+            if (!emitter.queried ||
+                distance(emitter.position, emitter.queried_position) > occlusion_settings.movement_threshold ||
+                distance(listener_position, emitter.queried_listener) >
+                    occlusion_settings.movement_threshold) {
+                jobs.push_back({sound, emitter.position, listener_position});
+            }
+        }
+
+        // Run the queries without holding the lock, they may be expensive
+        lock.unlock();
+        std::vector<float> results;
+        results.reserve(jobs.size());
+        for (Job const& job : jobs) {
+            results.push_back(std::clamp(query(job.listener, job.position), 0.0f, 1.0f));
+        }
+        lock.lock();
+
+        changed.clear();
+        for (std::size_t i = 0; i < jobs.size(); ++i) {
+            auto it = emitters.find(jobs[i].sound);
+            // The sound may have stopped while we were querying
+            if (it == emitters.end()) {
+                continue;
+            }
+            Emitter& emitter = it->second;
+            emitter.queried = true;
+            emitter.queried_position = jobs[i].position;
+            emitter.queried_listener = jobs[i].listener;
+            if (emitter.occlusion != results[i]) {
+                emitter.occlusion = results[i];
+                changed.emplace_back(it->first, results[i]);
+            }
+        }
+
+        // Publishing locks the audio device, and the audio thread calls
+        // untrack() when a sound finishes. Never hold both locks at once
+        lock.unlock();
+        for (auto const& [sound, occlusion] : changed) { publish(sound, occlusion); }
+        lock.lock();
+
+        wake.wait_for(lock, std::chrono::milliseconds(occlusion_settings.update_interval_ms),
+                      [this] { return stopping; });
+    }
+}
+
+} // namespace audeo::detail
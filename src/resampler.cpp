@@ -0,0 +1,139 @@
+#include "audeo/resampler.hpp"
+
+#define _USE_MATH_DEFINES
+#include <array>
+#include <cmath>
+#include <mutex>
+
+namespace audeo::detail {
+
+namespace {
+
+// Filters for downsampling need a lower cutoff frequency to avoid aliasing.
+// Instead of computing a filter per pitch value, we quantize the cutoff into a
+// fixed amount of buckets that are all computed up front.
+constexpr int cutoff_buckets = 16;
+
+// One extra phase so that interpolating between phase p and p + 1 never reads
+// out of bounds
+using SincTable = std::array<std::array<float, sinc_taps>, sinc_phases + 1>;
+
+std::array<SincTable, cutoff_buckets> sinc_tables;
+// Every engine initializes the tables, possibly from different threads
+std::once_flag tables_initialized;
+
+double sinc(double x) {
+    if (std::abs(x) < 1e-9) {
+        return 1.0;
+    }
+    return std::sin(M_PI * x) / (M_PI * x);
+}
+
+double blackman(double x) {
+    // x is in range [-1, 1], with the window peaking at 0
+    double const n = (x + 1.0) * 0.5;
+    return 0.42 - 0.5 * std::cos(2.0 * M_PI * n) + 0.08 * std::cos(4.0 * M_PI * n);
+}
+
+void compute_table(SincTable& table, double cutoff) {
+    for (int phase = 0; phase <= sinc_phases; ++phase) {
+        double const frac = static_cast<double>(phase) / sinc_phases;
+        double sum = 0.0;
+        for (int tap = 0; tap < sinc_taps; ++tap) {
+            // Distance between this tap and the interpolated position
+            double const x = (tap - resample_padding_before) - frac;
+            double const w = blackman(x / (sinc_half_taps + 1));
+            double const h = cutoff * sinc(cutoff * x) * w;
+            table[phase][tap] = static_cast<float>(h);
+            sum += h;
+        }
+        // Normalize so that the filter has unity gain at DC
+        for (float& coefficient : table[phase]) {
+            coefficient = static_cast<float>(coefficient / sum);
+        }
+    }
+}
+
+SincTable const& table_for_step(double step) {
+    if (step <= 1.0) {
+        return sinc_tables[cutoff_buckets - 1];
+    }
+    int bucket = static_cast<int>(cutoff_buckets / step) - 1;
+    if (bucket < 0)
+        bucket = 0;
+    return sinc_tables[bucket];
+}
+
+void resample_linear(float const* in,
+                     int channels,
+                     double start,
+                     double step,
+                     float* out,
+                     std::size_t out_frames) {
+    double pos = start;
+    for (std::size_t i = 0; i < out_frames; ++i, pos += step) {
+        auto const index = static_cast<std::ptrdiff_t>(std::floor(pos));
+        float const frac = static_cast<float>(pos - index);
+        float const* a = in + (index + resample_padding_before) * channels;
+        float const* b = a + channels;
+        for (int c = 0; c < channels; ++c) { out[i * channels + c] = a[c] + (b[c] - a[c]) * frac; }
+    }
+}
+
+void resample_sinc(float const* in,
+                   int channels,
+                   double start,
+                   double step,
+                   float* out,
+                   std::size_t out_frames) {
+    SincTable const& table = table_for_step(step);
+    double pos = start;
+    for (std::size_t i = 0; i < out_frames; ++i, pos += step) {
+        auto const index = static_cast<std::ptrdiff_t>(std::floor(pos));
+        double const phase_pos = (pos - index) * sinc_phases;
+        int const phase = static_cast<int>(phase_pos);
+        float const phase_frac = static_cast<float>(phase_pos - phase);
+
+        auto const& lo = table[phase];
+        auto const& hi = table[phase + 1];
+        // The first tap is located resample_padding_before frames before the
+        // interpolated position, which is exactly where in[index] is stored
+        float const* frame = in + index * channels;
+        for (int c = 0; c < channels; ++c) { out[i * channels + c] = 0.0f; }
+        for (int tap = 0; tap < sinc_taps; ++tap) {
+            float const coefficient = lo[tap] + (hi[tap] - lo[tap]) * phase_frac;
+            for (int c = 0; c < channels; ++c) {
+                out[i * channels + c] += frame[tap * channels + c] * coefficient;
+            }
+        }
+    }
+}
+
+} // namespace
+
+void init_resampler_tables() {
+    std::call_once(tables_initialized, [] {
+        for (int bucket = 0; bucket < cutoff_buckets; ++bucket) {
+            // Keep a small transition band below the new Nyquist frequency
+            double const cutoff = 0.95 * (bucket + 1) / cutoff_buckets;
+            compute_table(sinc_tables[bucket], cutoff);
+        }
+    });
+}
+
+void resample(float const* in,
+              int channels,
+              double start,
+              double step,
+              ResampleQuality quality,
+              float* out,
+              std::size_t out_frames) {
+    switch (quality) {
+        case ResampleQuality::Linear:
+            resample_linear(in, channels, start, step, out, out_frames);
+            break;
+        case ResampleQuality::Sinc: resample_sinc(in, channels, start, step, out, out_frames); break;
+    }
+}
+
+} // namespace audeo::detail
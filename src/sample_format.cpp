@@ -0,0 +1,127 @@
+#include "audeo/sample_format.hpp"
+
+#include <SDL_audio.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace audeo::detail {
+
+namespace {
+
+std::uint16_t load16(std::uint8_t const* bytes, bool big_endian) {
+    if (big_endian) {
+        return static_cast<std::uint16_t>((bytes[0] << 8) | bytes[1]);
+    }
+    return static_cast<std::uint16_t>((bytes[1] << 8) | bytes[0]);
+}
+
+void store16(std::uint8_t* bytes, std::uint16_t value, bool big_endian) {
+    if (big_endian) {
+        bytes[0] = static_cast<std::uint8_t>(value >> 8);
+        bytes[1] = static_cast<std::uint8_t>(value & 0xFF);
+    } else {
+        bytes[0] = static_cast<std::uint8_t>(value & 0xFF);
+        bytes[1] = static_cast<std::uint8_t>(value >> 8);
+    }
+}
+
+std::uint32_t load32(std::uint8_t const* bytes, bool big_endian) {
+    if (big_endian) {
+        return (static_cast<std::uint32_t>(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) |
+               bytes[3];
+    }
+    return (static_cast<std::uint32_t>(bytes[3]) << 24) | (bytes[2] << 16) | (bytes[1] << 8) |
+           bytes[0];
+}
+
+void store32(std::uint8_t* bytes, std::uint32_t value, bool big_endian) {
+    for (int i = 0; i < 4; ++i) {
+        int const shift = big_endian ? 24 - 8 * i : 8 * i;
+        bytes[i] = static_cast<std::uint8_t>((value >> shift) & 0xFF);
+    }
+}
+
+} // namespace
+
+std::size_t sample_size(std::uint16_t format) { return SDL_AUDIO_BITSIZE(format) / 8; }
+
+void to_float(std::uint16_t format, void const* in, float* out, std::size_t count) {
+    auto const* bytes = static_cast<std::uint8_t const*>(in);
+
+    // Fast path for the default SDL_Mixer format
+    if (format == AUDIO_S16SYS) {
+        auto const* samples = static_cast<std::int16_t const*>(in);
+        for (std::size_t i = 0; i < count; ++i) { out[i] = samples[i] * (1.0f / 32768.0f); }
+        return;
+    }
+
+    bool const big_endian = SDL_AUDIO_ISBIGENDIAN(format);
+    bool const is_signed = SDL_AUDIO_ISSIGNED(format);
+    if (SDL_AUDIO_BITSIZE(format) == 8) {
+        for (std::size_t i = 0; i < count; ++i) {
+            int value = is_signed ? static_cast<std::int8_t>(bytes[i]) : bytes[i] - 128;
+            out[i] = value * (1.0f / 128.0f);
+        }
+    } else if (SDL_AUDIO_BITSIZE(format) == 32) {
+        bool const is_float = SDL_AUDIO_ISFLOAT(format);
+        for (std::size_t i = 0; i < count; ++i) {
+            std::uint32_t raw = load32(bytes + 4 * i, big_endian);
+            if (is_float) {
+                std::memcpy(&out[i], &raw, sizeof(float));
+            } else {
+                out[i] = static_cast<std::int32_t>(raw) * (1.0f / 2147483648.0f);
+            }
+        }
+    } else {
+        for (std::size_t i = 0; i < count; ++i) {
+            std::uint16_t raw = load16(bytes + 2 * i, big_endian);
+            int value = is_signed ? static_cast<std::int16_t>(raw) : raw - 32768;
+            out[i] = value * (1.0f / 32768.0f);
+        }
+    }
+}
+
+void from_float(std::uint16_t format, float const* in, void* out, std::size_t count) {
+    auto* bytes = static_cast<std::uint8_t*>(out);
+
+    if (format == AUDIO_S16SYS) {
+        auto* samples = static_cast<std::int16_t*>(out);
+        for (std::size_t i = 0; i < count; ++i) {
+            float value = std::clamp(in[i], -1.0f, 1.0f) * 32767.0f;
+            samples[i] = static_cast<std::int16_t>(value);
+        }
+        return;
+    }
+
+    bool const big_endian = SDL_AUDIO_ISBIGENDIAN(format);
+    bool const is_signed = SDL_AUDIO_ISSIGNED(format);
+    if (SDL_AUDIO_BITSIZE(format) == 8) {
+        for (std::size_t i = 0; i < count; ++i) {
+            int value = static_cast<int>(std::clamp(in[i], -1.0f, 1.0f) * 127.0f);
+            bytes[i] = is_signed ? static_cast<std::uint8_t>(static_cast<std::int8_t>(value))
+                                 : static_cast<std::uint8_t>(value + 128);
+        }
+    } else if (SDL_AUDIO_BITSIZE(format) == 32) {
+        bool const is_float = SDL_AUDIO_ISFLOAT(format);
+        for (std::size_t i = 0; i < count; ++i) {
+            float const value = std::clamp(in[i], -1.0f, 1.0f);
+            std::uint32_t raw;
+            if (is_float) {
+                std::memcpy(&raw, &value, sizeof(float));
+            } else {
+                raw = static_cast<std::uint32_t>(static_cast<std::int32_t>(value * 2147483647.0));
+            }
+            store32(bytes + 4 * i, raw, big_endian);
+        }
+    } else {
+        for (std::size_t i = 0; i < count; ++i) {
+            int value = static_cast<int>(std::clamp(in[i], -1.0f, 1.0f) * 32767.0f);
+            std::uint16_t raw = is_signed ? static_cast<std::uint16_t>(static_cast<std::int16_t>(value))
+                                          : static_cast<std::uint16_t>(value + 32768);
+            store16(bytes + 2 * i, raw, big_endian);
+        }
+    }
+}
+
+} // namespace audeo::detail
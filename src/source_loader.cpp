@@ -0,0 +1,150 @@
+#include "audeo/source_loader.hpp"
+#include "audeo/sample_format.hpp"
+#include "audeo/trace.hpp"
+
+#include <SDL.h>
+#include <SDL_mixer.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace audeo::detail {
+
+EffectLoad::~EffectLoad() {
+    if (chunk) {
+        Mix_FreeChunk(chunk);
+    }
+}
+
+namespace {
+
+// Loads a WAV file converted to the format of a load with a frequency
+std::shared_ptr<std::vector<std::uint8_t>> convert_wav(EffectLoad const& load) {
+    SDL_AudioSpec spec;
+    Uint8* buffer = nullptr;
+    Uint32 length = 0;
+    if (!SDL_LoadWAV(load.path.c_str(), &spec, &buffer, &length)) {
+        return nullptr;
+    }
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, load.format,
+                          static_cast<Uint8>(load.channels), load.frequency) < 0) {
+        SDL_FreeWAV(buffer);
+        return nullptr;
+    }
+    auto pcm = std::make_shared<std::vector<std::uint8_t>>(static_cast<std::size_t>(length) *
+                                                           cvt.len_mult);
+    std::memcpy(pcm->data(), buffer, length);
+    SDL_FreeWAV(buffer);
+    std::size_t converted = length;
+    if (cvt.needed) {
+        cvt.buf = pcm->data();
+        cvt.len = static_cast<int>(length);
+        if (SDL_ConvertAudio(&cvt) < 0) {
+            return nullptr;
+        }
+        converted = static_cast<std::size_t>(cvt.len_cvt);
+    }
+    std::size_t const frame_size = sample_size(load.format) * load.channels;
+    pcm->resize(converted - converted % frame_size);
+    return pcm;
+}
+
+} // namespace
+
+void decode_effect(EffectLoad& load) {
+    AUDEO_TRACE_SCOPE("decode_effect");
+    Mix_Chunk* chunk = nullptr;
+    std::shared_ptr<std::vector<std::uint8_t>> pcm;
+    std::uint8_t const* samples = nullptr;
+    std::size_t size = 0;
+    if (load.frequency > 0) {
+        pcm = convert_wav(load);
+        if (!pcm) {
+            return;
+        }
+        samples = pcm->data();
+        size = pcm->size();
+    } else {
+        chunk = Mix_LoadWAV(load.path.c_str());
+        if (!chunk) {
+            return;
+        }
+        samples = chunk->abuf;
+        size = chunk->alen;
+    }
+    if (load.compress) {
+        std::int64_t const frame_count = size / (sample_size(load.format) * load.channels);
+        std::vector<float> decoded(frame_count * load.channels);
+        to_float(load.format, samples, decoded.data(), decoded.size());
+        load.adpcm = adpcm_encode(decoded.data(), load.channels, frame_count);
+        if (chunk) {
+            Mix_FreeChunk(chunk);
+        }
+    } else {
+        load.chunk = chunk;
+        load.pcm = std::move(pcm);
+    }
+    load.loaded = true;
+}
+
+SourceLoader::SourceLoader() : worker(&SourceLoader::run, this) {}
+
+SourceLoader::~SourceLoader() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void SourceLoader::add(std::shared_ptr<EffectLoad> load) {
+    {
+        std::lock_guard lock(mutex);
+        queue.push_back(std::move(load));
+    }
+    wake.notify_all();
+}
+
+void SourceLoader::wait(std::shared_ptr<EffectLoad> const& load) {
+    std::unique_lock lock(mutex);
+    auto const queued = std::find(queue.begin(), queue.end(), load);
+    if (queued != queue.end()) {
+        queue.erase(queued);
+        lock.unlock();
+        decode_effect(*load);
+        lock.lock();
+        load->done = true;
+        return;
+    }
+    finished.wait(lock, [&load] { return load->done; });
+}
+
+bool SourceLoader::is_done(EffectLoad const& load) {
+    std::lock_guard lock(mutex);
+    return load.done;
+}
+
+void SourceLoader::run() {
+    AUDEO_TRACE_THREAD("audeo source loader");
+    std::unique_lock lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) {
+            return;
+        }
+        std::shared_ptr<EffectLoad> load = std::move(queue.front());
+        queue.pop_front();
+
+        // Decoding does file I/O, so don't block add() while doing it
+        lock.unlock();
+        decode_effect(*load);
+        lock.lock();
+        load->done = true;
+        finished.notify_all();
+    }
+}
+
+} // namespace audeo::detail
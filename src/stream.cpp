@@ -0,0 +1,322 @@
+#include "audeo/stream.hpp"
+#include "audeo/sample_format.hpp"
+#include "audeo/trace.hpp"
+
+#include <SDL_audio.h>
+#include <SDL_rwops.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace audeo::detail {
+
+namespace {
+
+// How often the worker tops up the ring buffers. Has to be well below the
+// buffer length, even for sounds played at a high pitch
+constexpr std::chrono::milliseconds stream_poll_interval(10);
+
+// Frames read from the file at once
+constexpr std::size_t stream_read_frames = 1024;
+
+constexpr std::uint16_t wav_format_pcm = 1;
+constexpr std::uint16_t wav_format_float = 3;
+constexpr std::uint16_t wav_format_extensible = 0xFFFE;
+
+bool read_tag(SDL_RWops* file, char const* expected) {
+    char tag[4];
+    return SDL_RWread(file, tag, 1, 4) == 4 && std::memcmp(tag, expected, 4) == 0;
+}
+
+std::uint16_t to_sdl_format(std::uint16_t tag, std::uint16_t bits) {
+    if (tag == wav_format_float) {
+        return bits == 32 ? AUDIO_F32LSB : 0;
+    }
+    switch (bits) {
+        case 8: return AUDIO_U8;
+        case 16: return AUDIO_S16LSB;
+        case 32: return AUDIO_S32LSB;
+        default: return 0;
+    }
+}
+
+bool read_wav_info(SDL_RWops* file, WavInfo& info) {
+    if (!read_tag(file, "RIFF")) {
+        return false;
+    }
+    SDL_ReadLE32(file);
+    if (!read_tag(file, "WAVE")) {
+        return false;
+    }
+
+    bool has_format = false;
+    char id[4];
+    while (SDL_RWread(file, id, 1, 4) == 4) {
+        std::uint32_t const size = SDL_ReadLE32(file);
+        // Chunks are padded to an even size
+        Sint64 const next = SDL_RWtell(file) + size + (size & 1);
+
+        if (std::memcmp(id, "fmt ", 4) == 0) {
+            std::uint16_t tag = SDL_ReadLE16(file);
+            info.channels = SDL_ReadLE16(file);
+            info.sample_rate = static_cast<int>(SDL_ReadLE32(file));
+            SDL_ReadLE32(file); // Bytes per second
+            SDL_ReadLE16(file); // Block align
+            std::uint16_t const bits = SDL_ReadLE16(file);
+            if (tag == wav_format_extensible && size >= 40) {
+                SDL_ReadLE16(file); // Extension size
+                SDL_ReadLE16(file); // Valid bits per sample
+                SDL_ReadLE32(file); // Channel mask
+                // The first two bytes of the sub format GUID are the actual
+                // format tag
+                tag = SDL_ReadLE16(file);
+            }
+            if (tag != wav_format_pcm && tag != wav_format_float) {
+                return false;
+            }
+            info.format = to_sdl_format(tag, bits);
+            has_format = info.format != 0 && info.channels > 0 && info.sample_rate > 0;
+        } else if (std::memcmp(id, "data", 4) == 0) {
+            if (!has_format) {
+                return false;
+            }
+            info.data_offset = SDL_RWtell(file);
+            info.frame_count = size / (sample_size(info.format) * info.channels);
+            return true;
+        }
+
+        if (SDL_RWseek(file, next, RW_SEEK_SET) < 0) {
+            return false;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+bool read_wav_info(std::string_view path, WavInfo& info) {
+    SDL_RWops* file = SDL_RWFromFile(std::string(path).c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    bool const result = read_wav_info(file, info);
+    SDL_RWclose(file);
+    return result;
+}
+
+Stream::Stream(std::string path,
+               WavInfo const& info,
+               int output_channels,
+               int loops,
+               std::int64_t start_frame,
+               int window_frames) :
+    path(std::move(path)),
+    info(info),
+    output_channels(output_channels),
+    loops(loops),
+    file_frame(start_frame),
+    raw(stream_read_frames * sample_size(info.format) * info.channels),
+    converted(stream_read_frames * info.channels),
+    ring(static_cast<std::size_t>(stream_buffer_frames) * output_channels),
+    window(static_cast<std::size_t>(window_frames) * output_channels) {}
+
+Stream::~Stream() {
+    if (file) {
+        SDL_RWclose(file);
+    }
+}
+
+bool Stream::open() {
+    file = SDL_RWFromFile(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    std::int64_t const frame_bytes = sample_size(info.format) * info.channels;
+    return SDL_RWseek(file, info.data_offset + file_frame * frame_bytes, RW_SEEK_SET) >= 0;
+}
+
+std::size_t Stream::decode(float* out, std::size_t frames) {
+    std::size_t const frame_bytes = sample_size(info.format) * info.channels;
+    std::size_t done = 0;
+    while (done < frames) {
+        if (file_frame >= info.frame_count) {
+            if (loops == 0 || info.frame_count == 0) {
+                break;
+            }
+            if (loops > 0) {
+                --loops;
+            }
+            file_frame = 0;
+            SDL_RWseek(file, info.data_offset, RW_SEEK_SET);
+        }
+
+        std::size_t const wanted = std::min(
+            {frames - done, static_cast<std::size_t>(info.frame_count - file_frame), stream_read_frames});
+        std::size_t const got = SDL_RWread(file, raw.data(), frame_bytes, wanted);
+        if (got == 0) {
+            // The file is shorter than its header says. Stop instead of
+            // looping over nothing
+            loops = 0;
+            file_frame = info.frame_count;
+            break;
+        }
+        file_frame += got;
+
+        to_float(info.format, raw.data(), converted.data(), got * info.channels);
+        float* dst = out + done * output_channels;
+        for (std::size_t i = 0; i < got; ++i) {
+            float const* frame = converted.data() + i * info.channels;
+            if (output_channels == 1) {
+                float sum = 0.0f;
+                for (int c = 0; c < info.channels; ++c) { sum += frame[c]; }
+                dst[i] = sum / info.channels;
+            } else {
+                // Mono files play on every channel. Otherwise the file's
+                // channels map to the first output channels
+                for (int c = 0; c < output_channels; ++c) {
+                    float value = 0.0f;
+                    if (info.channels == 1) {
+                        value = frame[0];
+                    } else if (c < info.channels) {
+                        value = frame[c];
+                    }
+                    dst[i * output_channels + c] = value;
+                }
+            }
+        }
+        done += got;
+    }
+    return done;
+}
+
+void Stream::fill() {
+    AUDEO_TRACE_SCOPE("stream_fill");
+    if (decoded_all.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::int64_t const capacity = stream_buffer_frames;
+    std::int64_t head = written.load(std::memory_order_relaxed);
+    std::int64_t space = capacity - (head - consumed.load(std::memory_order_acquire));
+    while (space > 0) {
+        std::int64_t const index = head % capacity;
+        std::size_t const contiguous = static_cast<std::size_t>(std::min(space, capacity - index));
+        std::size_t const got = decode(ring.data() + index * output_channels, contiguous);
+        head += got;
+        space -= got;
+        written.store(head, std::memory_order_release);
+        if (got < contiguous) {
+            decoded_all.store(true, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+bool Stream::read(std::int64_t first, std::int64_t count, float* out) {
+    std::int64_t const capacity = stream_buffer_frames;
+    std::int64_t const keep_from = std::max<std::int64_t>(first, 0);
+    std::int64_t const end = first + count;
+
+    // Drop frames the resampler won't look at again
+    if (keep_from > window_start) {
+        std::int64_t const drop = std::min(keep_from - window_start, window_count);
+        std::memmove(window.data(), window.data() + drop * output_channels,
+                     (window_count - drop) * output_channels * sizeof(float));
+        window_start += drop;
+        window_count -= drop;
+    }
+
+    // Move frames from the ring buffer into the window until it reaches end
+    std::int64_t tail = consumed.load(std::memory_order_relaxed);
+    while (window_start + window_count < end) {
+        std::int64_t available = written.load(std::memory_order_acquire) - tail;
+        if (available == 0) {
+            if (!decoded_all.load(std::memory_order_acquire)) {
+                // The worker fell behind
+                consumed.store(tail, std::memory_order_release);
+                return false;
+            }
+            // Frames may have been written right before the flag was set
+            available = written.load(std::memory_order_acquire) - tail;
+            if (available == 0) {
+                break;
+            }
+        }
+
+        std::int64_t const index = tail % capacity;
+        std::int64_t const next = window_start + window_count;
+        if (window_count == 0 && next < keep_from) {
+            // Skip frames that were decoded but are already behind us
+            std::int64_t const n = std::min({available, capacity - index, keep_from - next});
+            window_start += n;
+            tail += n;
+            continue;
+        }
+        std::int64_t const n = std::min({available, capacity - index, end - next});
+        std::copy_n(ring.data() + index * output_channels, n * output_channels,
+                    window.data() + window_count * output_channels);
+        window_count += n;
+        tail += n;
+    }
+    consumed.store(tail, std::memory_order_release);
+
+    for (std::int64_t frame = first; frame < end; ++frame) {
+        float* dst = out + (frame - first) * output_channels;
+        if (frame < 0 || frame >= window_start + window_count) {
+            std::fill_n(dst, output_channels, 0.0f);
+        } else {
+            std::copy_n(window.data() + (frame - window_start) * output_channels, output_channels,
+                        dst);
+        }
+    }
+    return true;
+}
+
+bool Stream::finished(double position) const {
+    return decoded_all.load(std::memory_order_acquire) &&
+           position >= static_cast<double>(written.load(std::memory_order_acquire));
+}
+
+StreamWorker::StreamWorker() : worker(&StreamWorker::run, this) {}
+
+StreamWorker::~StreamWorker() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void StreamWorker::add(std::shared_ptr<Stream> stream) {
+    {
+        std::lock_guard lock(mutex);
+        added.push_back(std::move(stream));
+    }
+    wake.notify_all();
+}
+
+void StreamWorker::run() {
+    AUDEO_TRACE_THREAD("audeo stream worker");
+    std::vector<std::shared_ptr<Stream>> streams;
+
+    std::unique_lock lock(mutex);
+    while (!stopping) {
+        for (auto& stream : added) { streams.push_back(std::move(stream)); }
+        added.clear();
+
+        // Decoding does file I/O, so don't block add() while doing it
+        lock.unlock();
+        // A stream nobody else references has stopped playing
+        streams.erase(std::remove_if(streams.begin(), streams.end(),
+                                     [](auto const& stream) { return stream.use_count() == 1; }),
+                      streams.end());
+        for (auto& stream : streams) { stream->fill(); }
+        lock.lock();
+
+        wake.wait_for(lock, stream_poll_interval, [this] { return stopping || !added.empty(); });
+    }
+}
+
+} // namespace audeo::detail
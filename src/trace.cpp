@@ -0,0 +1,131 @@
+#include "audeo/trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace audeo::detail {
+
+namespace {
+
+struct TraceSpan {
+    char const* name = nullptr;
+    std::int64_t start_ns = 0;
+    std::int64_t end_ns = 0;
+};
+
+// Ring buffer of a single thread. Only that thread writes to it
+struct ThreadTrace {
+    std::uint32_t thread_id = 0;
+    std::atomic<char const*> name {nullptr};
+    std::array<TraceSpan, trace_buffer_spans> spans;
+    // Only ever increases, the index into spans is the count modulo its size
+    std::atomic<std::uint64_t> written {0};
+};
+
+// Buffers of threads that exited are kept, so their spans still make it into
+// the trace
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadTrace>> registry;
+
+ThreadTrace& this_thread_trace() {
+    thread_local ThreadTrace* trace = [] {
+        std::lock_guard lock(registry_mutex);
+        auto& created = registry.emplace_back(std::make_unique<ThreadTrace>());
+        created->thread_id = static_cast<std::uint32_t>(registry.size());
+        return created.get();
+    }();
+    return *trace;
+}
+
+// Trace event names are string literals, but escape them anyway to always
+// produce valid JSON
+std::string escape(char const* text) {
+    std::string escaped;
+    for (; *text; ++text) {
+        if (*text == '"' || *text == '\\') {
+            escaped += '\\';
+        }
+        escaped += *text;
+    }
+    return escaped;
+}
+
+} // namespace
+
+std::int64_t trace_clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void trace_span(char const* name, std::int64_t start_ns, std::int64_t end_ns) {
+    ThreadTrace& trace = this_thread_trace();
+    std::uint64_t const index = trace.written.load(std::memory_order_relaxed);
+    trace.spans[index % trace_buffer_spans] = TraceSpan {name, start_ns, end_ns};
+    trace.written.store(index + 1, std::memory_order_release);
+}
+
+void trace_thread_name(char const* name) {
+    this_thread_trace().name.store(name, std::memory_order_relaxed);
+}
+
+bool write_trace_file(std::string_view path) {
+    std::FILE* file = std::fopen(std::string(path).c_str(), "w");
+    if (!file) {
+        return false;
+    }
+
+    std::vector<TraceSpan> spans;
+    bool first = true;
+    auto separator = [&first, file] {
+        std::fputs(first ? "\n" : ",\n", file);
+        first = false;
+    };
+
+    std::fputs("{\"traceEvents\":[", file);
+    std::lock_guard lock(registry_mutex);
+    for (auto const& trace : registry) {
+        if (char const* name = trace->name.load(std::memory_order_relaxed)) {
+            separator();
+            std::fprintf(file,
+                         "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                         "\"args\":{\"name\":\"%s\"}}",
+                         trace->thread_id, escape(name).c_str());
+        }
+
+        // The owning thread keeps writing while we copy. Spans it overwrote
+        // in the meantime may be torn, so they are skipped
+        std::uint64_t const end = trace->written.load(std::memory_order_acquire);
+        std::uint64_t const begin = end > trace_buffer_spans ? end - trace_buffer_spans : 0;
+        spans.clear();
+        for (std::uint64_t i = begin; i < end; ++i) {
+            spans.push_back(trace->spans[i % trace_buffer_spans]);
+        }
+        std::uint64_t const after = trace->written.load(std::memory_order_acquire);
+        // A write in progress when after was read may already have overwritten
+        // the oldest of the copied spans, so skip one more
+        std::uint64_t const valid_begin =
+            after >= trace_buffer_spans ? after - trace_buffer_spans + 1 : 0;
+
+        for (std::uint64_t i = std::max(begin, valid_begin); i < end; ++i) {
+            TraceSpan const& span = spans[i - begin];
+            separator();
+            std::fprintf(file,
+                         "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+                         "\"dur\":%.3f}",
+                         escape(span.name).c_str(), trace->thread_id, span.start_ns / 1000.0,
+                         (span.end_ns - span.start_ns) / 1000.0);
+        }
+    }
+    std::fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+    return std::fclose(file) == 0;
+}
+
+} // namespace audeo::detail
@@ -0,0 +1,92 @@
+#include "audeo/vbap.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace audeo::detail {
+
+namespace {
+
+constexpr float pi = 3.14159265358979323846f;
+
+// Marks the LFE channel in the layout tables
+constexpr float lfe = 1000.0f;
+
+// Speaker azimuths in SDL channel order
+constexpr std::array<float, 4> quad_layout = {-45.0f, 45.0f, -135.0f, 135.0f};
+// FL FR FC LFE BL BR, using the ITU-R BS.775 angles
+constexpr std::array<float, 6> surround51_layout = {-30.0f, 30.0f, 0.0f, lfe, -110.0f, 110.0f};
+// FL FR FC LFE BL BR SL SR
+constexpr std::array<float, 8> surround71_layout = {-30.0f, 30.0f,   0.0f,   lfe,
+                                                    -150.0f, 150.0f, -90.0f, 90.0f};
+
+} // namespace
+
+SpeakerLayout::SpeakerLayout(int channels) {
+    std::vector<std::pair<float, int>> speakers;
+    auto add_layout = [&speakers](auto const& layout) {
+        for (std::size_t i = 0; i < layout.size(); ++i) {
+            if (layout[i] != lfe) {
+                speakers.emplace_back(layout[i], static_cast<int>(i));
+            }
+        }
+    };
+    switch (channels) {
+        case 4: add_layout(quad_layout); break;
+        case 6: add_layout(surround51_layout); break;
+        case 8: add_layout(surround71_layout); break;
+        default: return;
+    }
+
+    // Sort speakers around the circle and pair up every neighbour
+    std::sort(speakers.begin(), speakers.end());
+    for (std::size_t i = 0; i < speakers.size(); ++i) {
+        auto const& [azimuth_a, index_a] = speakers[i];
+        auto const& [azimuth_b, index_b] = speakers[(i + 1) % speakers.size()];
+        float const a = azimuth_a * pi / 180.0f;
+        float const b = azimuth_b * pi / 180.0f;
+        // Rows are the speaker direction vectors, x to the right and y to the
+        // front
+        float const m[2][2] = {{std::sin(a), std::cos(a)}, {std::sin(b), std::cos(b)}};
+        float const det = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+        SpeakerPair pair;
+        pair.first = index_a;
+        pair.second = index_b;
+        pair.inverse[0][0] = m[1][1] / det;
+        pair.inverse[0][1] = -m[0][1] / det;
+        pair.inverse[1][0] = -m[1][0] / det;
+        pair.inverse[1][1] = m[0][0] / det;
+        pairs.push_back(pair);
+    }
+}
+
+void SpeakerLayout::pan(float const* azimuths,
+                        float const* distance_gains,
+                        SpeakerGains* out,
+                        std::size_t count) const {
+    for (std::size_t i = 0; i < count; ++i) {
+        float const angle = azimuths[i] * pi / 180.0f;
+        float const x = std::sin(angle);
+        float const y = std::cos(angle);
+        out[i] = SpeakerGains {};
+
+        // The active pair is the one where both gains are positive
+        for (SpeakerPair const& pair : pairs) {
+            float g1 = x * pair.inverse[0][0] + y * pair.inverse[1][0];
+            float g2 = x * pair.inverse[0][1] + y * pair.inverse[1][1];
+            if (g1 < -1e-4f || g2 < -1e-4f) {
+                continue;
+            }
+            g1 = std::max(g1, 0.0f);
+            g2 = std::max(g2, 0.0f);
+            // Normalize for constant power
+            float const scale = distance_gains[i] / std::sqrt(g1 * g1 + g2 * g2);
+            out[i][pair.first] = g1 * scale;
+            out[i][pair.second] = g2 * scale;
+            break;
+        }
+    }
+}
+
+} // namespace audeo::detail
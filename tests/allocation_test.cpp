@@ -0,0 +1,143 @@
+// Checks that playing, stopping and finishing effects doesn't allocate once the
+// engine is warmed up. Uses SDL's dummy audio driver, so no sound card is
+// needed
+
+#include "audeo/audeo.hpp"
+#include "test_wav.hpp"
+
+#include <SDL.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <thread>
+
+namespace {
+
+std::atomic<std::size_t> allocations {0};
+std::atomic<std::size_t> sdl_allocations {0};
+std::thread::id const main_thread = std::this_thread::get_id();
+
+SDL_malloc_func sdl_malloc = nullptr;
+SDL_calloc_func sdl_calloc = nullptr;
+SDL_realloc_func sdl_realloc = nullptr;
+SDL_free_func sdl_free = nullptr;
+
+// Counts the allocations of SDL and SDL_Mixer made by the calls the test makes.
+// Those of the audio thread are not counted: SDL_Mixer copies every channel
+// that has effects into a new buffer in each callback, which audeo can't avoid
+void count_sdl_allocation() {
+    if (std::this_thread::get_id() == main_thread) {
+        ++sdl_allocations;
+    }
+}
+
+void* SDLCALL counting_malloc(std::size_t size) {
+    count_sdl_allocation();
+    return sdl_malloc(size);
+}
+
+void* SDLCALL counting_calloc(std::size_t count, std::size_t size) {
+    count_sdl_allocation();
+    return sdl_calloc(count, size);
+}
+
+void* SDLCALL counting_realloc(void* memory, std::size_t size) {
+    count_sdl_allocation();
+    return sdl_realloc(memory, size);
+}
+
+void SDLCALL forwarding_free(void* memory) { sdl_free(memory); }
+
+void count_finished(audeo::Sound, void* user_data) { ++*static_cast<int*>(user_data); }
+
+} // namespace
+
+// Counts every allocation on every thread, including the audio thread. The
+// array forms forward to these
+void* operator new(std::size_t size) {
+    ++allocations;
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+int main() {
+    // Before SDL allocates anything, so everything it allocates is freed by the
+    // same allocator
+    SDL_GetMemoryFunctions(&sdl_malloc, &sdl_calloc, &sdl_realloc, &sdl_free);
+    SDL_SetMemoryFunctions(counting_malloc, counting_calloc, counting_realloc, forwarding_free);
+
+    char const* const path = "audeo_allocation_test.wav";
+    // A tenth of a second, so sounds also finish on their own
+    if (!audeo::test::write_wav(path, 22050, 2205, 8000)) {
+        std::fprintf(stderr, "Could not write %s\n", path);
+        return 1;
+    }
+
+    try {
+        audeo::InitInfo info;
+        info.frequency = 22050;
+        if (!audeo::init(info)) {
+            std::fprintf(stderr, "Could not initialize audeo\n");
+            return 1;
+        }
+        audeo::SoundSource const source = audeo::load_source(path, audeo::AudioType::Effect);
+        int finished = 0;
+        audeo::set_sound_finish_callback(count_finished, &finished);
+
+        auto play_stop_finish = [source] {
+            audeo::Sound const stopped = audeo::play_sound(source);
+            audeo::stop_sound(stopped);
+            audeo::Sound const played = audeo::play_sound(source);
+            bool const done = audeo::wait_for(played, 2000);
+            audeo::poll_events();
+            return done;
+        };
+
+        // The first plays may allocate, for example to grow the scratch space
+        // of SDL_Mixer or the standard library
+        play_stop_finish();
+        std::size_t const before = allocations;
+        std::size_t const sdl_before = sdl_allocations;
+        int const before_finished = finished;
+        constexpr int rounds = 16;
+        for (int i = 0; i < rounds; ++i) {
+            if (!play_stop_finish()) {
+                std::fprintf(stderr, "A sound did not finish\n");
+                return 1;
+            }
+        }
+        std::size_t const allocated = allocations - before;
+        std::size_t const sdl_allocated = sdl_allocations - sdl_before;
+        int const finish_calls = finished - before_finished;
+        audeo::quit();
+
+        if (allocated != 0) {
+            std::fprintf(stderr, "Playing, stopping and finishing allocated %zu times\n", allocated);
+            return 1;
+        }
+        if (sdl_allocated != 0) {
+            std::fprintf(stderr, "Playing, stopping and finishing allocated %zu times in SDL\n",
+                         sdl_allocated);
+            return 1;
+        }
+        if (finish_calls != 2 * rounds) {
+            std::fprintf(stderr, "Expected %d finish callbacks, got %d\n", 2 * rounds, finish_calls);
+            return 1;
+        }
+    } catch (std::exception const& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::remove(path);
+    return 0;
+}
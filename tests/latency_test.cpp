@@ -0,0 +1,145 @@
+// Checks that scene commands apply at their exact frame: a sound played at
+// frame N is first heard at frame N, and is silent from the frame it is
+// stopped at. Also checks the latency estimates of an engine against the
+// buffers it mixed. Everything is rendered without an audio device
+
+#include "audeo/Engine.hpp"
+#include "audeo/OfflineRender.hpp"
+#include "test_wav.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+namespace {
+
+// First frame with a nonzero sample at or after from, or -1
+std::int64_t first_audible_frame(std::vector<float> const& out, int channels, std::int64_t from) {
+    for (std::int64_t frame = from; frame * channels < static_cast<std::int64_t>(out.size());
+         ++frame) {
+        for (int c = 0; c < channels; ++c) {
+            if (out[frame * channels + c] != 0.0f) {
+                return frame;
+            }
+        }
+    }
+    return -1;
+}
+
+// Checks get_output_latency() and get_time_until_audible() while a sound is
+// queued, mixed and played
+bool check_estimates(char const* path) {
+    audeo::InitInfo info;
+    info.chunk_size = 512;
+    audeo::Engine engine;
+    if (!engine.init_offline(info)) {
+        std::fprintf(stderr, "Could not initialize an engine\n");
+        return false;
+    }
+    double const latency = engine.get_output_latency();
+    double const expected = 1000.0 * info.chunk_size / info.frequency;
+    if (std::abs(latency - expected) > 1e-9) {
+        std::fprintf(stderr, "Output latency is %f ms for %u frames at %u Hz, expected %f\n",
+                     latency, info.chunk_size, info.frequency, expected);
+        return false;
+    }
+
+    audeo::SoundSource const source = engine.load_source(path, audeo::AudioType::Effect);
+    audeo::Sound const sound = engine.play_sound(source);
+    std::vector<float> out(info.chunk_size * 2);
+    auto estimate = [&engine, sound] { return engine.get_time_until_audible(sound).value_or(-1); };
+
+    // Before the first buffer, the sound waits for it to be mixed and played
+    double const queued = estimate();
+    if (std::abs(queued - latency) > 1e-9) {
+        std::fprintf(stderr, "Queued sound is audible in %f ms, expected %f\n", queued, latency);
+        return false;
+    }
+    // Mixed into the buffer that plays next. How long ago it was mixed is
+    // measured on the wall clock
+    engine.render(out.data(), info.chunk_size);
+    double const mixed = estimate();
+    if (mixed < 0.0 || mixed > latency) {
+        std::fprintf(stderr, "Mixed sound is audible in %f ms, expected at most %f\n", mixed,
+                     latency);
+        return false;
+    }
+    // The buffer after it is mixed once it plays
+    engine.render(out.data(), info.chunk_size);
+    double const playing = estimate();
+    if (playing != 0.0) {
+        std::fprintf(stderr, "Playing sound is audible in %f ms, expected 0\n", playing);
+        return false;
+    }
+
+    engine.stop_sound(sound);
+    if (engine.get_time_until_audible(sound) || engine.get_time_until_audible(audeo::Sound())) {
+        std::fprintf(stderr, "Invalid sounds have an estimate\n");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    char const* const path = "audeo_latency_test.wav";
+    if (!audeo::test::write_wav(path, 22050, 22050, 8000)) {
+        std::fprintf(stderr, "Could not write %s\n", path);
+        return 1;
+    }
+
+    // Neither frame is on a callback boundary
+    constexpr std::int64_t play_frame = 1000;
+    constexpr std::int64_t stop_frame = 3001;
+    audeo::Scene scene;
+    scene.sources.emplace_back().path = path;
+    audeo::SceneCommand play;
+    play.type = audeo::SceneCommandType::Play;
+    play.frame = play_frame;
+    scene.commands.push_back(play);
+    audeo::SceneCommand stop;
+    stop.type = audeo::SceneCommandType::Stop;
+    stop.frame = stop_frame;
+    scene.commands.push_back(stop);
+    scene.frame_count = 4096;
+
+    try {
+        for (unsigned int channels : {1u, 2u}) {
+            audeo::OfflineRenderInfo info;
+            info.output_channels = channels;
+            std::vector<float> const out = audeo::render_scenes({scene}, info)[0];
+            int const count = static_cast<int>(channels);
+
+            std::int64_t const first = first_audible_frame(out, count, 0);
+            if (first != play_frame) {
+                std::fprintf(stderr, "%u channels: played at frame %lld, first heard at %lld\n",
+                             channels, static_cast<long long>(play_frame),
+                             static_cast<long long>(first));
+                return 1;
+            }
+            if (out[(stop_frame - 1) * count] == 0.0f) {
+                std::fprintf(stderr, "%u channels: silent before the stop at frame %lld\n",
+                             channels, static_cast<long long>(stop_frame));
+                return 1;
+            }
+            std::int64_t const after_stop = first_audible_frame(out, count, stop_frame);
+            if (after_stop != -1) {
+                std::fprintf(stderr, "%u channels: stopped at frame %lld, still heard at %lld\n",
+                             channels, static_cast<long long>(stop_frame),
+                             static_cast<long long>(after_stop));
+                return 1;
+            }
+        }
+        if (!check_estimates(path)) {
+            return 1;
+        }
+    } catch (std::exception const& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::remove(path);
+    return 0;
+}
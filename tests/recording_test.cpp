@@ -0,0 +1,138 @@
+// Checks that a recording replays the way the engine played it live. An engine
+// without an audio device plays sounds while it records, and the replay of the
+// log has to render the same output. A log of an engine with an occlusion query
+// has to be refused
+
+#include "audeo/Engine.hpp"
+#include "audeo/OfflineRender.hpp"
+#include "test_wav.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+namespace {
+
+char const* const wav_path = "audeo_recording_test.wav";
+char const* const log_path = "audeo_recording_test.log";
+
+// Plays through the calls a replay has to reproduce, and returns the output
+std::vector<float> play_live(audeo::InitInfo const& info) {
+    audeo::Engine engine;
+    if (!engine.init_offline(info) || !engine.start_recording(log_path)) {
+        return {};
+    }
+    std::vector<float> out;
+    auto render = [&engine, &out](std::size_t frames) {
+        std::size_t const offset = out.size();
+        out.resize(offset + frames * 2);
+        engine.render(&out[offset], frames);
+        engine.poll_events();
+    };
+
+    audeo::SoundSource const source =
+        engine.load_source(wav_path, audeo::AudioType::Effect, audeo::SourceCompression::Adpcm);
+    engine.set_default_max_instances(source, 2, audeo::InstanceLimitBehavior::Reject);
+    engine.set_listener_count(2);
+    engine.set_listener_position(1, {20.0f, 0.0f, 0.0f});
+    audeo::Sound const near_second = engine.play_sound(source, audeo::loop_forever);
+    engine.set_position(near_second, {18.0f, 0.0f, 1.0f});
+    render(1000);
+
+    // Pitched, so its resample quality is heard
+    engine.set_pitch(near_second, 1.5f);
+    engine.set_resample_quality(near_second, audeo::ResampleQuality::Sinc);
+    audeo::Emitter const emitter = engine.create_emitter(source, {2.0f, 0.0f, 0.0f});
+    engine.update_emitters();
+    if (std::optional<audeo::Sound> const sound = engine.get_emitter_sound(emitter)) {
+        // Resampled with the default quality
+        engine.set_volume(*sound, 0.5f);
+        engine.set_pitch(*sound, 0.75f);
+    }
+    render(1000);
+
+    // The emitter goes out of range, and its sound is replaced by another one.
+    // Back in range, the instance limit keeps it from playing
+    engine.enable_ambisonics();
+    engine.set_emitter_position(emitter, {500.0f, 0.0f, 0.0f});
+    engine.update_emitters();
+    engine.play_sound(source, audeo::loop_forever);
+    render(500);
+    engine.set_emitter_position(emitter, {0.0f, 0.0f, -3.0f});
+    engine.update_emitters();
+    render(700);
+
+    engine.stop_recording();
+    return out;
+}
+
+} // namespace
+
+int main() {
+    if (!audeo::test::write_wav(wav_path, 22050, 22050, 8000, 7)) {
+        std::fprintf(stderr, "Could not write %s\n", wav_path);
+        return 1;
+    }
+
+    audeo::InitInfo info;
+    info.chunk_size = 256;
+    info.effect_channels = 8;
+    // Not the default, so the replay has to take it from the log
+    info.resample_quality = audeo::ResampleQuality::Linear;
+
+    try {
+        std::vector<float> const live = play_live(info);
+        if (live.empty()) {
+            std::fprintf(stderr, "Could not record\n");
+            return 1;
+        }
+
+        audeo::Scene scene;
+        audeo::OfflineRenderInfo replay_info;
+        if (!audeo::load_recording(log_path, scene, replay_info)) {
+            std::fprintf(stderr, "Could not load the recording\n");
+            return 1;
+        }
+        if (replay_info.resample_quality != info.resample_quality) {
+            std::fprintf(stderr, "The recording lost the resample quality\n");
+            return 1;
+        }
+        std::vector<float> const replay = audeo::render_scenes({scene}, replay_info)[0];
+        if (replay.size() != live.size()) {
+            std::fprintf(stderr, "Replayed %zu samples, played %zu\n", replay.size(), live.size());
+            return 1;
+        }
+        for (std::size_t i = 0; i < live.size(); ++i) {
+            if (std::abs(replay[i] - live[i]) > 1e-6f) {
+                std::fprintf(stderr, "Sample %zu was %f live, and %f in the replay\n", i,
+                             live[i], replay[i]);
+                return 1;
+            }
+        }
+
+        audeo::Engine engine;
+        if (!engine.init_offline(info) || !engine.start_recording(log_path)) {
+            std::fprintf(stderr, "Could not record\n");
+            return 1;
+        }
+        engine.set_occlusion_query([](audeo::vec3f, audeo::vec3f) { return 0.0f; });
+        engine.quit();
+        bool refused = false;
+        try {
+            audeo::load_recording(log_path, scene, replay_info);
+        } catch (std::exception const&) {
+            refused = true;
+        }
+        if (!refused) {
+            std::fprintf(stderr, "A recording with an occlusion query was replayed\n");
+            return 1;
+        }
+    } catch (std::exception const& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::remove(wav_path);
+    std::remove(log_path);
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Checks that get_stats() of an engine and the free get_stats() count the
+// audio callbacks their engine mixed. The engines render without an audio
+// device, so the callbacks are known
+
+#include "audeo/Engine.hpp"
+
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+namespace {
+
+bool check_stats(char const* name, audeo::EngineStats const& stats, unsigned int chunk_size) {
+    if (stats.callbacks != 3) {
+        std::fprintf(stderr, "%s: expected 3 callbacks, got %llu\n", name,
+                     static_cast<unsigned long long>(stats.callbacks));
+        return false;
+    }
+    if (stats.chunk_size != chunk_size) {
+        std::fprintf(stderr, "%s: expected a chunk size of %u, got %u\n", name, chunk_size,
+                     stats.chunk_size);
+        return false;
+    }
+    if (stats.underruns != 0) {
+        std::fprintf(stderr, "%s: an engine without a device reported underruns\n", name);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    audeo::InitInfo info;
+    info.chunk_size = 256;
+    // Two full callbacks and a partial one
+    std::vector<float> out((2 * info.chunk_size + 100) * 2);
+    std::size_t const frames = out.size() / 2;
+
+    try {
+        audeo::Engine engine;
+        if (!engine.init_offline(info)) {
+            std::fprintf(stderr, "Could not initialize an engine\n");
+            return 1;
+        }
+        engine.render(out.data(), frames);
+        if (!check_stats("Engine::get_stats", engine.get_stats(), info.chunk_size)) {
+            return 1;
+        }
+
+        if (!audeo::default_engine().init_offline(info)) {
+            std::fprintf(stderr, "Could not initialize the default engine\n");
+            return 1;
+        }
+        audeo::default_engine().render(out.data(), frames);
+        bool const ok = check_stats("get_stats", audeo::get_stats(), info.chunk_size);
+        audeo::quit();
+        if (!ok) {
+            return 1;
+        }
+    } catch (std::exception const& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
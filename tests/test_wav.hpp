@@ -0,0 +1,47 @@
+#ifndef AUDEO_TEST_WAV_HPP_
+#define AUDEO_TEST_WAV_HPP_
+
+#include <cstdint>
+#include <cstdio>
+
+namespace audeo::test {
+
+// Writes a mono 16 bit WAV file holding frame_count samples of value. If period
+// is not 0, the sign of the samples flips every period frames
+inline bool
+write_wav(char const* path, int frequency, int frame_count, std::int16_t value, int period = 0) {
+    std::FILE* file = std::fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    auto write_u32 = [file](std::uint32_t v) {
+        for (int i = 0; i < 4; ++i) { std::fputc(static_cast<int>((v >> (8 * i)) & 0xff), file); }
+    };
+    auto write_u16 = [file](std::uint16_t v) {
+        std::fputc(v & 0xff, file);
+        std::fputc(v >> 8, file);
+    };
+    std::uint32_t const data_size = static_cast<std::uint32_t>(frame_count) * 2;
+    std::fputs("RIFF", file);
+    write_u32(36 + data_size);
+    std::fputs("WAVEfmt ", file);
+    write_u32(16);
+    // PCM, mono
+    write_u16(1);
+    write_u16(1);
+    write_u32(static_cast<std::uint32_t>(frequency));
+    write_u32(static_cast<std::uint32_t>(frequency) * 2);
+    write_u16(2);
+    write_u16(16);
+    std::fputs("data", file);
+    write_u32(data_size);
+    for (int i = 0; i < frame_count; ++i) {
+        bool const flipped = period != 0 && (i / period) % 2 == 1;
+        write_u16(static_cast<std::uint16_t>(flipped ? -value : value));
+    }
+    return std::fclose(file) == 0;
+}
+
+} // namespace audeo::test
+
+#endif
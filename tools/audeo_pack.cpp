@@ -0,0 +1,139 @@
+// Packs sound files into an audeo sound bank, converted to the output format
+// the game will open the audio device with.
+//
+// Usage: audeo_pack [options] <output.bank> <name=path | path>...
+//   --frequency <hz>    Output frequency, defaults to 22050
+//   --channels <count>  Output channel count, defaults to 2
+//   --format <format>   u8, s8, u16, s16, u16lsb, s16lsb, u16msb or s16msb,
+//                       defaults to s16 (system byte order)
+//   --adpcm             Store the sounds as IMA-ADPCM
+//
+// Sounds given without a name are named after their path.
+
+#include "audeo/adpcm.hpp"
+#include "audeo/bank.hpp"
+#include "audeo/sample_format.hpp"
+
+#define SDL_MAIN_HANDLED
+#include <SDL.h>
+#include <SDL_mixer.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+bool parse_format(std::string_view name, Uint16& format) {
+    struct Format {
+        char const* name;
+        Uint16 format;
+    };
+    constexpr Format formats[] = {{"u8", AUDIO_U8},         {"s8", AUDIO_S8},
+                                  {"u16", AUDIO_U16SYS},    {"s16", AUDIO_S16SYS},
+                                  {"u16lsb", AUDIO_U16LSB}, {"s16lsb", AUDIO_S16LSB},
+                                  {"u16msb", AUDIO_U16MSB}, {"s16msb", AUDIO_S16MSB}};
+    for (Format const& f : formats) {
+        if (name == f.name) {
+            format = f.format;
+            return true;
+        }
+    }
+    return false;
+}
+
+int usage() {
+    std::cerr << "Usage: audeo_pack [--frequency hz] [--channels count] [--format format] "
+                 "[--adpcm] <output.bank> <name=path | path>...\n";
+    return 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int frequency = 22050;
+    int channels = 2;
+    Uint16 format = MIX_DEFAULT_FORMAT;
+    bool adpcm = false;
+    std::vector<std::string> positional;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view const arg = argv[i];
+        bool const has_value = i + 1 < argc;
+        if (arg == "--frequency" && has_value) {
+            frequency = std::atoi(argv[++i]);
+        } else if (arg == "--channels" && has_value) {
+            channels = std::atoi(argv[++i]);
+        } else if (arg == "--format" && has_value) {
+            if (!parse_format(argv[++i], format)) {
+                return usage();
+            }
+        } else if (arg == "--adpcm") {
+            adpcm = true;
+        } else if (arg.substr(0, 2) == "--") {
+            return usage();
+        } else {
+            positional.emplace_back(arg);
+        }
+    }
+    if (positional.size() < 2 || frequency <= 0 || channels <= 0) {
+        return usage();
+    }
+
+    // Decode through SDL_Mixer with the same output format the game will use,
+    // so the bank holds exactly what Mix_LoadWAV would produce at runtime. No
+    // sound is played, so the dummy driver is enough
+    SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+    if (SDL_Init(SDL_INIT_AUDIO) < 0 || Mix_OpenAudio(frequency, format, channels, 4096) == -1) {
+        std::cerr << "Failed to initialize SDL_Mixer: " << Mix_GetError() << "\n";
+        return 1;
+    }
+    Mix_Init(MIX_INIT_FLAC | MIX_INIT_MOD | MIX_INIT_OGG | MIX_INIT_MP3);
+    int opened_channels = 0;
+    Mix_QuerySpec(&frequency, &format, &opened_channels);
+    channels = opened_channels;
+    std::size_t const frame_size = audeo::detail::sample_size(format) * channels;
+
+    std::vector<audeo::detail::BankSound> sounds;
+    for (std::size_t i = 1; i < positional.size(); ++i) {
+        std::string const& arg = positional[i];
+        std::size_t const separator = arg.find('=');
+        std::string const name = separator == std::string::npos ? arg : arg.substr(0, separator);
+        std::string const path = separator == std::string::npos ? arg : arg.substr(separator + 1);
+
+        Mix_Chunk* chunk = Mix_LoadWAV(path.c_str());
+        if (!chunk) {
+            std::cerr << "Failed to load " << path << ": " << Mix_GetError() << "\n";
+            return 1;
+        }
+
+        audeo::detail::BankSound sound;
+        sound.name = name;
+        sound.frame_count = chunk->alen / frame_size;
+        if (adpcm) {
+            std::vector<float> samples(sound.frame_count * channels);
+            audeo::detail::to_float(format, chunk->abuf, samples.data(), samples.size());
+            sound.encoding = audeo::detail::BankEncoding::Adpcm;
+            sound.data = audeo::detail::adpcm_encode(samples.data(), channels,
+                                                     static_cast<std::int64_t>(sound.frame_count))
+                             .data;
+        } else {
+            sound.data.assign(chunk->abuf, chunk->abuf + sound.frame_count * frame_size);
+        }
+        Mix_FreeChunk(chunk);
+        sounds.push_back(std::move(sound));
+    }
+
+    Mix_CloseAudio();
+    Mix_Quit();
+    SDL_Quit();
+
+    if (!audeo::detail::write_bank(positional[0], frequency, format, channels, sounds)) {
+        std::cerr << "Failed to write " << positional[0] << "\n";
+        return 1;
+    }
+    std::cout << "Packed " << sounds.size() << " sounds into " << positional[0] << "\n";
+    return 0;
+}